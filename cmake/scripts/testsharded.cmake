@@ -0,0 +1,18 @@
+#writes a sharded set into a new directory, moves the whole directory, and rewrites the moved set as an ordinary file
+#expects sharded_exe, input_file, work_dir and output_file
+FILE(REMOVE_RECURSE ${work_dir} ${work_dir}-moved)
+FILE(MAKE_DIRECTORY ${work_dir})
+
+EXECUTE_PROCESS(COMMAND ${sharded_exe} WRITE ${input_file} ${work_dir}/matrix.shards ${work_dir}/shard0.nii ${work_dir}/shard1.nii ${work_dir}/shard2.nii
+                RESULT_VARIABLE write_result)
+IF(NOT (${write_result} EQUAL 0))
+    MESSAGE(FATAL_ERROR "writing the sharded set failed")
+ENDIF(NOT (${write_result} EQUAL 0))
+
+FILE(RENAME ${work_dir} ${work_dir}-moved)
+
+EXECUTE_PROCESS(COMMAND ${sharded_exe} READ ${work_dir}-moved/matrix.shards ${output_file}
+                RESULT_VARIABLE read_result)
+IF(NOT (${read_result} EQUAL 0))
+    MESSAGE(FATAL_ERROR "reading the moved sharded set failed")
+ENDIF(NOT (${read_result} EQUAL 0))
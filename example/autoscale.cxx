@@ -0,0 +1,108 @@
+#include "CiftiFile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+using namespace cifti;
+
+/**\file autoscale.cxx
+This program reads a Cifti file from argv[1], and writes it to argv[2] as 8 or 16 bit integers, with the scaling chosen
+from the data as it is written (setWritingDataTypeAutoScaling).  The output file is only written once the range is known,
+which is when the CiftiFile is closed - this program lets it go out of scope instead of calling close(), which also
+finishes the file, but can only print errors instead of throwing them.  It then reads argv[2] back, and checks that
+every value is within half a quantization step of the input.
+
+\include autoscale.cxx
+*/
+
+int main(int argc, char** argv)
+{
+    if (argc < 4)
+    {
+        cout << "usage: " << argv[0] << " <input cifti> <output cifti> <type> [DISK]" << endl;
+        cout << "  rewrite the input cifti file to the output filename with automatic scaling, then check the values read back." << endl;
+        cout << "  type can be 'INT8', 'UINT8', or 'INT16', DISK stages the unscaled data in a temporary file instead of in memory" << endl;
+        return 1;
+    }
+    int16_t type;
+    double typeSteps;
+    if (AString(argv[3]) == "INT8")
+    {
+        type = NIFTI_TYPE_INT8;
+        typeSteps = 255.0;
+    } else if (AString(argv[3]) == "UINT8") {
+        type = NIFTI_TYPE_UINT8;
+        typeSteps = 255.0;
+    } else if (AString(argv[3]) == "INT16") {
+        type = NIFTI_TYPE_INT16;
+        typeSteps = 65535.0;
+    } else {
+        cerr << "unrecognized type string: " << argv[3] << endl;
+        return 1;
+    }
+    bool stageOnDisk = false;
+    if (argc > 4)
+    {
+        if (AString(argv[4]) != "DISK")
+        {
+            cerr << "unrecognized staging string: " << argv[4] << endl;
+            return 1;
+        }
+        stageOnDisk = true;
+    }
+    try
+    {
+        CiftiFile inputFile(argv[1]);
+        const vector<int64_t> dims = inputFile.getDimensions();
+        vector<float> scratchRow(dims[0]), checkRow(dims[0]);
+        float minVal = 0.0f, maxVal = 0.0f;
+        bool first = true;
+        remove(argv[2]);//so a file left by an earlier run can't pass the check
+        {
+            CiftiFile outputFile;
+            outputFile.setWritingFile(argv[2]);
+            outputFile.setWritingDataTypeAutoScaling(type, stageOnDisk);
+            outputFile.setCiftiXML(inputFile.getCiftiXML());
+            for (MultiDimIterator<int64_t> iter = inputFile.getIteratorOverRows(); !iter.atEnd(); ++iter)
+            {
+                inputFile.getRow(scratchRow.data(), *iter);
+                outputFile.setRow(scratchRow.data(), *iter);
+                for (int64_t i = 0; i < dims[0]; ++i)
+                {
+                    if (first)
+                    {
+                        minVal = scratchRow[i];
+                        maxVal = scratchRow[i];
+                        first = false;
+                    }
+                    minVal = min(minVal, scratchRow[i]);
+                    maxVal = max(maxVal, scratchRow[i]);
+                }
+            }
+        }//no close(), the destructor writes the output file
+        double tolerance = 0.5 * (maxVal - minVal) / typeSteps + 1e-5 * max(fabs(minVal), fabs(maxVal));//half a step, plus float rounding of the scale and offset
+        CiftiFile checkFile(argv[2]);
+        if (checkFile.getDimensions() != dims) throw CiftiException("dimensions of output file don't match input");
+        for (MultiDimIterator<int64_t> iter = inputFile.getIteratorOverRows(); !iter.atEnd(); ++iter)
+        {
+            inputFile.getRow(scratchRow.data(), *iter);
+            checkFile.getRow(checkRow.data(), *iter);
+            for (int64_t i = 0; i < dims[0]; ++i)
+            {
+                if (!(fabs(checkRow[i] - scratchRow[i]) <= tolerance))
+                {
+                    cerr << "value read back is " << checkRow[i] << ", expected " << scratchRow[i] << " within " << tolerance << endl;
+                    return 1;
+                }
+            }
+        }
+    } catch (CiftiException& e) {
+        cerr << "Caught CiftiException: " + AString_to_std_string(e.whatString()) << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include "CiftiFile.h"
+#include "Common/ByteSwapping.h"
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+using namespace cifti;
+
+/**\file float16.cxx
+This program reads a Cifti file from argv[1], and writes it out to argv[2] as half precision floats (CIFTILIB_TYPE_FLOAT16).
+It then reopens argv[2], and writes the values it reads back to argv[3] as raw little-endian float32, with no header, so the
+result can be checked without depending on how the XML was formatted.  Half precision is a CiftiLib extension, other nifti
+readers will refuse the file.
+
+\include float16.cxx
+*/
+
+int main(int argc, char** argv)
+{
+    if (argc < 4)
+    {
+        cout << "usage: " << argv[0] << " <input cifti> <output cifti> <output raw> [<endian>]" << endl;
+        cout << "  rewrite the input cifti file to the output filename as half precision, then dump what it reads back as raw float32." << endl;
+        cout << "  endian can be 'LITTLE' or 'BIG', and uses native endianness if not specified" << endl;
+        return 1;
+    }
+    CiftiFile::ENDIAN myEndian = CiftiFile::NATIVE;
+    if (argc > 4)
+    {
+        if (AString(argv[4]) == "LITTLE")
+        {
+            myEndian = CiftiFile::LITTLE;
+        } else if (AString(argv[4]) == "BIG") {
+            myEndian = CiftiFile::BIG;
+        } else {
+            cerr << "unrecognized endianness string: " << argv[4] << endl;
+            return 1;
+        }
+    }
+    try
+    {
+        {
+            CiftiFile inputFile(argv[1]);
+            inputFile.setWritingDataTypeNoScaling(CIFTILIB_TYPE_FLOAT16);//values are rounded to nearest, and overflow to infinity past 65504
+            inputFile.writeFile(argv[2], CiftiVersion(), myEndian);
+        }
+        CiftiFile halfFile(argv[2]);
+        const vector<int64_t>& dims = halfFile.getDimensions();
+        vector<float> scratchRow(dims[0]);
+        ofstream rawFile(argv[3], ios::binary);
+        for (MultiDimIterator<int64_t> iter = halfFile.getIteratorOverRows(); !iter.atEnd(); ++iter)
+        {
+            halfFile.getRow(scratchRow.data(), *iter);
+            if (ByteSwapping::isBigEndian()) ByteSwapping::swapArray(scratchRow.data(), scratchRow.size());//so the output is the same on every machine
+            rawFile.write((const char*)scratchRow.data(), scratchRow.size() * sizeof(float));
+        }
+        if (!rawFile) throw CiftiException("failed to write file '" + AString(argv[3]) + "'");
+    } catch (CiftiException& e) {
+        cerr << "Caught CiftiException: " + AString_to_std_string(e.whatString()) << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,176 @@
+#include "CiftiFile.h"
+#include "NiftiIO.h"
+#include "Common/DataConversion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+using namespace std;
+using namespace cifti;
+
+/**\file kernels.cxx
+This program checks that the vectorized datatype conversions (see Common/DataConversion.h) give exactly the same results as the
+generic loops in NiftiIO, for each instruction set the processor has.  It takes the values of the 2D Cifti file in argv[1], with
+values that need rounding or clamping mixed in, and writes them with NiftiIO into memory in each datatype, with and without scaling,
+once with the kernels turned off and once per instruction set, and checks that the bytes are identical.  It then reads each one
+back the same way, checks that the values are identical, and writes the values to argv[2] without a header.  argv[3] is the
+endianness to write in, which makes the conversions byteswap when it isn't the native order.
+
+\include kernels.cxx
+*/
+
+namespace
+{
+    struct Combination
+    {
+        int16_t type;
+        const char* name;
+        bool isFloat, scaled;
+    };
+
+    const Combination COMBINATIONS[] = {
+        { NIFTI_TYPE_INT8, "INT8", false, false },
+        { NIFTI_TYPE_INT8, "INT8", false, true },
+        { NIFTI_TYPE_UINT8, "UINT8", false, false },
+        { NIFTI_TYPE_UINT8, "UINT8", false, true },
+        { NIFTI_TYPE_INT16, "INT16", false, false },
+        { NIFTI_TYPE_INT16, "INT16", false, true },
+        { NIFTI_TYPE_FLOAT32, "FLOAT32", true, false },
+        { NIFTI_TYPE_FLOAT32, "FLOAT32", true, true },
+        { NIFTI_TYPE_FLOAT64, "FLOAT64", true, false },
+        { NIFTI_TYPE_FLOAT64, "FLOAT64", true, true },
+        { CIFTILIB_TYPE_FLOAT16, "FLOAT16", true, false }
+    };
+
+    //powers of 2 and small integers, so that the expected values are exact whatever precision the generic code uses
+    const double SCALE_MULT = 0.25, SCALE_OFFSET = 3.0;
+
+    //ties for rounding, with and without the scaling above, edges of the integer types, and values that half precision can't hold
+    const float SPECIAL_VALUES[] = { 0.5f, -0.5f, 1.5f, 2.5f, -2.5f, 3.125f, 2.875f, -5.125f, 127.5f, -128.5f, 254.5f, 255.5f, 32767.5f, -32768.5f,
+                                     1e30f, -1e30f, numeric_limits<float>::infinity(), -numeric_limits<float>::infinity(), numeric_limits<float>::quiet_NaN(),
+                                     -0.0f, 1e-40f, 65504.0f, 65520.0f, 6e-8f, 1e-5f };
+    const int NUM_SPECIAL_VALUES = sizeof(SPECIAL_VALUES) / sizeof(SPECIAL_VALUES[0]);
+
+    const DataConversion::KernelLevel LEVELS[] = { DataConversion::KERNELS_NONE, DataConversion::KERNELS_SSE2, DataConversion::KERNELS_AVX2, DataConversion::KERNELS_AVX512 };
+    const char* LEVEL_NAMES[] = { "generic", "SSE2", "AVX2", "AVX-512" };
+    const int NUM_LEVELS = sizeof(LEVELS) / sizeof(LEVELS[0]);
+
+    void writeMemory(vector<char>& bufferOut, const vector<float>& data, const vector<int64_t>& dims, const Combination& combo, const bool& swapped)
+    {
+        NiftiHeader header;
+        header.setDimensions(dims);
+        header.setDataType(combo.type);
+        if (combo.scaled) header.setDataScaling(SCALE_MULT, SCALE_OFFSET);
+        NiftiIO writer;
+        writer.writeNewMemory(bufferOut, header, 2, swapped);
+        for (int64_t row = 0; row < dims[1]; ++row)
+        {
+            writer.writeData(data.data() + row * dims[0], 1, vector<int64_t>(1, row));
+        }
+        writer.close();
+    }
+
+    void readMemory(vector<float>& dataOut, const vector<char>& buffer, const vector<int64_t>& dims)
+    {
+        NiftiIO reader;
+        reader.openReadMemory(buffer.data(), buffer.size());
+        dataOut.resize(dims[0] * dims[1]);
+        for (int64_t row = 0; row < dims[1]; ++row)
+        {
+            reader.readData(dataOut.data() + row * dims[0], 1, vector<int64_t>(1, row));
+        }
+        reader.close();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 4)
+    {
+        cout << "usage: " << argv[0] << " <input cifti> <output raw> <endian>" << endl;
+        cout << "  check the vectorized conversions against the generic ones, using the values from the input cifti file, and dump the values read back as raw float32." << endl;
+        cout << "  endian can be 'LITTLE' or 'BIG'" << endl;
+        return 1;
+    }
+    bool swapped;
+    if (AString(argv[3]) == "LITTLE")
+    {
+        swapped = ByteSwapping::isBigEndian();
+    } else if (AString(argv[3]) == "BIG") {
+        swapped = !ByteSwapping::isBigEndian();
+    } else {
+        cerr << "unrecognized endianness string: " << argv[3] << endl;
+        return 1;
+    }
+    bool failed = false;
+    try
+    {
+        CiftiFile inputFile(argv[1]);
+        const vector<int64_t>& inputDims = inputFile.getDimensions();
+        if (inputDims.size() != 2) throw CiftiException("input file must be 2D");
+        vector<float> values(inputDims[0] * inputDims[1]);
+        for (int64_t row = 0; row < inputDims[1]; ++row)
+        {
+            inputFile.getRow(values.data() + row * inputDims[0], row);
+        }
+        vector<int64_t> dims(2);//the transposed shape, as the example files have very short rows, and the kernels work on whole rows
+        dims[0] = inputDims[1];
+        dims[1] = inputDims[0];
+        for (size_t i = 0; i < values.size(); i += 7)
+        {
+            values[i] = SPECIAL_VALUES[(i / 7) % NUM_SPECIAL_VALUES];
+        }
+        for (int64_t row = 0; row < dims[1]; ++row)
+        {//the last few elements of a row are done by the scalar code in the kernels
+            for (int64_t i = 0; i < min(dims[0], (int64_t)NUM_SPECIAL_VALUES); ++i)
+            {
+                values[(row + 1) * dims[0] - 1 - i] = SPECIAL_VALUES[i];
+            }
+        }
+        vector<float> integerValues = values;//converting NaN to an integer type is undefined
+        for (size_t i = 0; i < integerValues.size(); ++i)
+        {
+            if (integerValues[i] != integerValues[i]) integerValues[i] = 0.0f;
+        }
+        ofstream rawFile(argv[2], ios::binary);
+        for (size_t i = 0; i < sizeof(COMBINATIONS) / sizeof(COMBINATIONS[0]); ++i)
+        {
+            const Combination& combo = COMBINATIONS[i];
+            AString comboName = AString(combo.name) + (combo.scaled ? " scaled" : "");
+            vector<char> genericBytes, levelBytes;
+            for (int level = 0; level < NUM_LEVELS; ++level)
+            {
+                DataConversion::setMaxKernelLevel(LEVELS[level]);
+                writeMemory(level == 0 ? genericBytes : levelBytes, combo.isFloat ? values : integerValues, dims, combo, swapped);
+                if (level > 0 && levelBytes != genericBytes)
+                {
+                    cerr << AString_to_std_string(comboName) << ": " << LEVEL_NAMES[level] << " wrote different bytes than the generic code" << endl;
+                    failed = true;
+                }
+            }
+            vector<float> genericValues, levelValues;
+            for (int level = 0; level < NUM_LEVELS; ++level)
+            {
+                DataConversion::setMaxKernelLevel(LEVELS[level]);
+                readMemory(level == 0 ? genericValues : levelValues, genericBytes, dims);
+                if (level > 0 && memcmp(levelValues.data(), genericValues.data(), genericValues.size() * sizeof(float)) != 0)
+                {
+                    cerr << AString_to_std_string(comboName) << ": " << LEVEL_NAMES[level] << " read different values than the generic code" << endl;
+                    failed = true;
+                }
+            }
+            rawFile.write((const char*)genericValues.data(), genericValues.size() * sizeof(float));
+        }
+        DataConversion::setMaxKernelLevel(DataConversion::KERNELS_AVX512);
+        if (!rawFile) throw CiftiException("failed to write file '" + AString(argv[2]) + "'");
+    } catch (CiftiException& e) {
+        cerr << "Caught CiftiException: " + AString_to_std_string(e.whatString()) << endl;
+        return 1;
+    }
+    return (failed ? 1 : 0);
+}
@@ -0,0 +1,222 @@
+#include "CiftiFile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <vector>
+
+using namespace std;
+using namespace cifti;
+
+/**\file rewritemodes.cxx
+This program reads a Cifti file from argv[1], and writes it out to argv[2] as little endian, like rewrite.cxx, but using one of
+the optional ways of reading or writing, named by argv[3].  Every mode should give the same file as the little endian rewrite.
+
+\include rewritemodes.cxx
+*/
+
+namespace
+{
+    vector<vector<int64_t> > getRowIndices(const CiftiFile& inputFile)
+    {
+        vector<vector<int64_t> > ret;
+        for (MultiDimIterator<int64_t> iter = inputFile.getIteratorOverRows(); !iter.atEnd(); ++iter)
+        {
+            ret.push_back(*iter);
+        }
+        return ret;
+    }
+
+    void writeMatrix(const AString& fileName, const CiftiXML& xml, const vector<vector<int64_t> >& rows, const vector<float>& matrix)
+    {
+        const int64_t rowLength = xml.getDimensions()[0];
+        CiftiFile outputFile;
+        outputFile.setWritingFile(fileName, CiftiVersion(), CiftiFile::LITTLE);
+        outputFile.setCiftiXML(xml);
+        for (size_t i = 0; i < rows.size(); ++i)
+        {
+            outputFile.setRow(matrix.data() + i * rowLength, rows[i]);
+        }
+        outputFile.close();
+    }
+
+    void copyRows(const CiftiFile& inputFile, CiftiFile& outputFile)
+    {
+        vector<float> scratchRow(inputFile.getDimensions()[0]);
+        for (MultiDimIterator<int64_t> iter = inputFile.getIteratorOverRows(); !iter.atEnd(); ++iter)
+        {
+            inputFile.getRow(scratchRow.data(), *iter);
+            outputFile.setRow(scratchRow.data(), *iter);
+        }
+    }
+
+    template<typename T>
+    bool checkRounded(const CiftiFile& myFile, const vector<int64_t>& indexSelect, const vector<double>& doubleRow, const char* typeName, const char* where)
+    {//integer rows should be the double row rounded to nearest and clamped, like NiftiIO does for an unscaled float file
+        vector<T> typedRow(doubleRow.size());
+        myFile.getRow(typedRow.data(), indexSelect);
+        for (size_t i = 0; i < doubleRow.size(); ++i)
+        {
+            if (doubleRow[i] != doubleRow[i]) continue;//converting NaN to an integer type is undefined
+            double expected = min((double)numeric_limits<T>::max(), max((double)numeric_limits<T>::min(), floor(0.5 + doubleRow[i])));
+            if ((double)typedRow[i] != expected)
+            {
+                cerr << typeName << " row from " << where << " has " << (double)typedRow[i] << " at index " << i << ", expected " << expected << endl;
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    bool checkIntegerRows(const CiftiFile& myFile, const vector<int64_t>& indexSelect, const vector<double>& doubleRow, const char* where)
+    {
+        return checkRounded<int32_t>(myFile, indexSelect, doubleRow, "int32", where) &&
+               checkRounded<int16_t>(myFile, indexSelect, doubleRow, "int16", where) &&
+               checkRounded<uint8_t>(myFile, indexSelect, doubleRow, "uint8", where);
+    }
+    
+    void rewriteThreads(const AString& inName, const AString& outName)
+    {//one CiftiFile, read by several threads at once, in whatever order they get to the rows
+        CiftiFile inputFile(inName);
+        const int64_t rowLength = inputFile.getDimensions()[0];
+        vector<vector<int64_t> > rows = getRowIndices(inputFile);
+        const int64_t numRows = (int64_t)rows.size();
+        vector<float> matrix(numRows * rowLength);
+        bool failed = false;
+#pragma omp parallel for schedule(dynamic) num_threads(4)
+        for (int64_t i = 0; i < numRows; ++i)
+        {
+            try
+            {
+                inputFile.getRow(matrix.data() + i * rowLength, rows[i]);
+            } catch (CiftiException& e) {
+#pragma omp critical
+                cerr << "Caught CiftiException in thread: " + AString_to_std_string(e.whatString()) << endl;
+                failed = true;
+            }
+        }
+        if (failed) throw CiftiException("reading rows from several threads failed");
+        writeMatrix(outName, inputFile.getCiftiXML(), rows, matrix);
+    }
+    
+    void rewriteDirect(const AString& inName, const AString& outName)
+    {//both files bypass the page cache, where the filesystem allows it
+        CiftiFile inputFile;
+        inputFile.openFile(inName, BinaryFile::DIRECT);
+        CiftiFile outputFile;
+        outputFile.setWritingFile(outName, CiftiVersion(), CiftiFile::LITTLE, BinaryFile::DIRECT);
+        outputFile.setCiftiXML(inputFile.getCiftiXML());
+        copyRows(inputFile, outputFile);
+        outputFile.close();
+    }
+    
+    void rewriteReadAhead(const AString& inName, const AString& outName)
+    {//a buffer of only a few rows, so the helper thread has to wait for the reader, and the last row first, so it has to start over
+        CiftiFile inputFile(inName);
+        inputFile.setReadAhead(4 * inputFile.getDimensions()[0] * sizeof(float));
+        vector<float> scratchRow(inputFile.getDimensions()[0]);
+        inputFile.getRow(scratchRow.data(), getRowIndices(inputFile).back());
+        CiftiFile outputFile;
+        outputFile.setWritingFile(outName, CiftiVersion(), CiftiFile::LITTLE);
+        outputFile.setCiftiXML(inputFile.getCiftiXML());
+        copyRows(inputFile, outputFile);
+        outputFile.close();
+    }
+    
+    void rewriteWriteBehind(const AString& inName, const AString& outName)
+    {//a buffer of only a few rows, so setRow has to wait for the helper thread, and the first row is written twice, so the queue has to keep the order
+        CiftiFile inputFile(inName);
+        CiftiFile outputFile;
+        outputFile.setWriteBehind(4 * inputFile.getDimensions()[0] * sizeof(float));
+        outputFile.setWritingFile(outName, CiftiVersion(), CiftiFile::LITTLE);
+        outputFile.setCiftiXML(inputFile.getCiftiXML());
+        vector<float> junkRow(inputFile.getDimensions()[0], -1.0f);
+        outputFile.setRow(junkRow.data(), getRowIndices(inputFile).front());
+        copyRows(inputFile, outputFile);
+        outputFile.close();
+    }
+    
+    void rewriteBuffer(const AString& inName, const AString& outName)
+    {//no file IO in CiftiFile at all, the caller reads and writes the files
+        vector<char> inputBytes, outputBytes;
+        {
+            ifstream inputStream(AString_to_std_string(inName).c_str(), ios::in | ios::binary);
+            inputBytes.assign(istreambuf_iterator<char>(inputStream), istreambuf_iterator<char>());
+            if (!inputStream) throw CiftiException("failed to read file '" + inName + "'");
+        }
+        CiftiFile inputFile;
+        inputFile.openBuffer(inputBytes.data(), inputBytes.size());
+        CiftiFile outputFile;//in memory, and setCiftiXML leaves out the file metadata, like the other modes - writeBuffer on inputFile would keep it
+        outputFile.setCiftiXML(inputFile.getCiftiXML());
+        copyRows(inputFile, outputFile);
+        outputFile.writeBuffer(outputBytes, CiftiVersion(), CiftiFile::LITTLE);
+        ofstream outputStream(AString_to_std_string(outName).c_str(), ios::out | ios::trunc | ios::binary);
+        outputStream.write(outputBytes.data(), outputBytes.size());
+        if (!outputStream) throw CiftiException("failed to write file '" + outName + "'");
+    }
+    
+    void rewriteTyped(const AString& inName, const AString& outName)
+    {//rows go through double on disk, and the integer overloads are checked against them both on disk and in memory
+        CiftiFile inputFile(inName);
+        CiftiFile outputFile;
+        outputFile.setWritingFile(outName, CiftiVersion(), CiftiFile::LITTLE);
+        outputFile.setCiftiXML(inputFile.getCiftiXML());
+        CiftiFile memoryFile;
+        memoryFile.setCiftiXML(inputFile.getCiftiXML());
+        vector<double> doubleRow(inputFile.getDimensions()[0]);
+        for (MultiDimIterator<int64_t> iter = inputFile.getIteratorOverRows(); !iter.atEnd(); ++iter)
+        {
+            inputFile.getRow(doubleRow.data(), *iter);
+            if (!checkIntegerRows(inputFile, *iter, doubleRow, "disk")) throw CiftiException("typed getRow on disk gave wrong values");
+            memoryFile.setRow(doubleRow.data(), *iter);
+            if (!checkIntegerRows(memoryFile, *iter, doubleRow, "memory")) throw CiftiException("typed getRow in memory gave wrong values");
+            outputFile.setRow(doubleRow.data(), *iter);
+        }
+        outputFile.close();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 4)
+    {
+        cout << "usage: " << argv[0] << " <input cifti> <output cifti> <mode>" << endl;
+        cout << "  rewrite the input cifti file to the output filename as little endian, reading or writing it in the specified way." << endl;
+        cout << "  mode can be:" << endl;
+        cout << "    THREADS - read all rows from several OpenMP threads at once" << endl;
+        cout << "    DIRECT - open both files with BinaryFile::DIRECT" << endl;
+        cout << "    READAHEAD - read the input with a small read-ahead buffer" << endl;
+        cout << "    WRITEBEHIND - write the output with a small write-behind buffer" << endl;
+        cout << "    BUFFER - read the input into memory for openBuffer, and write the output from writeBuffer" << endl;
+        cout << "    TYPED - read and write rows as double, and check the integer getRow overloads against them" << endl;
+        return 1;
+    }
+    AString mode(argv[3]);
+    try
+    {
+        if (mode == "THREADS")
+        {
+            rewriteThreads(argv[1], argv[2]);
+        } else if (mode == "DIRECT") {
+            rewriteDirect(argv[1], argv[2]);
+        } else if (mode == "READAHEAD") {
+            rewriteReadAhead(argv[1], argv[2]);
+        } else if (mode == "WRITEBEHIND") {
+            rewriteWriteBehind(argv[1], argv[2]);
+        } else if (mode == "BUFFER") {
+            rewriteBuffer(argv[1], argv[2]);
+        } else if (mode == "TYPED") {
+            rewriteTyped(argv[1], argv[2]);
+        } else {
+            cerr << "unrecognized mode: " << argv[3] << endl;
+            return 1;
+        }
+    } catch (CiftiException& e) {
+        cerr << "Caught CiftiException: " + AString_to_std_string(e.whatString()) << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include "CiftiFile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+using namespace cifti;
+
+/**\file rowscale.cxx
+This program reads a 2D Cifti file from argv[1], and writes its transpose to argv[2] as 8 or 16 bit integers with a separate scale
+and offset for each row, or for each blockLength elements of a row (setWritingDataTypeRowScaling).  The transpose is written because
+the example files have very short rows, and the blocks should actually split them.  It then reads argv[2] back, and checks that every
+value is within half a quantization step of the input, where the step comes from the range of the row or block.
+
+\include rowscale.cxx
+*/
+
+int main(int argc, char** argv)
+{
+    if (argc < 4)
+    {
+        cout << "usage: " << argv[0] << " <input cifti> <output cifti> <type> [<block length>]" << endl;
+        cout << "  write the transpose of the input cifti file to the output filename with per-row scaling, then check the values read back." << endl;
+        cout << "  type can be 'INT8' or 'INT16', block length defaults to 0, which scales whole rows" << endl;
+        return 1;
+    }
+    int16_t type;
+    double typeSteps;
+    if (AString(argv[3]) == "INT8")
+    {
+        type = NIFTI_TYPE_INT8;
+        typeSteps = 255.0;
+    } else if (AString(argv[3]) == "INT16") {
+        type = NIFTI_TYPE_INT16;
+        typeSteps = 65535.0;
+    } else {
+        cerr << "unrecognized type string: " << argv[3] << endl;
+        return 1;
+    }
+    int64_t blockLength = 0;
+    if (argc > 4)
+    {
+        blockLength = atol(argv[4]);
+        if (blockLength < 0)
+        {
+            cerr << "block length must not be negative" << endl;
+            return 1;
+        }
+    }
+    try
+    {
+        CiftiFile inputFile(argv[1]);
+        inputFile.convertToInMemory();//getColumn on disk reads one element from every row
+        const vector<int64_t>& inputDims = inputFile.getDimensions();
+        if (inputDims.size() != 2) throw CiftiException("input file must be 2D");
+        CiftiXML transposedXML = inputFile.getCiftiXML();
+        transposedXML.setMap(CiftiXML::ALONG_ROW, *(inputFile.getCiftiXML().getMap(CiftiXML::ALONG_COLUMN)));
+        transposedXML.setMap(CiftiXML::ALONG_COLUMN, *(inputFile.getCiftiXML().getMap(CiftiXML::ALONG_ROW)));
+        const int64_t rowLength = inputDims[1], numRows = inputDims[0];
+        vector<float> scratchRow(rowLength), checkRow(rowLength);
+        {
+            CiftiFile outputFile;
+            outputFile.setWritingFile(argv[2]);
+            outputFile.setWritingDataTypeRowScaling(type, blockLength);
+            outputFile.setCiftiXML(transposedXML);
+            for (int64_t row = 0; row < numRows; ++row)
+            {
+                inputFile.getColumn(scratchRow.data(), row);
+                outputFile.setRow(scratchRow.data(), row);
+            }
+            outputFile.close();//writes the scale table, and reports any write errors
+        }
+        int64_t checkBlock = (blockLength > 0 ? blockLength : rowLength);
+        CiftiFile checkFile(argv[2]);
+        if (checkFile.getDimensions() != transposedXML.getDimensions()) throw CiftiException("dimensions of output file don't match the transposed input");
+        for (int64_t row = 0; row < numRows; ++row)
+        {
+            inputFile.getColumn(scratchRow.data(), row);
+            checkFile.getRow(checkRow.data(), row);
+            for (int64_t start = 0; start < rowLength; start += checkBlock)
+            {
+                int64_t end = min(rowLength, start + checkBlock);
+                float minVal = *min_element(scratchRow.begin() + start, scratchRow.begin() + end);
+                float maxVal = *max_element(scratchRow.begin() + start, scratchRow.begin() + end);
+                double tolerance = 0.5 * (maxVal - minVal) / typeSteps + 1e-5 * max(fabs(minVal), fabs(maxVal));//half a step, plus float rounding of the scale and offset
+                for (int64_t i = start; i < end; ++i)
+                {
+                    if (!(fabs(checkRow[i] - scratchRow[i]) <= tolerance))
+                    {
+                        cerr << "value read back is " << checkRow[i] << ", expected " << scratchRow[i] << " within " << tolerance << endl;
+                        return 1;
+                    }
+                }
+            }
+        }
+    } catch (CiftiException& e) {
+        cerr << "Caught CiftiException: " + AString_to_std_string(e.whatString()) << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include "CiftiFile.h"
+
+#include <iostream>
+#include <vector>
+
+using namespace std;
+using namespace cifti;
+
+/**\file sharded.cxx
+This program either splits a Cifti file by rows across several nifti files (setWritingShardedFile), or reads such a set
+back (openShardedFile) and writes it out as an ordinary Cifti file.  The manifest names the shards relative to itself,
+so a set can be moved to another directory as a whole and still be opened.
+
+\include sharded.cxx
+*/
+
+int main(int argc, char** argv)
+{
+    if (argc < 4 || (AString(argv[1]) == "WRITE" && argc < 5))
+    {
+        cout << "usage: " << argv[0] << " WRITE <input cifti> <output manifest> <shard file> [<shard file>...]" << endl;
+        cout << "  split the input cifti file across the shard files, in stripes of 16 rows." << endl;
+        cout << "   or: " << argv[0] << " READ <input manifest> <output cifti>" << endl;
+        cout << "  rewrite a sharded matrix as an ordinary little-endian cifti file." << endl;
+        return 1;
+    }
+    try
+    {
+        if (AString(argv[1]) == "WRITE")
+        {
+            CiftiFile inputFile(argv[2]);
+            vector<AString> shardNames;
+            for (int i = 4; i < argc; ++i)
+            {
+                shardNames.push_back(argv[i]);
+            }
+            CiftiFile outputFile;
+            outputFile.setWritingShardedFile(argv[3], shardNames, 16);//small stripes, so that the example files use every shard
+            outputFile.setCiftiXML(inputFile.getCiftiXML());
+            const vector<int64_t>& dims = inputFile.getDimensions();
+            vector<float> scratchRow(dims[0]);
+            for (MultiDimIterator<int64_t> iter = inputFile.getIteratorOverRows(); !iter.atEnd(); ++iter)
+            {
+                inputFile.getRow(scratchRow.data(), *iter);
+                outputFile.setRow(scratchRow.data(), *iter);
+            }
+            outputFile.close();
+        } else if (AString(argv[1]) == "READ") {
+            CiftiFile inputFile;
+            inputFile.openShardedFile(argv[2]);
+            inputFile.writeFile(argv[3], CiftiVersion(), CiftiFile::LITTLE);
+        } else {
+            cerr << "unrecognized mode: " << argv[1] << endl;
+            return 1;
+        }
+    } catch (CiftiException& e) {
+        cerr << "Caught CiftiException: " + AString_to_std_string(e.whatString()) << endl;
+        return 1;
+    }
+    return 0;
+}
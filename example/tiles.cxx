@@ -0,0 +1,87 @@
+#include "CiftiFile.h"
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+using namespace cifti;
+
+/**\file tiles.cxx
+This program rewrites a 2D Cifti file from argv[1] to argv[2] as native float32, writes a tile sidecar for it
+(writeTileSidecar), and checks that every column read through the sidecar matches the rows.  It then changes the last
+value of argv[2] in place, without changing its size, and checks that getColumn sees the new value instead of the
+stale tiles.
+
+\include tiles.cxx
+*/
+
+namespace
+{
+    bool checkColumns(const CiftiFile& myFile)
+    {
+        const vector<int64_t>& dims = myFile.getDimensions();
+        vector<float> matrix(dims[0] * dims[1]), column(dims[1]);
+        for (int64_t row = 0; row < dims[1]; ++row)
+        {
+            myFile.getRow(matrix.data() + row * dims[0], row);
+        }
+        for (int64_t col = 0; col < dims[0]; ++col)
+        {
+            myFile.getColumn(column.data(), col);
+            for (int64_t row = 0; row < dims[1]; ++row)
+            {
+                if (column[row] != matrix[row * dims[0] + col])
+                {
+                    cerr << "column " << col << " has " << column[row] << " at row " << row << ", getRow has " << matrix[row * dims[0] + col] << endl;
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        cout << "usage: " << argv[0] << " <input cifti> <output cifti>" << endl;
+        cout << "  rewrite the 2D input cifti file to the output filename, and check getColumn through a tile sidecar." << endl;
+        return 1;
+    }
+    try
+    {
+        {
+            CiftiFile inputFile(argv[1]);
+            if (inputFile.getDimensions().size() != 2) throw CiftiException("input file must be 2D");
+            inputFile.writeFile(argv[2]);//native endian float32, so the last value can be changed directly
+        }
+        CiftiFile::writeTileSidecar(argv[2], 16);//small tiles, so the example files have many of them
+        {
+            CiftiFile tiledFile(argv[2]);
+            if (!checkColumns(tiledFile)) return 1;
+        }
+        float newValue = 12345.0f;
+        {
+            fstream editFile(argv[2], ios::in | ios::out | ios::binary);
+            editFile.seekp(-(streamoff)sizeof(float), ios::end);//the data is last in the file, so this is the last column of the last row
+            editFile.write((const char*)&newValue, sizeof(float));
+            if (!editFile) throw CiftiException("failed to change file '" + AString(argv[2]) + "'");
+        }
+        CiftiFile editedFile(argv[2]);
+        const vector<int64_t>& dims = editedFile.getDimensions();
+        vector<float> column(dims[1]);
+        editedFile.getColumn(column.data(), dims[0] - 1);
+        if (column[dims[1] - 1] != newValue)
+        {
+            cerr << "getColumn returned " << column[dims[1] - 1] << " after the file changed, expected " << newValue << endl;
+            return 1;
+        }
+        if (!checkColumns(editedFile)) return 1;
+    } catch (CiftiException& e) {
+        cerr << "Caught CiftiException: " + AString_to_std_string(e.whatString()) << endl;
+        return 1;
+    }
+    return 0;
+}
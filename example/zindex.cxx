@@ -0,0 +1,141 @@
+#include "CiftiFile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <zlib.h>
+
+using namespace std;
+using namespace cifti;
+
+/**\file zindex.cxx
+This program makes a plain (single member, not BGZF) gzipped Cifti file at argv[2] from the 2D Cifti file in argv[1], with a series of
+timepoints along the rows, long enough that reading it records decompression checkpoints.  It reads the last row and then the rest,
+which saves the checkpoints to argv[2] + ".zidx", then opens it again and checks that the index was used rather than written again.  The rows read the
+second time are also written to argv[3] without a header, so they can be checked independently of the XML library.
+
+\include zindex.cxx
+*/
+
+namespace
+{
+    const int64_t MIN_DATA_BYTES = 3 << 20;//a checkpoint is recorded every 1MiB of uncompressed data
+    const char INDEX_MARKER[] = "zindex example marker";
+    
+    uint32_t scramble(const int64_t& row, const int64_t& col)
+    {//so that the data doesn't compress into a few huge deflate blocks, checkpoints are only made between blocks
+        uint32_t ret = (uint32_t)row * 2654435761u ^ (uint32_t)col * 40503u;
+        ret ^= ret >> 13;
+        ret *= 0x5bd1e995u;
+        ret ^= ret >> 15;
+        return ret;
+    }
+
+    bool readFromEnd(const AString& fileName, const vector<float>& matrix, vector<float>& rowsOut)
+    {//the last row first, so the rest needs to seek back, and with an index, the first row read can go straight to the last checkpoint
+        CiftiFile inputFile(fileName);
+        const vector<int64_t>& dims = inputFile.getDimensions();
+        rowsOut.resize(dims[0] * dims[1]);
+        inputFile.getRow(rowsOut.data() + (dims[1] - 1) * dims[0], dims[1] - 1);
+        for (int64_t row = 0; row < dims[1] - 1; ++row)
+        {
+            inputFile.getRow(rowsOut.data() + row * dims[0], row);
+        }
+        inputFile.close();
+        if (rowsOut != matrix)
+        {
+            cerr << "data read from '" << AString_to_std_string(fileName) << "' doesn't match what was written" << endl;
+            return false;
+        }
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 4)
+    {
+        cout << "usage: " << argv[0] << " <input cifti> <output gzipped cifti> <output raw>" << endl;
+        cout << "  write a plain gzipped series file made from the 2D input cifti file, and check that its .zidx is saved and reused." << endl;
+        return 1;
+    }
+    try
+    {
+        CiftiFile inputFile(argv[1]);
+        const vector<int64_t>& inputDims = inputFile.getDimensions();
+        if (inputDims.size() != 2) throw CiftiException("input file must be 2D");
+        const int64_t numRows = inputDims[1];
+        const int64_t rowLength = max((int64_t)2, (MIN_DATA_BYTES / (int64_t)sizeof(float) + numRows - 1) / numRows);
+        CiftiXML seriesXML = inputFile.getCiftiXML();
+        CiftiSeriesMap seriesMap;
+        seriesMap.setLength(rowLength);
+        seriesXML.setMap(CiftiXML::ALONG_ROW, seriesMap);
+        vector<float> inputRow(inputDims[0]), matrix(rowLength * numRows);
+        for (int64_t row = 0; row < numRows; ++row)
+        {
+            inputFile.getRow(inputRow.data(), row);
+            for (int64_t i = 0; i < rowLength; ++i)
+            {
+                matrix[row * rowLength + i] = inputRow[i % inputDims[0]] + 0.25f * (scramble(row, i) % 4096);
+            }
+        }
+        vector<char> fileBytes;
+        {
+            CiftiFile seriesFile;
+            seriesFile.setCiftiXML(seriesXML);
+            for (int64_t row = 0; row < numRows; ++row)
+            {
+                seriesFile.setRow(matrix.data() + row * rowLength, row);
+            }
+            seriesFile.writeBuffer(fileBytes, CiftiVersion(), CiftiFile::LITTLE);
+        }
+        const AString indexName = AString(argv[2]) + ".zidx";
+        remove(AString_to_std_string(indexName).c_str());//so an index left by an earlier run can't pass the check
+        gzFile gzOut = gzopen(argv[2], "wb");//gzopen writes one member, unlike CiftiFile, which writes BGZF
+        if (gzOut == NULL) throw CiftiException("failed to open '" + AString(argv[2]) + "' for writing");
+        if (gzwrite(gzOut, fileBytes.data(), (unsigned)fileBytes.size()) != (int)fileBytes.size())
+        {
+            gzclose(gzOut);
+            throw CiftiException("failed to write '" + AString(argv[2]) + "'");
+        }
+        if (gzclose(gzOut) != Z_OK) throw CiftiException("failed to write '" + AString(argv[2]) + "'");
+        vector<float> rowsRead;
+        if (!readFromEnd(argv[2], matrix, rowsRead)) return 1;
+#if ZLIB_VERNUM >= 0x1280 //CiftiLib only records checkpoints with zlib 1.2.8 or later
+        {//CiftiLib ignores extra bytes after the checkpoints, but would replace the whole file if it didn't use it
+            if (!ifstream(AString_to_std_string(indexName).c_str()))
+            {
+                cerr << "reading '" << argv[2] << "' didn't save '" << AString_to_std_string(indexName) << "'" << endl;
+                return 1;
+            }
+            ofstream indexFile(AString_to_std_string(indexName).c_str(), ios::out | ios::app | ios::binary);
+            indexFile.write(INDEX_MARKER, sizeof(INDEX_MARKER));
+            if (!indexFile) throw CiftiException("failed to change '" + indexName + "'");
+        }
+#endif
+        if (!readFromEnd(argv[2], matrix, rowsRead)) return 1;
+#if ZLIB_VERNUM >= 0x1280
+        {
+            ifstream indexFile(AString_to_std_string(indexName).c_str(), ios::in | ios::binary);
+            vector<char> marker(sizeof(INDEX_MARKER));
+            indexFile.seekg(-(streamoff)sizeof(INDEX_MARKER), ios::end);
+            indexFile.read(marker.data(), marker.size());
+            if (!indexFile || !equal(marker.begin(), marker.end(), INDEX_MARKER))
+            {
+                cerr << "'" << AString_to_std_string(indexName) << "' was written again instead of being used" << endl;
+                return 1;
+            }
+        }
+#endif
+        ofstream rawFile(argv[3], ios::out | ios::trunc | ios::binary);
+        rawFile.write((const char*)rowsRead.data(), rowsRead.size() * sizeof(float));
+        if (!rawFile) throw CiftiException("failed to write '" + AString(argv[3]) + "'");
+    } catch (CiftiException& e) {
+        cerr << "Caught CiftiException: " + AString_to_std_string(e.whatString()) << endl;
+        return 1;
+    }
+    return 0;
+}
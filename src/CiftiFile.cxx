@@ -28,10 +28,14 @@
 #include "CiftiFile.h"
 
 #include "Common/CiftiAssert.h"
+#include "Common/CiftiMutex.h"
+#include "Common/DataConversion.h"
 #include "Common/MultiDimArray.h"
 #include "NiftiIO.h"
 
 #ifdef CIFTILIB_USE_QT
+    #include <QDateTime>
+    #include <QDir>
     #include <QFileInfo>
 #else
     //use boost filesystem, because cross-platform filesystem support with POSIX is absurd
@@ -39,7 +43,21 @@
     #include "boost/filesystem.hpp"
 #endif
 
+#ifdef CIFTILIB_HAVE_STAT_NSEC
+    #include <sys/stat.h>
+#endif
+
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
 
 using namespace std;
 using namespace boost;
@@ -48,36 +66,324 @@ using namespace cifti;
 //private implementation classes, helpers
 namespace
 {
+    //rows numbered in file order (first index fastest), for the read-ahead and write-behind helpers - returns -1 for out of range indices
+    int64_t rowNumber(const vector<int64_t>& rowDims, const vector<int64_t>& indexSelect)
+    {
+        if (indexSelect.size() != rowDims.size()) return -1;
+        int64_t ret = 0, stride = 1;
+        for (size_t i = 0; i < rowDims.size(); ++i)
+        {
+            if (indexSelect[i] < 0 || indexSelect[i] >= rowDims[i]) return -1;
+            ret += indexSelect[i] * stride;
+            stride *= rowDims[i];
+        }
+        return ret;
+    }
+    
+    vector<int64_t> rowIndices(const vector<int64_t>& rowDims, int64_t rowNumber)
+    {
+        vector<int64_t> ret(rowDims.size());
+        for (size_t i = 0; i < rowDims.size(); ++i)
+        {
+            ret[i] = rowNumber % rowDims[i];
+            rowNumber /= rowDims[i];
+        }
+        return ret;
+    }
+    
+    //for in-memory data, rounds to nearest and clamps like NiftiIO does when reading unscaled float data into an integer type
+    template<typename T>
+    T convertFromFloat(const float& in)
+    {
+        typedef numeric_limits<T> mylimits;
+        if (!mylimits::is_integer) return (T)in;
+        double rounded = floor(0.5 + (double)in);
+        if (rounded != rounded) return 0;//NaN has no integer value
+        if (rounded > (double)mylimits::max()) return mylimits::max();
+        if (rounded < (double)mylimits::min()) return mylimits::min();
+        return (T)rounded;
+    }
+    
+    //reads the rows after the last requested one on a helper thread, into a ring of rows
+    //the helper has to keep running between calls, which OpenMP can't express (it only parallelizes inside a call), and waiting for
+    //a row needs a condition variable, which CiftiMutex doesn't have - so this uses std::thread and std::mutex instead
+    class RowPrefetcher
+    {
+        NiftiIO* m_nifti;
+        vector<int64_t> m_rowDims;
+        int64_t m_rowLength, m_numRows, m_numSlots;
+        vector<float> m_ring;//row r is in slot r % m_numSlots
+        int64_t m_first, m_next;//rows [m_first, m_next) are ready, the helper reads m_next when there is a free slot
+        int64_t m_generation;//incremented when the reader jumps, so an in-progress row from before the jump gets dropped
+        int64_t m_lastMiss;//after a jump, wait for the next row to be requested before reading ahead again, so random access doesn't waste IO
+        bool m_stop, m_failed, m_paused;
+        std::thread::id m_owner;//only one calling thread gets to steer the read-ahead, other threads read directly
+        std::mutex m_mutex;
+        std::condition_variable m_workCond, m_readyCond;
+        std::thread m_thread;
+        RowPrefetcher(const RowPrefetcher&);
+        RowPrefetcher& operator=(const RowPrefetcher&);
+        void run();
+    public:
+        RowPrefetcher(NiftiIO* nifti, const vector<int64_t>& dims, const int64_t& maxBytes);
+        void getRow(float* dataOut, const vector<int64_t>& indexSelect, const bool& tolerateShortRead);
+        ~RowPrefetcher();
+    };
+    
+    //copies rows from setRow into a bounded set of buffers, a helper thread converts and writes them in file order
+    //like RowPrefetcher, the helper outlives the setRow call, and setRow waits for a free buffer on a condition variable, so this can't use OpenMP or CiftiMutex
+    class RowWriteBehind
+    {
+        NiftiIO* m_nifti;
+        vector<int64_t> m_rowDims;
+        int64_t m_rowLength, m_maxRows, m_numWriting;
+        map<int64_t, vector<float> > m_queued;//sorted by row number, so the helper writes in file order
+        vector<vector<float> > m_pool;//recycled row buffers
+        AString m_error;//first write error, reported by setRow or flush
+        bool m_stop;
+        std::mutex m_mutex;
+        std::condition_variable m_workCond, m_doneCond;
+        std::thread m_thread;
+        RowWriteBehind(const RowWriteBehind&);
+        RowWriteBehind& operator=(const RowWriteBehind&);
+        void run();
+        void writeRows(map<int64_t, vector<float> >& rows, vector<float>& staging);
+    public:
+        RowWriteBehind(NiftiIO* nifti, const vector<int64_t>& dims, const int64_t& maxBytes);
+        void setRow(const float* dataIn, const vector<int64_t>& indexSelect);
+        void flush();//waits for queued rows to be written, throws the first write error
+        ~RowWriteBehind();//writes any remaining rows
+    };
+    
+    //square tiles of a 2D matrix as float32, in a <filename>.tiles sidecar, so a column only needs the tiles it passes through instead of one read per element
+    //every tile is full size (zero padded past the matrix edges), tiles are in row-major order with row-major data inside, so tile positions are computed, not stored
+    class TileSidecar
+    {
+        mutable BinaryFile m_file;
+        int64_t m_numRows, m_rowLength, m_tileSize, m_numTileRows, m_numTileCols;
+        mutable vector<float> m_cache;//the column of tiles used by the last getColumn, neighboring columns are in the same tiles
+        mutable int64_t m_cachedTileCol;
+        mutable CiftiMutex m_mutex;
+        TileSidecar() { m_numRows = 0; m_rowLength = 0; m_tileSize = 0; m_numTileRows = 0; m_numTileCols = 0; m_cachedTileCol = -1; }
+    public:
+        static AString sidecarName(const AString& filename) { return filename + ".tiles"; }
+        static boost::shared_ptr<TileSidecar> open(const AString& filename, const vector<int64_t>& dims);//NULL if there is no sidecar, or it doesn't match the file
+        static void write(const CiftiFile::ReadImplInterface* from, const AString& filename, const vector<int64_t>& dims, const int64_t& tileSize);
+        void getColumn(float* dataOut, const int64_t& index) const;
+    };
+    
+    //per-row (or per-block) scale and offset for 8 or 16 bit integer data, kept in a CIFTILIB_ECODE_ROW_SCALING extension
+    //each block of a row is fit to its own range when the row is written, so rows are always written whole
+    class RowScaleTable
+    {
+        int16_t m_datatype;
+        int64_t m_rowLength, m_numRows, m_blockLength, m_blocksPerRow;
+        vector<int64_t> m_rowDims;
+        vector<float> m_scales;//mult then offset, for each block of each row in file order - all zero decodes unwritten rows to zero
+        int64_t checkedRow(const vector<int64_t>& indexSelect) const;
+        template<typename T>
+        void readRowTyped(NiftiIO& nifti, float* dataOut, const vector<int64_t>& indexSelect, const bool& tolerateShortRead) const;
+        template<typename T>
+        void writeRowTyped(NiftiIO& nifti, const float* dataIn, const vector<int64_t>& indexSelect);
+    public:
+        RowScaleTable(const int16_t& datatype, const vector<int64_t>& dims, const int64_t& blockLength);//new, all zero, 0 block length means whole rows
+        RowScaleTable(const int16_t& datatype, const vector<int64_t>& dims, const vector<char>& bytes, const bool& swapped, const AString& filename);//from an extension
+        vector<char> toBytes(const bool& swapped) const;
+        void readRow(NiftiIO& nifti, float* dataOut, const vector<int64_t>& indexSelect, const bool& tolerateShortRead) const;
+        void writeRow(NiftiIO& nifti, const float* dataIn, const vector<int64_t>& indexSelect);
+        float dequantize(const double& stored, const int64_t& row, const int64_t& index) const;//for single elements, as in getColumn
+    };
+    
     class CiftiOnDiskImpl : public CiftiFile::WriteImplInterface
     {
         mutable NiftiIO m_nifti;//because file objects aren't stateless (current position), so reading "changes" them
         CiftiXML m_xml;//because we need to parse it to set up the dimensions anyway
+        boost::shared_ptr<RowPrefetcher> m_prefetch;//declared after m_nifti so that its thread stops before the file closes
+        boost::shared_ptr<RowWriteBehind> m_writeBehind;//ditto
+        boost::shared_ptr<TileSidecar> m_tiles;//only when reading an unchanged file that has a sidecar
+        boost::shared_ptr<RowScaleTable> m_rowScales;//only for files with per-row scaling, which bypass read-ahead and write-behind
+        int m_rowScaleExtension;//index of the extension to update on close, -1 when not writing one
+        void flushWrites() const { if (m_writeBehind != NULL) m_writeBehind->flush(); }//before anything that could see or reorder the queued rows
+        void readCiftiHeader();//after m_nifti is opened
+        template<typename T>
+        void getRowTyped(T* dataOut, const vector<int64_t>& indexSelect, const bool& tolerateShortRead) const;//for types other than float, skips read-ahead and write-behind
+        template<typename T>
+        void setRowTyped(const T* dataIn, const vector<int64_t>& indexSelect);
     public:
-        CiftiOnDiskImpl(const AString& filename);//read-only
+        CiftiOnDiskImpl(const AString& filename, const BinaryFile::IOMethod& method = BinaryFile::BUFFERED);//read-only
+        CiftiOnDiskImpl(const void* data, const int64_t& size);//read-only, from caller-owned memory
         CiftiOnDiskImpl(const AString& filename, const CiftiXML& xml, const CiftiVersion& version, const bool& swapEndian,
-                        const int16_t& datatype, const bool& rescale, const double& minval, const double& maxval);//make new empty file with read/write
+                        const int16_t& datatype, const bool& rescale, const double& minval, const double& maxval,
+                        const BinaryFile::IOMethod& method = BinaryFile::BUFFERED, vector<char>* memoryOut = NULL,
+                        const int64_t& rowScaleBlock = -1);//make new empty file with read/write, or write into memoryOut - rowScaleBlock >= 0 for per-row scaling
+        ~CiftiOnDiskImpl();//writes the per-row scale table if close() wasn't called
         void getRow(float* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const;
+        void getRow(double* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const { getRowTyped(dataOut, indexSelect, tolerateShortRead); }
+        void getRow(int32_t* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const { getRowTyped(dataOut, indexSelect, tolerateShortRead); }
+        void getRow(int16_t* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const { getRowTyped(dataOut, indexSelect, tolerateShortRead); }
+        void getRow(uint8_t* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const { getRowTyped(dataOut, indexSelect, tolerateShortRead); }
         void getColumn(float* dataOut, const int64_t& index) const;
+        const float* getRowPointer(const std::vector<int64_t>& indexSelect) const;
+        void getRows(float* dataOut, const int64_t& rowLength, const std::vector<std::vector<int64_t> >& indexSelects) const;
+        void getRowRange(float* dataOut, const vector<int64_t>& dims, const vector<int64_t>& indexSelect, const int64_t& numRows) const;
+        void setAccessPattern(const CiftiFile::AccessPattern& pattern) const;
+        void willNeedRows(const int64_t& rowLength, const int64_t& firstRow, const int64_t& numRows) const;
+        void setReadAhead(const int64_t& maxBytes, const vector<int64_t>& dims);
         const CiftiXML& getCiftiXML() const { return m_xml; }
         AString getFilename() const { return m_nifti.getFilename(); }
         bool isSwapped() const { return m_nifti.getHeader().isSwapped(); }
         void setRow(const float* dataIn, const std::vector<int64_t>& indexSelect);
+        void setRow(const double* dataIn, const std::vector<int64_t>& indexSelect) { setRowTyped(dataIn, indexSelect); }
+        void setRow(const int32_t* dataIn, const std::vector<int64_t>& indexSelect) { setRowTyped(dataIn, indexSelect); }
+        void setRow(const int16_t* dataIn, const std::vector<int64_t>& indexSelect) { setRowTyped(dataIn, indexSelect); }
+        void setRow(const uint8_t* dataIn, const std::vector<int64_t>& indexSelect) { setRowTyped(dataIn, indexSelect); }
         void setColumn(const float* dataIn, const int64_t& index);
+        void setRows(const float* dataIn, const int64_t& rowLength, const std::vector<std::vector<int64_t> >& indexSelects);
+        void setRowRange(const float* dataIn, const vector<int64_t>& dims, const vector<int64_t>& indexSelect, const int64_t& numRows);
+        void setWriteBehind(const int64_t& maxBytes, const vector<int64_t>& dims);
+        void flush() { flushWrites(); }
         void close();
     };
     
+    //one matrix split by rows across several plain nifti-2 files, listed in a text manifest along with the XML
+    //row r is in stripe r / m_stripeRows, and stripes go to the shards round-robin, so neighboring stripes can be transferred from different devices at the same time
+    class CiftiShardedImpl : public CiftiFile::WriteImplInterface
+    {
+        struct Segment
+        {
+            int64_t m_shard, m_shardRow, m_numRows, m_dataRow;//consecutive rows within one shard, m_dataRow is the row within the caller's data
+        };
+        CiftiXML m_xml;
+        vector<int64_t> m_rowDims;
+        int64_t m_rowLength, m_numRows, m_stripeRows;
+        AString m_manifestName;
+        vector<AString> m_shardNames;
+        vector<boost::shared_ptr<NiftiIO> > m_shards;//nifti reads and writes are positional, so each shard can be used from several threads
+        const static int64_t STRIPE_BYTES;
+        void setDimensions(const vector<int64_t>& dims);
+        void locate(const int64_t& row, int64_t& shard, int64_t& shardRow) const;
+        int64_t shardRowCount(const int64_t& shard) const;
+        void addSegments(vector<Segment>& segments, const int64_t& firstRow, const int64_t& numRows, const int64_t& dataRow) const;
+        void transfer(float* data, const vector<Segment>& segments, const bool& writing) const;//one openmp thread per shard involved
+        void transferShard(float* data, const vector<Segment>& segments, const bool& writing, AString* errorOut) const;
+        void writeManifest(const CiftiVersion& version) const;
+        template<typename T>
+        void getRowTyped(T* dataOut, const vector<int64_t>& indexSelect, const bool& tolerateShortRead) const;
+        template<typename T>
+        void setRowTyped(const T* dataIn, const vector<int64_t>& indexSelect);
+    public:
+        CiftiShardedImpl(const AString& manifestName);//read-only
+        CiftiShardedImpl(const AString& manifestName, const vector<AString>& shardNames, const int64_t& stripeRows, const CiftiXML& xml, const CiftiVersion& version,
+                         const bool& swapEndian, const int16_t& datatype, const bool& rescale, const double& minval, const double& maxval);//make new empty shards with read/write
+        const CiftiXML& getCiftiXML() const { return m_xml; }
+        vector<AString> getFilenames() const;//manifest, then shards
+        void getRow(float* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const { getRowTyped(dataOut, indexSelect, tolerateShortRead); }
+        void getRow(double* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const { getRowTyped(dataOut, indexSelect, tolerateShortRead); }
+        void getRow(int32_t* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const { getRowTyped(dataOut, indexSelect, tolerateShortRead); }
+        void getRow(int16_t* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const { getRowTyped(dataOut, indexSelect, tolerateShortRead); }
+        void getRow(uint8_t* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const { getRowTyped(dataOut, indexSelect, tolerateShortRead); }
+        void getColumn(float* dataOut, const int64_t& index) const;
+        void getRows(float* dataOut, const int64_t& rowLength, const std::vector<std::vector<int64_t> >& indexSelects) const;
+        void getRowRange(float* dataOut, const vector<int64_t>& dims, const vector<int64_t>& indexSelect, const int64_t& numRows) const;
+        void setRow(const float* dataIn, const std::vector<int64_t>& indexSelect) { setRowTyped(dataIn, indexSelect); }
+        void setRow(const double* dataIn, const std::vector<int64_t>& indexSelect) { setRowTyped(dataIn, indexSelect); }
+        void setRow(const int32_t* dataIn, const std::vector<int64_t>& indexSelect) { setRowTyped(dataIn, indexSelect); }
+        void setRow(const int16_t* dataIn, const std::vector<int64_t>& indexSelect) { setRowTyped(dataIn, indexSelect); }
+        void setRow(const uint8_t* dataIn, const std::vector<int64_t>& indexSelect) { setRowTyped(dataIn, indexSelect); }
+        void setColumn(const float* dataIn, const int64_t& index);
+        void setRows(const float* dataIn, const int64_t& rowLength, const std::vector<std::vector<int64_t> >& indexSelects);
+        void setRowRange(const float* dataIn, const vector<int64_t>& dims, const vector<int64_t>& indexSelect, const int64_t& numRows);
+        void close();
+    };
+    
+    const int64_t CiftiShardedImpl::STRIPE_BYTES = 1<<24;//16MiB, large enough for efficient IO on each device
+    
     class CiftiMemoryImpl : public CiftiFile::WriteImplInterface
     {
         MultiDimArray<float> m_array;
+        template<typename T>
+        void getRowTyped(T* dataOut, const vector<int64_t>& indexSelect) const;//converts from the stored floats, same rounding as reading a float file into T
+        template<typename T>
+        void setRowTyped(const T* dataIn, const vector<int64_t>& indexSelect);
     public:
         CiftiMemoryImpl(const CiftiXML& xml);
         void getRow(float* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const;
+        void getRow(double* dataOut, const std::vector<int64_t>& indexSelect, const bool&) const { getRowTyped(dataOut, indexSelect); }
+        void getRow(int32_t* dataOut, const std::vector<int64_t>& indexSelect, const bool&) const { getRowTyped(dataOut, indexSelect); }
+        void getRow(int16_t* dataOut, const std::vector<int64_t>& indexSelect, const bool&) const { getRowTyped(dataOut, indexSelect); }
+        void getRow(uint8_t* dataOut, const std::vector<int64_t>& indexSelect, const bool&) const { getRowTyped(dataOut, indexSelect); }
         void getColumn(float* dataOut, const int64_t& index) const;
+        const float* getRowPointer(const std::vector<int64_t>& indexSelect) const;
+        void getRowRange(float* dataOut, const vector<int64_t>& dims, const vector<int64_t>& indexSelect, const int64_t& numRows) const;
         bool isInMemory() const { return true; }
         void setRow(const float* dataIn, const std::vector<int64_t>& indexSelect);
+        void setRow(const double* dataIn, const std::vector<int64_t>& indexSelect) { setRowTyped(dataIn, indexSelect); }
+        void setRow(const int32_t* dataIn, const std::vector<int64_t>& indexSelect) { setRowTyped(dataIn, indexSelect); }
+        void setRow(const int16_t* dataIn, const std::vector<int64_t>& indexSelect) { setRowTyped(dataIn, indexSelect); }
+        void setRow(const uint8_t* dataIn, const std::vector<int64_t>& indexSelect) { setRowTyped(dataIn, indexSelect); }
+        void setColumn(const float* dataIn, const int64_t& index);
+        void setRowRange(const float* dataIn, const vector<int64_t>& dims, const vector<int64_t>& indexSelect, const int64_t& numRows);
+    };
+    
+    //for setWritingDataTypeAutoScaling, stages the data as float and tracks the range of the finite values written, CiftiFile writes the real file when closing
+    class CiftiAutoScaleImpl : public CiftiFile::WriteImplInterface
+    {
+        boost::shared_ptr<CiftiFile::WriteImplInterface> m_staging;
+        AString m_tempName;//empty when staging in memory
+        int64_t m_rowLength, m_numRows;
+        float m_min, m_max;//m_min > m_max until a finite value is written
+        mutable CiftiMutex m_rangeMutex;
+        void addRange(const float* data, const int64_t& count);
+        void removeTemp();
+        template<typename T>
+        void setRowTyped(const T* dataIn, const vector<int64_t>& indexSelect);
+    public:
+        CiftiAutoScaleImpl(const CiftiXML& xml, const AString& tempName);
+        ~CiftiAutoScaleImpl();
+        void getRange(float& minOut, float& maxOut) const;
+        void replaceStaging(const boost::shared_ptr<CiftiFile::WriteImplInterface>& staging);//for convertToInMemory, staging must already have a copy of the data
+        void getRow(float* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const { m_staging->getRow(dataOut, indexSelect, tolerateShortRead); }
+        void getRow(double* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const { m_staging->getRow(dataOut, indexSelect, tolerateShortRead); }
+        void getRow(int32_t* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const { m_staging->getRow(dataOut, indexSelect, tolerateShortRead); }
+        void getRow(int16_t* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const { m_staging->getRow(dataOut, indexSelect, tolerateShortRead); }
+        void getRow(uint8_t* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const { m_staging->getRow(dataOut, indexSelect, tolerateShortRead); }
+        void getColumn(float* dataOut, const int64_t& index) const { m_staging->getColumn(dataOut, index); }
+        const float* getRowPointer(const std::vector<int64_t>& indexSelect) const { return m_staging->getRowPointer(indexSelect); }
+        void getRows(float* dataOut, const int64_t& rowLength, const std::vector<std::vector<int64_t> >& indexSelects) const { m_staging->getRows(dataOut, rowLength, indexSelects); }
+        void getRowRange(float* dataOut, const vector<int64_t>& dims, const vector<int64_t>& indexSelect, const int64_t& numRows) const { m_staging->getRowRange(dataOut, dims, indexSelect, numRows); }
+        bool isInMemory() const { return m_staging->isInMemory(); }
+        void setRow(const float* dataIn, const std::vector<int64_t>& indexSelect);
+        void setRow(const double* dataIn, const std::vector<int64_t>& indexSelect) { setRowTyped(dataIn, indexSelect); }
+        void setRow(const int32_t* dataIn, const std::vector<int64_t>& indexSelect) { setRowTyped(dataIn, indexSelect); }
+        void setRow(const int16_t* dataIn, const std::vector<int64_t>& indexSelect) { setRowTyped(dataIn, indexSelect); }
+        void setRow(const uint8_t* dataIn, const std::vector<int64_t>& indexSelect) { setRowTyped(dataIn, indexSelect); }
         void setColumn(const float* dataIn, const int64_t& index);
+        void setRows(const float* dataIn, const int64_t& rowLength, const std::vector<std::vector<int64_t> >& indexSelects);
+        void setRowRange(const float* dataIn, const vector<int64_t>& dims, const vector<int64_t>& indexSelect, const int64_t& numRows);
+        void setWriteBehind(const int64_t& maxBytes, const vector<int64_t>& dims) { m_staging->setWriteBehind(maxBytes, dims); }
+        void flush() { m_staging->flush(); }
+        void close() { m_staging->close(); }
     };
     
+    //turns the range of the data into the arguments for setDataTypeAndScaleRange, returns false when the data doesn't need scaling
+    bool autoScalingRange(const float& dataMin, const float& dataMax, double& minOut, double& maxOut)
+    {
+        if (!(dataMin <= dataMax)) return false;//no finite values
+        minOut = dataMin;
+        maxOut = dataMax;
+        if (minOut == maxOut)
+        {//a slope of zero means no scaling, so stretch the range to zero, which puts the constant exactly on an end of it
+            if (minOut == 0.0) return false;
+            if (minOut > 0.0)
+            {
+                minOut = 0.0;
+            } else {
+                maxOut = 0.0;
+            }
+        }
+        return true;
+    }
+    
     bool shouldSwap(const CiftiFile::ENDIAN& endian)
     {
         if (ByteSwapping::isBigEndian())
@@ -125,6 +431,107 @@ namespace
         return filesystem::canonical(temp).native();
 #endif
 #endif
+#endif
+    }
+    
+    //for names stored in a file, so the files can be moved together - mypath relative to the directory containing baseFile, when possible
+    AString pathRelativeTo(const AString& mypath, const AString& baseFile)
+    {
+#ifdef CIFTILIB_USE_QT
+        return QFileInfo(baseFile).absoluteDir().relativeFilePath(QFileInfo(mypath).absoluteFilePath());
+#else
+#ifdef CIFTILIB_BOOST_NO_RELATIVE
+        return pathToAbsolute(mypath);//lexically_relative was added in 1.60.0
+#else
+        filesystem::path base = filesystem::absolute(AString_to_std_string(baseFile)).parent_path().lexically_normal();
+        filesystem::path target = filesystem::absolute(AString_to_std_string(mypath)).lexically_normal();
+        filesystem::path ret = target.lexically_relative(base);
+        if (ret.empty()) return target.native();//different drive, etc
+        return ret.generic_string();
+#endif
+#endif
+    }
+    
+    //inverse of the above, relative names are relative to the directory containing baseFile, absolute names are unchanged
+    AString pathResolveFrom(const AString& mypath, const AString& baseFile)
+    {
+#ifdef CIFTILIB_USE_QT
+        return QFileInfo(baseFile).absoluteDir().absoluteFilePath(mypath);
+#else
+        filesystem::path base = filesystem::path(AString_to_std_string(pathToAbsolute(baseFile))).parent_path();
+#ifdef CIFTILIB_BOOST_NO_FSV3
+        return filesystem::complete(AString_to_std_string(mypath), base).file_string();
+#else
+        return filesystem::absolute(AString_to_std_string(mypath), base).native();
+#endif
+#endif
+    }
+    
+    //hidden file next to the output, uncompressed, and ending the same way so that it gets no extension warning
+    AString autoScaleStagingName(const AString& outputName)
+    {
+        AString uncompressed = outputName;
+        if (AString_endsWith(outputName, ".gz")) uncompressed = AString_substr(outputName, 0, outputName.size() - 3);
+        if (AString_endsWith(outputName, ".zst")) uncompressed = AString_substr(outputName, 0, outputName.size() - 4);
+#ifdef CIFTILIB_USE_QT
+        QFileInfo info(uncompressed);
+        return info.absolutePath() + "/.autoscale-" + info.fileName();
+#else
+        filesystem::path temp = AString_to_std_string(uncompressed);
+#ifdef CIFTILIB_BOOST_NO_FSV3
+        return (temp.parent_path() / (".autoscale-" + temp.filename())).file_string();
+#else
+        return (temp.parent_path() / (".autoscale-" + temp.filename().native())).native();
+#endif
+#endif
+    }
+    
+    //enough about a file to tell whether a sidecar still matches it, times are in nanoseconds when the system has them
+    struct FileSignature
+    {
+        int64_t m_size, m_modTime, m_changeTime, m_inode, m_device;//change time is the modification time when there is no ctime
+        bool operator==(const FileSignature& rhs) const
+        {
+            return m_size == rhs.m_size && m_modTime == rhs.m_modTime && m_changeTime == rhs.m_changeTime && m_inode == rhs.m_inode && m_device == rhs.m_device;
+        }
+        bool operator!=(const FileSignature& rhs) const { return !(*this == rhs); }
+    };
+    
+    //false if the file doesn't exist
+    bool pathSignature(const AString& mypath, FileSignature& sigOut)
+    {
+#ifdef CIFTILIB_HAVE_STAT_NSEC
+        struct stat info;
+        if (stat(AString_to_std_string(mypath).c_str(), &info) != 0) return false;
+        sigOut.m_size = info.st_size;
+        sigOut.m_modTime = info.st_mtim.tv_sec * (int64_t)1000000000 + info.st_mtim.tv_nsec;
+        sigOut.m_changeTime = info.st_ctim.tv_sec * (int64_t)1000000000 + info.st_ctim.tv_nsec;//can't be set by utime, unlike mtime
+        sigOut.m_inode = info.st_ino;//a replaced file gets a new inode
+        sigOut.m_device = info.st_dev;
+        return true;
+#else
+        sigOut.m_inode = 0;
+        sigOut.m_device = 0;
+#ifdef CIFTILIB_USE_QT
+        QFileInfo info(mypath);
+        if (!info.exists()) return false;
+        sigOut.m_size = info.size();
+        sigOut.m_modTime = info.lastModified().toMSecsSinceEpoch() * 1000000;
+        sigOut.m_changeTime = sigOut.m_modTime;
+        return true;
+#else
+        try
+        {
+            filesystem::path temp = AString_to_std_string(mypath);
+            if (!filesystem::exists(temp)) return false;
+            sigOut.m_size = filesystem::file_size(temp);
+            sigOut.m_modTime = filesystem::last_write_time(temp) * (int64_t)1000000000;
+            sigOut.m_changeTime = sigOut.m_modTime;
+            return true;
+        } catch (filesystem::filesystem_error&) {
+            return false;
+        }
+#endif
 #endif
     }
 }
@@ -133,6 +540,42 @@ CiftiFile::ReadImplInterface::~ReadImplInterface()
 {
 }
 
+void CiftiFile::ReadImplInterface::getRows(float* dataOut, const int64_t& rowLength, const vector<vector<int64_t> >& indexSelects) const
+{
+    for (size_t i = 0; i < indexSelects.size(); ++i)
+    {
+        getRow(dataOut + i * rowLength, indexSelects[i], false);
+    }
+}
+
+void CiftiFile::WriteImplInterface::setRows(const float* dataIn, const int64_t& rowLength, const vector<vector<int64_t> >& indexSelects)
+{
+    for (size_t i = 0; i < indexSelects.size(); ++i)
+    {
+        setRow(dataIn + i * rowLength, indexSelects[i]);
+    }
+}
+
+void CiftiFile::ReadImplInterface::getRowRange(float* dataOut, const vector<int64_t>& dims, const vector<int64_t>& indexSelect, const int64_t& numRows) const
+{
+    vector<int64_t> rowDims(dims.begin() + 1, dims.end());
+    int64_t first = rowNumber(rowDims, indexSelect);
+    for (int64_t i = 0; i < numRows; ++i)
+    {
+        getRow(dataOut + i * dims[0], rowIndices(rowDims, first + i), false);
+    }
+}
+
+void CiftiFile::WriteImplInterface::setRowRange(const float* dataIn, const vector<int64_t>& dims, const vector<int64_t>& indexSelect, const int64_t& numRows)
+{
+    vector<int64_t> rowDims(dims.begin() + 1, dims.end());
+    int64_t first = rowNumber(rowDims, indexSelect);
+    for (int64_t i = 0; i < numRows; ++i)
+    {
+        setRow(dataIn + i * dims[0], rowIndices(rowDims, first + i));
+    }
+}
+
 CiftiFile::WriteImplInterface::~WriteImplInterface()
 {
 }
@@ -140,38 +583,120 @@ CiftiFile::WriteImplInterface::~WriteImplInterface()
 CiftiFile::CiftiFile()
 {
     m_endianPref = NATIVE;
+    m_writingMethod = BinaryFile::BUFFERED;
+    m_writeBehindBytes = 0;
+    m_shardStripeRows = 0;
     setWritingDataTypeNoScaling();//default argument is float32
 }
 
 CiftiFile::CiftiFile(const AString& fileName)
 {
     m_endianPref = NATIVE;
+    m_writingMethod = BinaryFile::BUFFERED;
+    m_writeBehindBytes = 0;
+    m_shardStripeRows = 0;
     setWritingDataTypeNoScaling();//default argument is float32
     openFile(fileName);
 }
 
-void CiftiFile::openFile(const AString& fileName)
+CiftiFile::~CiftiFile()
+{//other writers finish the file in their own destructors, but auto-scaling has only staged the data, so letting it go out of scope would silently leave no output
+    if (dynamic_cast<CiftiAutoScaleImpl*>(m_writingImpl.get()) == NULL) return;
+    AString fileName = m_writingFile;
+    try
+    {
+        close();
+    } catch (CiftiException& e) {
+        cerr << "error finishing auto-scaled cifti file '" << AString_to_std_string(fileName) << "': " << AString_to_std_string(e.whatString()) << endl;
+    } catch (std::exception& e) {
+        cerr << "error finishing auto-scaled cifti file '" << AString_to_std_string(fileName) << "': " << e.what() << endl;
+    }
+}
+
+void CiftiFile::openFile(const AString& fileName, const BinaryFile::IOMethod& method)
 {
     close();//to make sure it closes everything first, even if the open throws
-    boost::shared_ptr<CiftiOnDiskImpl> newRead(new CiftiOnDiskImpl(pathToAbsolute(fileName)));//this constructor opens existing file read-only
+    boost::shared_ptr<CiftiOnDiskImpl> newRead(new CiftiOnDiskImpl(pathToAbsolute(fileName), method));//this constructor opens existing file read-only
     m_readingImpl = newRead;//it should be noted that if the constructor throws (if the file isn't readable), new guarantees the memory allocated for the object will be freed
     m_xml = newRead->getCiftiXML();
     m_dims = m_xml.getDimensions();
     m_onDiskVersion = m_xml.getParsedVersion();
 }
 
-void CiftiFile::setWritingFile(const AString& fileName, const CiftiVersion& writingVersion, const ENDIAN& endian)
+void CiftiFile::openBuffer(const void* data, const int64_t& size)
+{
+    close();
+    boost::shared_ptr<CiftiOnDiskImpl> newRead(new CiftiOnDiskImpl(data, size));
+    m_readingImpl = newRead;
+    m_xml = newRead->getCiftiXML();
+    m_dims = m_xml.getDimensions();
+    m_onDiskVersion = m_xml.getParsedVersion();
+}
+
+void CiftiFile::writeBuffer(vector<char>& bufferOut, const CiftiVersion& writingVersion, const ENDIAN& endian)
+{
+    if (m_readingImpl == NULL || m_dims.empty()) throw CiftiException("writeBuffer called on uninitialized CiftiFile");
+    if (m_writingImpl != NULL) m_writingImpl->flush();//report errors from write-behind
+    bool rescale;
+    double minval, maxval;
+    getWritingScaling(rescale, minval, maxval);
+    boost::shared_ptr<WriteImplInterface> tempWrite(new CiftiOnDiskImpl("<memory>", m_xml, writingVersion, shouldSwap(endian), m_writingDataType, rescale,
+                                                                        minval, maxval, BinaryFile::BUFFERED, &bufferOut, m_rowScaleBlock));
+    copyImplData(m_readingImpl.get(), tempWrite.get(), m_dims);
+    tempWrite->close();
+}
+
+void CiftiFile::writeTileSidecar(const AString& fileName, const int64_t& tileSize)
+{
+    if (tileSize < 1) throw CiftiException("tile size must be positive");
+    AString absName = pathToAbsolute(fileName);
+    CiftiOnDiskImpl reader(absName);
+    vector<int64_t> dims = reader.getCiftiXML().getDimensions();
+    if (dims.size() != 2) throw CiftiException("tile sidecar is only supported for 2D cifti files, '" + fileName + "' has " + AString_number(dims.size()) + " dimensions");
+    TileSidecar::write(&reader, absName, dims, tileSize);
+}
+
+void CiftiFile::openShardedFile(const AString& manifestName)
+{
+    close();
+    boost::shared_ptr<CiftiShardedImpl> newRead(new CiftiShardedImpl(pathToAbsolute(manifestName)));
+    m_readingImpl = newRead;
+    m_xml = newRead->getCiftiXML();
+    m_dims = m_xml.getDimensions();
+    m_onDiskVersion = m_xml.getParsedVersion();
+}
+
+void CiftiFile::setWritingShardedFile(const AString& manifestName, const vector<AString>& shardNames, const int64_t& stripeRows,
+                                      const CiftiVersion& writingVersion, const ENDIAN& endian)
+{
+    if (shardNames.empty()) throw CiftiException("setWritingShardedFile called with no shard files");
+    if (stripeRows < 0) throw CiftiException("setWritingShardedFile called with negative stripe size");
+    setWritingFile(manifestName, writingVersion, endian);
+    for (size_t i = 0; i < shardNames.size(); ++i)
+    {
+        if (BinaryFile::isCompressedName(shardNames[i])) throw CiftiException("shard file '" + shardNames[i] + "' can't be compressed, shards are written in any order");
+        m_writingShards.push_back(pathToAbsolute(shardNames[i]));
+    }
+    m_shardStripeRows = stripeRows;
+}
+
+void CiftiFile::setWritingFile(const AString& fileName, const CiftiVersion& writingVersion, const ENDIAN& endian, const BinaryFile::IOMethod& method)
 {
     m_writingFile = pathToAbsolute(fileName);//always resolve paths as soon as they enter CiftiFile, in case some clown changes directory before writing data
+    m_writingShards.clear();
     m_writingImpl.reset();//prevent writing to previous writing implementation, let the next set...() set up for writing
     m_onDiskVersion = writingVersion;
     m_endianPref = endian;
+    m_writingMethod = method;
 }
 
 void CiftiFile::setWritingDataTypeNoScaling(const int16_t& type)
 {
     m_writingDataType = type;//could do some validation here
     m_doWriteScaling = false;
+    m_autoScaling = false;
+    m_autoScaleOnDisk = false;
+    m_rowScaleBlock = -1;
     m_minScalingVal = -1.0;//these scaling values should never be used, but don't leave them uninitialized
     m_maxScalingVal = 1.0;
     m_writingImpl.reset();//prevent writing to previous writing implementation, let the next set...() set up for writing
@@ -181,14 +706,72 @@ void CiftiFile::setWritingDataTypeAndScaling(const int16_t& type, const double&
 {
     m_writingDataType = type;//could do some validation here
     m_doWriteScaling = true;
+    m_autoScaling = false;
+    m_autoScaleOnDisk = false;
+    m_rowScaleBlock = -1;
     m_minScalingVal = minval;
     m_maxScalingVal = maxval;
     m_writingImpl.reset();//prevent writing to previous writing implementation, let the next set...() set up for writing
 }
 
+void CiftiFile::setWritingDataTypeAutoScaling(const int16_t& type, const bool& stageOnDisk)
+{
+    m_writingDataType = type;
+    m_doWriteScaling = false;//decided when writing
+    m_autoScaling = true;
+    m_autoScaleOnDisk = stageOnDisk;
+    m_rowScaleBlock = -1;
+    m_minScalingVal = -1.0;
+    m_maxScalingVal = 1.0;
+    m_writingImpl.reset();//prevent writing to previous writing implementation, let the next set...() set up for writing
+}
+
+void CiftiFile::setWritingDataTypeRowScaling(const int16_t& type, const int64_t& blockLength)
+{
+    if (type != NIFTI_TYPE_INT8 && type != NIFTI_TYPE_INT16) throw CiftiException("per-row scaling is only supported for int8 and int16 data");
+    if (blockLength < 0) throw CiftiException("per-row scaling block length can't be negative");
+    m_writingDataType = type;
+    m_doWriteScaling = false;//the table replaces the header scaling
+    m_autoScaling = false;
+    m_autoScaleOnDisk = false;
+    m_rowScaleBlock = blockLength;
+    m_minScalingVal = -1.0;
+    m_maxScalingVal = 1.0;
+    m_writingImpl.reset();//prevent writing to previous writing implementation, let the next set...() set up for writing
+}
+
+void CiftiFile::getWritingScaling(bool& rescale, double& minval, double& maxval) const
+{
+    rescale = m_doWriteScaling;
+    minval = m_minScalingVal;
+    maxval = m_maxScalingVal;
+    if (!m_autoScaling) return;
+    float dataMin = numeric_limits<float>::infinity(), dataMax = -numeric_limits<float>::infinity();
+    const CiftiAutoScaleImpl* autoImpl = dynamic_cast<const CiftiAutoScaleImpl*>(m_readingImpl.get());
+    if (autoImpl != NULL)
+    {
+        autoImpl->getRange(dataMin, dataMax);
+    } else {//data that didn't go through setRow in this mode, so we need the extra pass after all
+        vector<int64_t> iterateDims(m_dims.begin() + 1, m_dims.end());
+        vector<float> scratchRow(m_dims[0]);
+        for (MultiDimIterator<int64_t> iter(iterateDims); !iter.atEnd(); ++iter)
+        {
+            m_readingImpl->getRow(scratchRow.data(), *iter, false);
+            DataConversion::updateRange(scratchRow.data(), m_dims[0], dataMin, dataMax);
+        }
+    }
+    if (autoScalingRange(dataMin, dataMax, minval, maxval))
+    {
+        rescale = true;
+    } else {
+        rescale = false;//leave minval and maxval at the unused defaults
+    }
+}
+
 void CiftiFile::writeFile(const AString& fileName, const CiftiVersion& writingVersion, const ENDIAN& endian)
 {
     if (m_readingImpl == NULL || m_dims.empty()) throw CiftiException("writeFile called on uninitialized CiftiFile");
+    if (m_writingImpl != NULL) m_writingImpl->flush();//report errors from write-behind
     bool writeSwapped = shouldSwap(endian);
     AString canonicalFilename = pathToCanonical(fileName);//NOTE: returns EMPTY STRING for nonexistent file
     const CiftiOnDiskImpl* testImpl = dynamic_cast<CiftiOnDiskImpl*>(m_readingImpl.get());
@@ -202,10 +785,16 @@ void CiftiFile::writeFile(const AString& fileName, const CiftiVersion& writingVe
         m_readingImpl = tempMemory;//we are about to make the old reading impl very unhappy, replace it so that if we get an error while writing, we hang onto the memory version
         m_writingImpl.reset();//and make it re-magic the writing implementation again if it tries to write again
     }
+    bool rescale;
+    double minval, maxval;
+    getWritingScaling(rescale, minval, maxval);
     boost::shared_ptr<WriteImplInterface> tempWrite(new CiftiOnDiskImpl(pathToAbsolute(fileName), m_xml, writingVersion, writeSwapped,
-                                                                        m_writingDataType, m_doWriteScaling, m_minScalingVal, m_maxScalingVal));
+                                                                        m_writingDataType, rescale, minval, maxval, BinaryFile::BUFFERED, NULL, m_rowScaleBlock));
     copyImplData(m_readingImpl.get(), tempWrite.get(), m_dims);
-    if (collision)//if we rewrote the file, we need the handle to the new file, and to dump the temporary in-memory version
+    if (collision && BinaryFile::isCompressedName(fileName))
+    {//compressed files can't be read while open for writing, so keep reading from the in-memory copy
+        m_onDiskVersion = writingVersion;
+    } else if (collision)//if we rewrote the file, we need the handle to the new file, and to dump the temporary in-memory version
     {
         m_onDiskVersion = writingVersion;//also record the current version number
         m_readingImpl = tempWrite;//replace the temporary memory version
@@ -220,6 +809,16 @@ void CiftiFile::close()
 {
     if (m_writingImpl != NULL)
     {
+        if (dynamic_cast<CiftiAutoScaleImpl*>(m_writingImpl.get()) != NULL)
+        {//all the data has been seen, so now we can write the real file
+            bool rescale;
+            double minval, maxval;
+            getWritingScaling(rescale, minval, maxval);
+            boost::shared_ptr<WriteImplInterface> output = makeFileWriter(rescale, minval, maxval);
+            if (m_writeBehindBytes > 0) output->setWriteBehind(m_writeBehindBytes, m_dims);
+            copyImplData(m_writingImpl.get(), output.get(), m_dims);
+            output->close();
+        }
         m_writingImpl->close();//only writing implementations should ever throw errors on close, and specifically only on-disk
     }
     m_writingImpl.reset();
@@ -227,8 +826,12 @@ void CiftiFile::close()
     m_dims.clear();
     m_xml = CiftiXML();
     m_writingFile = "";
+    m_writingShards.clear();
     m_onDiskVersion = CiftiVersion();//for completeness, it gets reset on open anyway
     m_endianPref = NATIVE;//reset things to defaults
+    m_writingMethod = BinaryFile::BUFFERED;
+    m_writeBehindBytes = 0;
+    m_shardStripeRows = 0;
     setWritingDataTypeNoScaling();//default argument is float32
 }
 
@@ -242,6 +845,12 @@ void CiftiFile::convertToInMemory()
     }
     boost::shared_ptr<WriteImplInterface> tempWrite(new CiftiMemoryImpl(m_xml));//if we get an error while reading, free the memory immediately, and don't leave m_readingImpl and m_writingImpl pointing to different things
     copyImplData(m_readingImpl.get(), tempWrite.get(), m_dims);
+    CiftiAutoScaleImpl* autoImpl = dynamic_cast<CiftiAutoScaleImpl*>(m_readingImpl.get());
+    if (autoImpl != NULL && autoImpl == m_writingImpl.get())
+    {//keep the output file and the tracked range, only move the staged data
+        autoImpl->replaceStaging(tempWrite);
+        return;
+    }
     m_writingImpl = tempWrite;
     m_readingImpl = tempWrite;
 }
@@ -256,13 +865,46 @@ bool CiftiFile::isInMemory() const
     }
 }
 
-void CiftiFile::getRow(float* dataOut, const vector<int64_t>& indexSelect, const bool& tolerateShortRead) const
+template<typename T>
+void CiftiFile::getRowTyped(T* dataOut, const vector<int64_t>& indexSelect, const bool& tolerateShortRead) const
 {
     if (m_dims.empty()) throw CiftiException("getRow called on uninitialized CiftiFile");
     if (m_readingImpl == NULL) return;//NOT an error because we are pretending to have a matrix already, while we are waiting for setRow to actually start writing the file
     m_readingImpl->getRow(dataOut, indexSelect, tolerateShortRead);
 }
 
+void CiftiFile::getRow(float* dataOut, const vector<int64_t>& indexSelect, const bool& tolerateShortRead) const
+{
+    getRowTyped(dataOut, indexSelect, tolerateShortRead);
+}
+
+void CiftiFile::getRow(double* dataOut, const vector<int64_t>& indexSelect, const bool& tolerateShortRead) const
+{
+    getRowTyped(dataOut, indexSelect, tolerateShortRead);
+}
+
+void CiftiFile::getRow(int32_t* dataOut, const vector<int64_t>& indexSelect, const bool& tolerateShortRead) const
+{
+    getRowTyped(dataOut, indexSelect, tolerateShortRead);
+}
+
+void CiftiFile::getRow(int16_t* dataOut, const vector<int64_t>& indexSelect, const bool& tolerateShortRead) const
+{
+    getRowTyped(dataOut, indexSelect, tolerateShortRead);
+}
+
+void CiftiFile::getRow(uint8_t* dataOut, const vector<int64_t>& indexSelect, const bool& tolerateShortRead) const
+{
+    getRowTyped(dataOut, indexSelect, tolerateShortRead);
+}
+
+const float* CiftiFile::getRowPointer(const vector<int64_t>& indexSelect) const
+{
+    if (m_dims.empty()) throw CiftiException("getRowPointer called on uninitialized CiftiFile");
+    if (m_readingImpl == NULL) return NULL;//there is no matrix yet, so there is nothing to point to
+    return m_readingImpl->getRowPointer(indexSelect);
+}
+
 void CiftiFile::getColumn(float* dataOut, const int64_t& index) const
 {
     if (m_dims.empty()) throw CiftiException("getColumn called on uninitialized CiftiFile");
@@ -271,6 +913,43 @@ void CiftiFile::getColumn(float* dataOut, const int64_t& index) const
     m_readingImpl->getColumn(dataOut, index);
 }
 
+void CiftiFile::getRows(float* dataOut, const vector<vector<int64_t> >& indexSelects) const
+{
+    if (m_dims.empty()) throw CiftiException("getRows called on uninitialized CiftiFile");
+    if (m_readingImpl == NULL) return;//NOT an error because we are pretending to have a matrix already, while we are waiting for setRow to actually start writing the file
+    m_readingImpl->getRows(dataOut, m_dims[0], indexSelects);
+}
+
+void CiftiFile::setAccessPattern(const AccessPattern& pattern) const
+{
+    if (m_readingImpl == NULL) return;//only a hint
+    m_readingImpl->setAccessPattern(pattern);
+}
+
+void CiftiFile::willNeedRows(const int64_t& firstRow, const int64_t& numRows) const
+{
+    if (m_dims.empty()) throw CiftiException("willNeedRows called on uninitialized CiftiFile");
+    if (m_dims.size() != 2) throw CiftiException("willNeedRows called on non-2D CiftiFile");
+    if (firstRow < 0 || numRows < 0 || firstRow + numRows > m_dims[1]) throw CiftiException("willNeedRows called with invalid row range");
+    if (m_readingImpl == NULL || numRows == 0) return;
+    m_readingImpl->willNeedRows(m_dims[0], firstRow, numRows);
+}
+
+void CiftiFile::setReadAhead(const int64_t& maxBytes)
+{
+    if (m_dims.empty()) throw CiftiException("setReadAhead called on uninitialized CiftiFile");
+    if (maxBytes < 0) throw CiftiException("setReadAhead called with negative size");
+    if (m_readingImpl == NULL || m_writingImpl != NULL) return;//rows that are being written can't be read ahead
+    m_readingImpl->setReadAhead(maxBytes, m_dims);
+}
+
+void CiftiFile::setWriteBehind(const int64_t& maxBytes)
+{
+    if (maxBytes < 0) throw CiftiException("setWriteBehind called with negative size");
+    m_writeBehindBytes = maxBytes;
+    if (m_writingImpl != NULL) m_writingImpl->setWriteBehind(maxBytes, m_dims);//in-memory ignores it
+}
+
 void CiftiFile::setCiftiXML(const CiftiXML& xml, const bool useOldMetadata)
 {
     if (xml.getNumberOfDimensions() == 0) throw CiftiException("setCiftiXML called with 0-dimensional CiftiXML");
@@ -292,12 +971,70 @@ void CiftiFile::setCiftiXML(const CiftiXML& xml, const bool useOldMetadata)
     m_dims = xmlDims;
 }
 
-void CiftiFile::setRow(const float* dataIn, const vector<int64_t>& indexSelect)
+template<typename T>
+void CiftiFile::setRowTyped(const T* dataIn, const vector<int64_t>& indexSelect)
 {
     verifyWriteImpl();
     m_writingImpl->setRow(dataIn, indexSelect);
 }
 
+void CiftiFile::setRow(const float* dataIn, const vector<int64_t>& indexSelect)
+{
+    setRowTyped(dataIn, indexSelect);
+}
+
+void CiftiFile::setRow(const double* dataIn, const vector<int64_t>& indexSelect)
+{
+    setRowTyped(dataIn, indexSelect);
+}
+
+void CiftiFile::setRow(const int32_t* dataIn, const vector<int64_t>& indexSelect)
+{
+    setRowTyped(dataIn, indexSelect);
+}
+
+void CiftiFile::setRow(const int16_t* dataIn, const vector<int64_t>& indexSelect)
+{
+    setRowTyped(dataIn, indexSelect);
+}
+
+void CiftiFile::setRow(const uint8_t* dataIn, const vector<int64_t>& indexSelect)
+{
+    setRowTyped(dataIn, indexSelect);
+}
+
+void CiftiFile::setRows(const float* dataIn, const vector<vector<int64_t> >& indexSelects)
+{
+    verifyWriteImpl();
+    m_writingImpl->setRows(dataIn, m_dims[0], indexSelects);
+}
+
+void CiftiFile::getRowRange(float* dataOut, const vector<int64_t>& indexSelect, const int64_t& numRows) const
+{
+    if (m_dims.empty()) throw CiftiException("getRowRange called on uninitialized CiftiFile");
+    checkRowRange(indexSelect, numRows);
+    if (m_readingImpl == NULL || numRows == 0) return;//NOT an error because we are pretending to have a matrix already, while we are waiting for setRow to actually start writing the file
+    m_readingImpl->getRowRange(dataOut, m_dims, indexSelect, numRows);
+}
+
+void CiftiFile::setRowRange(const float* dataIn, const vector<int64_t>& indexSelect, const int64_t& numRows)
+{
+    verifyWriteImpl();
+    checkRowRange(indexSelect, numRows);
+    if (numRows == 0) return;
+    m_writingImpl->setRowRange(dataIn, m_dims, indexSelect, numRows);
+}
+
+void CiftiFile::checkRowRange(const vector<int64_t>& indexSelect, const int64_t& numRows) const
+{
+    vector<int64_t> rowDims(m_dims.begin() + 1, m_dims.end());
+    if (indexSelect.size() != rowDims.size()) throw CiftiException("row range has the wrong number of indices for this CiftiFile");
+    int64_t first = rowNumber(rowDims, indexSelect), total = 1;
+    if (first < 0) throw CiftiException("row range starts outside of the matrix");
+    for (size_t i = 0; i < rowDims.size(); ++i) total *= rowDims[i];
+    if (numRows < 0 || first + numRows > total) throw CiftiException("row range extends past the end of the matrix");
+}
+
 void CiftiFile::setColumn(const float* dataIn, const int64_t& index)
 {
     verifyWriteImpl();
@@ -306,7 +1043,8 @@ void CiftiFile::setColumn(const float* dataIn, const int64_t& index)
 }
 
 //single-index functions
-void CiftiFile::getRow(float* dataOut, const int64_t& index, const bool& tolerateShortRead) const
+template<typename T>
+void CiftiFile::getRowTyped(T* dataOut, const int64_t& index, const bool& tolerateShortRead) const
 {
     if (m_dims.empty()) throw CiftiException("getRow called on uninitialized CiftiFile");
     if (m_dims.size() != 2) throw CiftiException("getRow with single index called on non-2D CiftiFile");
@@ -315,19 +1053,117 @@ void CiftiFile::getRow(float* dataOut, const int64_t& index, const bool& tolerat
     m_readingImpl->getRow(dataOut, tempvec, tolerateShortRead);
 }
 
-void CiftiFile::setRow(const float* dataIn, const int64_t& index)
+void CiftiFile::getRow(float* dataOut, const int64_t& index, const bool& tolerateShortRead) const
+{
+    getRowTyped(dataOut, index, tolerateShortRead);
+}
+
+void CiftiFile::getRow(double* dataOut, const int64_t& index, const bool& tolerateShortRead) const
+{
+    getRowTyped(dataOut, index, tolerateShortRead);
+}
+
+void CiftiFile::getRow(int32_t* dataOut, const int64_t& index, const bool& tolerateShortRead) const
+{
+    getRowTyped(dataOut, index, tolerateShortRead);
+}
+
+void CiftiFile::getRow(int16_t* dataOut, const int64_t& index, const bool& tolerateShortRead) const
+{
+    getRowTyped(dataOut, index, tolerateShortRead);
+}
+
+void CiftiFile::getRow(uint8_t* dataOut, const int64_t& index, const bool& tolerateShortRead) const
+{
+    getRowTyped(dataOut, index, tolerateShortRead);
+}
+
+template<typename T>
+void CiftiFile::setRowTyped(const T* dataIn, const int64_t& index)
 {
     verifyWriteImpl();
     if (m_dims.size() != 2) throw CiftiException("setRow with single index called on non-2D CiftiFile");
     vector<int64_t> tempvec(1, index);//could use a member if we need more speed
     m_writingImpl->setRow(dataIn, tempvec);
 }
-//*///end single-index functions
 
-void CiftiFile::verifyWriteImpl()
-{//this is where the magic happens - we want to emulate being a simple in-memory file, but actually be reading/writing on-disk when possible
-    if (m_writingImpl != NULL) return;
-    CiftiAssert(!m_dims.empty());//if the xml hasn't been set, then we can't do anything meaningful
+void CiftiFile::setRow(const float* dataIn, const int64_t& index)
+{
+    setRowTyped(dataIn, index);
+}
+
+void CiftiFile::setRow(const double* dataIn, const int64_t& index)
+{
+    setRowTyped(dataIn, index);
+}
+
+void CiftiFile::setRow(const int32_t* dataIn, const int64_t& index)
+{
+    setRowTyped(dataIn, index);
+}
+
+void CiftiFile::setRow(const int16_t* dataIn, const int64_t& index)
+{
+    setRowTyped(dataIn, index);
+}
+
+void CiftiFile::setRow(const uint8_t* dataIn, const int64_t& index)
+{
+    setRowTyped(dataIn, index);
+}
+
+const float* CiftiFile::getRowPointer(const int64_t& index) const
+{
+    if (m_dims.empty()) throw CiftiException("getRowPointer called on uninitialized CiftiFile");
+    if (m_dims.size() != 2) throw CiftiException("getRowPointer with single index called on non-2D CiftiFile");
+    if (m_readingImpl == NULL) return NULL;
+    vector<int64_t> tempvec(1, index);
+    return m_readingImpl->getRowPointer(tempvec);
+}
+
+void CiftiFile::getRows(float* dataOut, const vector<int64_t>& indices) const
+{
+    if (m_dims.empty()) throw CiftiException("getRows called on uninitialized CiftiFile");
+    if (m_dims.size() != 2) throw CiftiException("getRows with single indices called on non-2D CiftiFile");
+    vector<vector<int64_t> > indexSelects(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        indexSelects[i] = vector<int64_t>(1, indices[i]);
+    }
+    getRows(dataOut, indexSelects);
+}
+
+void CiftiFile::setRows(const float* dataIn, const vector<int64_t>& indices)
+{
+    verifyWriteImpl();
+    if (m_dims.size() != 2) throw CiftiException("setRows with single indices called on non-2D CiftiFile");
+    vector<vector<int64_t> > indexSelects(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        indexSelects[i] = vector<int64_t>(1, indices[i]);
+    }
+    m_writingImpl->setRows(dataIn, m_dims[0], indexSelects);
+}
+
+void CiftiFile::getRows(float* dataOut, const int64_t& firstRow, const int64_t& numRows) const
+{
+    if (m_dims.empty()) throw CiftiException("getRows called on uninitialized CiftiFile");
+    if (m_dims.size() != 2) throw CiftiException("getRows with row range called on non-2D CiftiFile");
+    getRowRange(dataOut, vector<int64_t>(1, firstRow), numRows);
+}
+
+void CiftiFile::setRows(const float* dataIn, const int64_t& firstRow, const int64_t& numRows)
+{
+    verifyWriteImpl();
+    if (m_dims.size() != 2) throw CiftiException("setRows with row range called on non-2D CiftiFile");
+    setRowRange(dataIn, vector<int64_t>(1, firstRow), numRows);
+}
+//*///end single-index functions
+
+void CiftiFile::verifyWriteImpl()
+{//this is where the magic happens - we want to emulate being a simple in-memory file, but actually be reading/writing on-disk when possible
+    if (m_writingImpl != NULL) return;
+    CiftiAssert(!m_dims.empty());//if the xml hasn't been set, then we can't do anything meaningful
     if (m_dims.empty()) throw CiftiException("setRow or setColumn attempted on uninitialized CiftiFile");
     if (m_writingFile == "")
     {
@@ -340,18 +1176,33 @@ void CiftiFile::verifyWriteImpl()
     } else {//NOTE: m_onDiskVersion gets set in setWritingFile
         if (m_readingImpl != NULL)
         {
+            vector<AString> readingFiles, writingFiles(1, m_writingFile);
             CiftiOnDiskImpl* testImpl = dynamic_cast<CiftiOnDiskImpl*>(m_readingImpl.get());
-            if (testImpl != NULL)
+            CiftiShardedImpl* testSharded = dynamic_cast<CiftiShardedImpl*>(m_readingImpl.get());
+            if (testImpl != NULL) readingFiles.push_back(testImpl->getFilename());
+            if (testSharded != NULL) readingFiles = testSharded->getFilenames();
+            writingFiles.insert(writingFiles.end(), m_writingShards.begin(), m_writingShards.end());
+            bool collision = false;
+            for (size_t i = 0; i < readingFiles.size() && !collision; ++i)
             {
-                AString canonicalCurrent = pathToCanonical(testImpl->getFilename());//returns "" if nonexistent, if unlinked while open
-                if (canonicalCurrent != "" && canonicalCurrent == pathToCanonical(m_writingFile))//these were already absolute
+                AString canonicalCurrent = pathToCanonical(readingFiles[i]);//returns "" if nonexistent, if unlinked while open
+                for (size_t j = 0; j < writingFiles.size(); ++j)
                 {
-                    convertToInMemory();//save existing data in memory before we clobber file
+                    if (canonicalCurrent != "" && canonicalCurrent == pathToCanonical(writingFiles[j])) collision = true;//these were already absolute
                 }
             }
+            if (collision)
+            {
+                convertToInMemory();//save existing data in memory before we clobber file
+            }
         }
-        m_writingImpl = boost::shared_ptr<CiftiOnDiskImpl>(new CiftiOnDiskImpl(m_writingFile, m_xml, m_onDiskVersion, shouldSwap(m_endianPref),
-                                                                               m_writingDataType, m_doWriteScaling, m_minScalingVal, m_maxScalingVal));//this constructor makes new file for writing
+        if (m_autoScaling)
+        {//the output file is written by close(), once the range is known
+            m_writingImpl = boost::shared_ptr<CiftiAutoScaleImpl>(new CiftiAutoScaleImpl(m_xml, m_autoScaleOnDisk ? autoScaleStagingName(m_writingFile) : AString()));
+        } else {
+            m_writingImpl = makeFileWriter(m_doWriteScaling, m_minScalingVal, m_maxScalingVal);
+        }
+        if (m_writeBehindBytes > 0) m_writingImpl->setWriteBehind(m_writeBehindBytes, m_dims);
         if (m_readingImpl != NULL)
         {
             copyImplData(m_readingImpl.get(), m_writingImpl.get(), m_dims);
@@ -360,6 +1211,18 @@ void CiftiFile::verifyWriteImpl()
     m_readingImpl = m_writingImpl;//read-only implementations are set up in specialized functions
 }
 
+boost::shared_ptr<CiftiFile::WriteImplInterface> CiftiFile::makeFileWriter(const bool& rescale, const double& minval, const double& maxval) const
+{
+    if (m_writingShards.empty())
+    {
+        return boost::shared_ptr<CiftiOnDiskImpl>(new CiftiOnDiskImpl(m_writingFile, m_xml, m_onDiskVersion, shouldSwap(m_endianPref),
+                                                                      m_writingDataType, rescale, minval, maxval, m_writingMethod, NULL, m_rowScaleBlock));//this constructor makes new file for writing
+    }
+    if (m_rowScaleBlock >= 0) throw CiftiException("per-row scaling is not supported for sharded files");
+    return boost::shared_ptr<CiftiShardedImpl>(new CiftiShardedImpl(m_writingFile, m_writingShards, m_shardStripeRows, m_xml, m_onDiskVersion, shouldSwap(m_endianPref),
+                                                                    m_writingDataType, rescale, minval, maxval));
+}
+
 void CiftiFile::copyImplData(const ReadImplInterface* from, WriteImplInterface* to, const vector<int64_t>& dims)
 {
     vector<int64_t> iterateDims(dims.begin() + 1, dims.end());
@@ -387,6 +1250,11 @@ void CiftiMemoryImpl::getRow(float* dataOut, const vector<int64_t>& indexSelect,
     }
 }
 
+const float* CiftiMemoryImpl::getRowPointer(const vector<int64_t>& indexSelect) const
+{
+    return m_array.get(1, indexSelect);
+}
+
 void CiftiMemoryImpl::getColumn(float* dataOut, const int64_t& index) const
 {
     CiftiAssert(m_array.getDimensions().size() == 2);//otherwise, CiftiFile shouldn't have called this
@@ -400,6 +1268,28 @@ void CiftiMemoryImpl::getColumn(float* dataOut, const int64_t& index) const
     }
 }
 
+template<typename T>
+void CiftiMemoryImpl::getRowTyped(T* dataOut, const vector<int64_t>& indexSelect) const
+{
+    const float* ref = m_array.get(1, indexSelect);
+    int64_t rowSize = m_array.getDimensions()[0];
+    for (int64_t i = 0; i < rowSize; ++i)
+    {
+        dataOut[i] = convertFromFloat<T>(ref[i]);
+    }
+}
+
+template<typename T>
+void CiftiMemoryImpl::setRowTyped(const T* dataIn, const vector<int64_t>& indexSelect)
+{
+    float* ref = m_array.get(1, indexSelect);
+    int64_t rowSize = m_array.getDimensions()[0];
+    for (int64_t i = 0; i < rowSize; ++i)
+    {
+        ref[i] = (float)dataIn[i];
+    }
+}
+
 void CiftiMemoryImpl::setRow(const float* dataIn, const vector<int64_t>& indexSelect)
 {
     float* ref = m_array.get(1, indexSelect);
@@ -410,6 +1300,18 @@ void CiftiMemoryImpl::setRow(const float* dataIn, const vector<int64_t>& indexSe
     }
 }
 
+void CiftiMemoryImpl::getRowRange(float* dataOut, const vector<int64_t>& dims, const vector<int64_t>& indexSelect, const int64_t& numRows) const
+{
+    const float* ref = m_array.get(1, indexSelect);//consecutive rows are contiguous
+    memcpy(dataOut, ref, numRows * dims[0] * sizeof(float));
+}
+
+void CiftiMemoryImpl::setRowRange(const float* dataIn, const vector<int64_t>& dims, const vector<int64_t>& indexSelect, const int64_t& numRows)
+{
+    float* ref = m_array.get(1, indexSelect);
+    memcpy(ref, dataIn, numRows * dims[0] * sizeof(float));
+}
+
 void CiftiMemoryImpl::setColumn(const float* dataIn, const int64_t& index)
 {
     CiftiAssert(m_array.getDimensions().size() == 2);//otherwise, CiftiFile shouldn't have called this
@@ -423,9 +1325,24 @@ void CiftiMemoryImpl::setColumn(const float* dataIn, const int64_t& index)
     }
 }
 
-CiftiOnDiskImpl::CiftiOnDiskImpl(const AString& filename)
+CiftiOnDiskImpl::CiftiOnDiskImpl(const AString& filename, const BinaryFile::IOMethod& method)
 {//opens existing file for reading
-    m_nifti.openRead(filename);//read-only, so we don't need write permission to read a cifti file
+    m_rowScaleExtension = -1;
+    m_nifti.openRead(filename, method);//read-only, so we don't need write permission to read a cifti file
+    readCiftiHeader();
+    if (m_xml.getNumberOfDimensions() == 2) m_tiles = TileSidecar::open(filename, m_xml.getDimensions());
+}
+
+CiftiOnDiskImpl::CiftiOnDiskImpl(const void* data, const int64_t& size)
+{//reads from caller-owned memory, data is used in place
+    m_rowScaleExtension = -1;
+    m_nifti.openReadMemory(data, size);
+    readCiftiHeader();
+}
+
+void CiftiOnDiskImpl::readCiftiHeader()
+{
+    const AString filename = m_nifti.getFilename();
     if (m_nifti.getNumComponents() != 1) throw CiftiException("complex or rgb datatype found in file '" + filename + "', these are not supported in cifti");
     const NiftiHeader& myHeader = m_nifti.getHeader();
     int numExts = (int)myHeader.m_extensions.size(), whichExt = -1;
@@ -466,6 +1383,16 @@ CiftiOnDiskImpl::CiftiOnDiskImpl(const AString& filename)
             }
         }
     }
+    for (int i = 0; i < numExts; ++i)
+    {
+        if (myHeader.m_extensions[i]->m_ecode == CIFTILIB_ECODE_ROW_SCALING)
+        {
+            double mult, offset;
+            if (myHeader.getDataScaling(mult, offset)) throw CiftiException("file '" + filename + "' has both per-row and global scaling");//the table applies to the stored integers
+            m_rowScales.reset(new RowScaleTable(myHeader.getDataType(), m_xml.getDimensions(), myHeader.m_extensions[i]->m_bytes, myHeader.isSwapped(), filename));
+            break;
+        }
+    }
 }
 
 namespace
@@ -575,9 +1502,19 @@ namespace
 }
 
 CiftiOnDiskImpl::CiftiOnDiskImpl(const AString& filename, const CiftiXML& xml, const CiftiVersion& version, const bool& swapEndian,
-                                 const int16_t& datatype, const bool& rescale, const double& minval, const double& maxval)
+                                 const int16_t& datatype, const bool& rescale, const double& minval, const double& maxval, const BinaryFile::IOMethod& method,
+                                 vector<char>* memoryOut, const int64_t& rowScaleBlock)
 {//starts writing new file
-    warnForBadExtension(filename, xml);
+    m_rowScaleExtension = -1;
+    if (rowScaleBlock >= 0 && memoryOut == NULL && BinaryFile::isCompressedName(filename))
+    {
+        throw CiftiException("file '" + filename + "' can't be compressed, per-row scaling is written to the header when the file is closed");
+    }
+    if (memoryOut == NULL)
+    {
+        warnForBadExtension(filename, xml);
+        remove(AString_to_std_string(TileSidecar::sidecarName(filename)).c_str());//a sidecar from the old contents would be stale, and could have the same size and timestamp
+    }
     NiftiHeader outHeader;
     if (rescale)
     {
@@ -596,6 +1533,16 @@ CiftiOnDiskImpl::CiftiOnDiskImpl(const AString& filename, const CiftiXML& xml, c
     outExtension->m_ecode = NIFTI_ECODE_CIFTI;
     outExtension->m_bytes = xml.writeXMLToVector(version);
     outHeader.m_extensions.push_back(outExtension);
+    if (rowScaleBlock >= 0)
+    {//reserve the space for the table now, close() writes the real one
+        m_rowScales.reset(new RowScaleTable(datatype, xml.getDimensions(), rowScaleBlock));
+        boost::shared_ptr<NiftiExtension> scaleExtension(new NiftiExtension());
+        scaleExtension->m_ecode = CIFTILIB_ECODE_ROW_SCALING;
+        scaleExtension->m_bytes = m_rowScales->toBytes(swapEndian);
+        m_rowScaleExtension = (int)outHeader.m_extensions.size();
+        outHeader.m_extensions.push_back(scaleExtension);
+    }
+    bool withRead = !BinaryFile::isCompressedName(filename);//compressed files can only be written sequentially, and not read back until closed
     vector<int64_t> matrixDims = xml.getDimensions();
     vector<int64_t> niftiDims(4, 1);//the reserved space and time dims
     niftiDims.insert(niftiDims.end(), matrixDims.begin(), matrixDims.end());
@@ -607,54 +1554,1197 @@ CiftiOnDiskImpl::CiftiOnDiskImpl(const AString& filename, const CiftiXML& xml, c
         headerDims[4] = headerDims[5];
         headerDims[5] = temp;
         outHeader.setDimensions(headerDims);//give the header the reversed dimensions
-        m_nifti.writeNew(filename, outHeader, 2, true, swapEndian);
-        m_nifti.overrideDimensions(niftiDims);//and then tell the nifti reader to use the correct dimensions
     } else {
         outHeader.setDimensions(niftiDims);
-        m_nifti.writeNew(filename, outHeader, 2, true, swapEndian);
     }
+    if (memoryOut != NULL)
+    {
+        m_nifti.writeNewMemory(*memoryOut, outHeader, 2, swapEndian);
+    } else {
+        m_nifti.writeNew(filename, outHeader, 2, withRead, swapEndian, method);
+    }
+    if (version.hasReversedFirstDims())
+    {
+        m_nifti.overrideDimensions(niftiDims);//and then tell the nifti reader to use the correct dimensions
+    }
+    m_nifti.preallocateData();//rows can arrive in any order, so reserve the whole extent now - also reports a full disk before any work is done
     m_xml = xml;
 }
 
+CiftiOnDiskImpl::~CiftiOnDiskImpl()
+{
+    if (m_rowScaleExtension < 0) return;
+    try
+    {//writeFile() just lets the writer go out of scope, the table would otherwise be left empty
+        m_nifti.updateExtension(m_rowScaleExtension, m_rowScales->toBytes(isSwapped()));
+    } catch (...) {}//errors have nowhere to go from here
+}
+
 void CiftiOnDiskImpl::close()
 {
+    if (m_writeBehind != NULL)
+    {
+        m_writeBehind->flush();//report queued write errors before closing
+        m_writeBehind.reset();
+    }
+    if (m_rowScaleExtension >= 0)
+    {
+        m_nifti.updateExtension(m_rowScaleExtension, m_rowScales->toBytes(isSwapped()));
+        m_rowScaleExtension = -1;//only once
+    }
     m_nifti.close();//lets this throw when there is a writing problem
 }//don't bother resetting m_xml, this instance is about to be destroyed
 
 void CiftiOnDiskImpl::getRow(float* dataOut, const vector<int64_t>& indexSelect, const bool& tolerateShortRead) const
 {
+    flushWrites();
+    if (m_rowScales != NULL)
+    {
+        m_rowScales->readRow(m_nifti, dataOut, indexSelect, tolerateShortRead);
+        return;
+    }
+    if (m_prefetch != NULL)
+    {
+        m_prefetch->getRow(dataOut, indexSelect, tolerateShortRead);
+        return;
+    }
     m_nifti.readData(dataOut, 5, indexSelect, tolerateShortRead);//5 means 4 reserved (space and time) plus the first cifti dimension
 }
 
+template<typename T>
+void CiftiOnDiskImpl::getRowTyped(T* dataOut, const vector<int64_t>& indexSelect, const bool& tolerateShortRead) const
+{//the read-ahead ring only holds float rows
+    flushWrites();
+    if (m_rowScales != NULL)
+    {//the table decodes to float
+        vector<float> tempRow(m_xml.getDimensionLength(CiftiXML::ALONG_ROW));
+        m_rowScales->readRow(m_nifti, tempRow.data(), indexSelect, tolerateShortRead);
+        for (size_t i = 0; i < tempRow.size(); ++i) dataOut[i] = convertFromFloat<T>(tempRow[i]);
+        return;
+    }
+    m_nifti.readData(dataOut, 5, indexSelect, tolerateShortRead);
+}
+
+const float* CiftiOnDiskImpl::getRowPointer(const vector<int64_t>& indexSelect) const
+{
+    flushWrites();
+    return m_nifti.getDataPointer<float>(5, indexSelect);//returns NULL if not memory mapped, or the data needs conversion
+}
+
+void CiftiOnDiskImpl::getRows(float* dataOut, const int64_t& rowLength, const vector<vector<int64_t> >& indexSelects) const
+{
+    flushWrites();
+    if (m_rowScales != NULL)
+    {
+        ReadImplInterface::getRows(dataOut, rowLength, indexSelects);
+        return;
+    }
+    m_nifti.readDataBatch(dataOut, 5, indexSelects);
+}
+
+void CiftiOnDiskImpl::getRowRange(float* dataOut, const vector<int64_t>& dims, const vector<int64_t>& indexSelect, const int64_t& numRows) const
+{
+    flushWrites();
+    if (m_rowScales != NULL)
+    {
+        ReadImplInterface::getRowRange(dataOut, dims, indexSelect, numRows);
+        return;
+    }
+    m_nifti.readDataRange(dataOut, 5, indexSelect, numRows);
+}
+
+void CiftiOnDiskImpl::setAccessPattern(const CiftiFile::AccessPattern& pattern) const
+{
+    switch (pattern)
+    {
+        case CiftiFile::NORMAL_ACCESS:
+            m_nifti.adviseAccess(BinaryFile::NORMAL_ACCESS);
+            break;
+        case CiftiFile::SEQUENTIAL_ROWS:
+            m_nifti.adviseAccess(BinaryFile::SEQUENTIAL);
+            break;
+        case CiftiFile::RANDOM_ROWS:
+            m_nifti.adviseAccess(BinaryFile::RANDOM);
+            break;
+        case CiftiFile::COLUMN_SCAN:
+        {
+            int64_t rowBytes = m_xml.getDimensionLength(CiftiXML::ALONG_ROW) * m_nifti.numBytesPerElem();
+            if (rowBytes <= 8192)//a column touches every page anyway, so readahead helps
+            {
+                m_nifti.adviseAccess(BinaryFile::SEQUENTIAL);
+            } else {//readahead would pull in mostly unused data
+                m_nifti.adviseAccess(BinaryFile::RANDOM);
+            }
+            break;
+        }
+    }
+}
+
+void CiftiOnDiskImpl::willNeedRows(const int64_t& rowLength, const int64_t& firstRow, const int64_t& numRows) const
+{
+    m_nifti.adviseAccess(BinaryFile::WILL_NEED, firstRow * rowLength, numRows * rowLength);
+}
+
+void CiftiOnDiskImpl::setReadAhead(const int64_t& maxBytes, const vector<int64_t>& dims)
+{
+    m_prefetch.reset();//stop the old thread first
+    if (maxBytes > 0 && m_rowScales == NULL)//the ring is read without the table
+    {
+        m_prefetch.reset(new RowPrefetcher(&m_nifti, dims, maxBytes));
+    }
+}
+
+RowPrefetcher::RowPrefetcher(NiftiIO* nifti, const vector<int64_t>& dims, const int64_t& maxBytes)
+{
+    CiftiAssert(dims.size() > 1);
+    m_nifti = nifti;
+    m_rowLength = dims[0];
+    m_rowDims = vector<int64_t>(dims.begin() + 1, dims.end());
+    m_numRows = 1;
+    for (size_t i = 0; i < m_rowDims.size(); ++i) m_numRows *= m_rowDims[i];
+    m_numSlots = max(int64_t(1), min(m_numRows, maxBytes / (m_rowLength * (int64_t)sizeof(float))));
+    m_ring.resize(m_numSlots * m_rowLength);
+    m_first = 0;//start at the beginning, that is what getIteratorOverRows does
+    m_next = 0;
+    m_generation = 0;
+    m_lastMiss = -1;
+    m_stop = false;
+    m_failed = false;
+    m_paused = false;
+    m_thread = std::thread(&RowPrefetcher::run, this);
+}
+
+RowPrefetcher::~RowPrefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_workCond.notify_all();
+    m_thread.join();
+}
+
+void RowPrefetcher::run()
+{
+    vector<char> scratch;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        while (!m_stop && (m_failed || m_paused || m_next >= m_numRows || m_next >= m_first + m_numSlots))
+        {
+            m_workCond.wait(lock);
+        }
+        if (m_stop) return;
+        int64_t row = m_next, generation = m_generation;
+        float* slot = m_ring.data() + (row % m_numSlots) * m_rowLength;//no one else touches this slot until m_next moves past it
+        lock.unlock();
+        bool ok = true;
+        try
+        {
+            m_nifti->readData(slot, 5, rowIndices(m_rowDims, row), scratch);
+        } catch (...) {
+            ok = false;
+        }
+        lock.lock();
+        if (!ok)
+        {
+            m_failed = true;//give up, getRow reads directly and reports the error
+        } else if (generation == m_generation) {
+            ++m_next;
+        }
+        m_readyCond.notify_all();
+    }
+}
+
+void RowPrefetcher::getRow(float* dataOut, const vector<int64_t>& indexSelect, const bool& tolerateShortRead)
+{
+    int64_t row = rowNumber(m_rowDims, indexSelect);//out of range gives -1, which misses and lets the direct read throw the usual error
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_owner != std::this_thread::get_id() && m_owner != std::thread::id() && !m_paused)
+        {
+            lock.unlock();
+            m_nifti->readData(dataOut, 5, indexSelect, tolerateShortRead);
+            return;
+        }
+        m_owner = std::this_thread::get_id();
+        while (!m_failed && !m_paused && row >= m_first && row == m_next && row < m_first + m_numSlots)//the helper is on it
+        {
+            m_readyCond.wait(lock);
+        }
+        if (!m_failed && row >= m_first && row < m_next)
+        {
+            memcpy(dataOut, m_ring.data() + (row % m_numSlots) * m_rowLength, m_rowLength * sizeof(float));
+            m_first = row + 1;//anything skipped over is dropped
+            lock.unlock();
+            m_workCond.notify_one();
+            return;
+        }
+        if (row >= 0)
+        {//out of order, restart after this row
+            m_first = row + 1;
+            m_next = row + 1;
+            ++m_generation;
+            m_paused = (row != m_lastMiss + 1);
+            m_lastMiss = row;
+        }
+    }
+    m_workCond.notify_one();
+    m_readyCond.notify_all();//other threads may be waiting on a row that is no longer coming
+    m_nifti->readData(dataOut, 5, indexSelect, tolerateShortRead);
+}
+
 void CiftiOnDiskImpl::getColumn(float* dataOut, const int64_t& index) const
 {
     CiftiAssert(m_xml.getNumberOfDimensions() == 2);//otherwise this shouldn't be called
     CiftiAssert(index >= 0 && index < m_xml.getDimensionLength(CiftiXML::ALONG_ROW));
+    flushWrites();
+    if (m_tiles != NULL)
+    {
+        m_tiles->getColumn(dataOut, index);
+        return;
+    }
     vector<int64_t> indexSelect(2);
     indexSelect[0] = index;
     int64_t colLength = m_xml.getDimensionLength(CiftiXML::ALONG_COLUMN);
+    vector<char> scratch;//reuse scratch memory for all elements
     for (int64_t i = 0; i < colLength; ++i)//assume if they really want getColumn on disk, they don't want their pagecache obliterated, so read it 1 element at a time
     {
         indexSelect[1] = i;
-        m_nifti.readData(dataOut + i, 4, indexSelect);//4 means just the 4 reserved dimensions, so 1 element of the matrix
+        m_nifti.readData(dataOut + i, 4, indexSelect, scratch);//4 means just the 4 reserved dimensions, so 1 element of the matrix
+        if (m_rowScales != NULL) dataOut[i] = m_rowScales->dequantize(dataOut[i], i, index);//the header has no scaling, so that was the stored integer
     }
 }
 
 void CiftiOnDiskImpl::setRow(const float* dataIn, const vector<int64_t>& indexSelect)
 {
+    if (m_rowScales != NULL)
+    {
+        m_rowScales->writeRow(m_nifti, dataIn, indexSelect);
+        return;
+    }
+    if (m_writeBehind != NULL)
+    {
+        m_writeBehind->setRow(dataIn, indexSelect);
+        return;
+    }
+    m_nifti.writeData(dataIn, 5, indexSelect);
+}
+
+template<typename T>
+void CiftiOnDiskImpl::setRowTyped(const T* dataIn, const vector<int64_t>& indexSelect)
+{
+    flushWrites();//write-behind only queues float rows, and a queued row must not overwrite this one later
+    if (m_rowScales != NULL)
+    {//the table is fit to float data
+        vector<float> tempRow(m_xml.getDimensionLength(CiftiXML::ALONG_ROW));
+        for (size_t i = 0; i < tempRow.size(); ++i) tempRow[i] = (float)dataIn[i];
+        m_rowScales->writeRow(m_nifti, tempRow.data(), indexSelect);
+        return;
+    }
     m_nifti.writeData(dataIn, 5, indexSelect);
 }
 
-void CiftiOnDiskImpl::setColumn(const float* dataIn, const int64_t& index)
+void CiftiOnDiskImpl::setRows(const float* dataIn, const int64_t& rowLength, const vector<vector<int64_t> >& indexSelects)
 {
-    CiftiAssert(m_xml.getNumberOfDimensions() == 2);//otherwise this shouldn't be called
-    CiftiAssert(index >= 0 && index < m_xml.getDimensionLength(CiftiXML::ALONG_ROW));
-    vector<int64_t> indexSelect(2);
-    indexSelect[0] = index;
-    int64_t colLength = m_xml.getDimensionLength(CiftiXML::ALONG_COLUMN);
-    for (int64_t i = 0; i < colLength; ++i)//don't do RMW, so write it 1 element at a time
+    if (m_rowScales != NULL)
     {
-        indexSelect[1] = i;
-        m_nifti.writeData(dataIn + i, 4, indexSelect);//4 means just the 4 reserved dimensions, so 1 element of the matrix
+        WriteImplInterface::setRows(dataIn, rowLength, indexSelects);
+        return;
+    }
+    if (m_writeBehind != NULL)
+    {
+        for (size_t i = 0; i < indexSelects.size(); ++i)
+        {
+            m_writeBehind->setRow(dataIn + i * rowLength, indexSelects[i]);
+        }
+        return;
+    }
+    m_nifti.writeDataBatch(dataIn, 5, indexSelects);
+}
+
+void CiftiOnDiskImpl::setRowRange(const float* dataIn, const vector<int64_t>& dims, const vector<int64_t>& indexSelect, const int64_t& numRows)
+{
+    if (m_writeBehind != NULL || m_rowScales != NULL)
+    {//queue them like setRow, the helper merges consecutive rows anyway
+        WriteImplInterface::setRowRange(dataIn, dims, indexSelect, numRows);
+        return;
+    }
+    m_nifti.writeDataRange(dataIn, 5, indexSelect, numRows);
+}
+
+void CiftiOnDiskImpl::setWriteBehind(const int64_t& maxBytes, const vector<int64_t>& dims)
+{
+    flushWrites();//finish with the old queue, and report its errors
+    m_writeBehind.reset();
+    if (maxBytes > 0 && m_rowScales == NULL)//the helper writes without the table
+    {
+        m_writeBehind.reset(new RowWriteBehind(&m_nifti, dims, maxBytes));
     }
 }
+
+RowWriteBehind::RowWriteBehind(NiftiIO* nifti, const vector<int64_t>& dims, const int64_t& maxBytes)
+{
+    CiftiAssert(dims.size() > 1);
+    m_nifti = nifti;
+    m_rowLength = dims[0];
+    m_rowDims = vector<int64_t>(dims.begin() + 1, dims.end());
+    m_maxRows = max(int64_t(1), maxBytes / (m_rowLength * (int64_t)sizeof(float)));
+    m_numWriting = 0;
+    m_stop = false;
+    m_thread = std::thread(&RowWriteBehind::run, this);
+}
+
+RowWriteBehind::~RowWriteBehind()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_workCond.notify_all();
+    m_thread.join();//the helper empties the queue before it exits, errors at this point have nowhere to go
+}
+
+void RowWriteBehind::setRow(const float* dataIn, const vector<int64_t>& indexSelect)
+{
+    int64_t row = rowNumber(m_rowDims, indexSelect);
+    if (row < 0)
+    {//let NiftiIO generate the usual error, after the queue is written so it doesn't race with the helper
+        flush();
+        m_nifti->writeData(dataIn, 5, indexSelect);
+        return;
+    }
+    vector<float> buffer;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_error != "") throw CiftiException(m_error);
+        map<int64_t, vector<float> >::iterator iter = m_queued.find(row);
+        if (iter != m_queued.end())
+        {//not written yet, replace it
+            memcpy(iter->second.data(), dataIn, m_rowLength * sizeof(float));
+            return;
+        }
+        while (m_error == "" && (int64_t)m_queued.size() + m_numWriting >= m_maxRows)
+        {
+            m_doneCond.wait(lock);
+        }
+        if (m_error != "") throw CiftiException(m_error);
+        if (!m_pool.empty())
+        {
+            buffer.swap(m_pool.back());
+            m_pool.pop_back();
+        }
+    }
+    buffer.resize(m_rowLength);
+    memcpy(buffer.data(), dataIn, m_rowLength * sizeof(float));
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        vector<float>& slot = m_queued[row];//if another thread queued the same row meanwhile, ours is newer
+        if (slot.empty())
+        {
+            slot.swap(buffer);
+        } else {
+            memcpy(slot.data(), buffer.data(), m_rowLength * sizeof(float));
+            m_pool.push_back(vector<float>());
+            m_pool.back().swap(buffer);
+        }
+    }
+    m_workCond.notify_one();
+}
+
+void RowWriteBehind::flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_queued.empty() || m_numWriting > 0)
+    {
+        m_doneCond.wait(lock);
+    }
+    if (m_error != "") throw CiftiException(m_error);
+}
+
+void RowWriteBehind::run()
+{
+    vector<float> staging;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        while (!m_stop && m_queued.empty())
+        {
+            m_workCond.wait(lock);
+        }
+        if (m_queued.empty()) return;//only when stopping
+        map<int64_t, vector<float> > rows;
+        rows.swap(m_queued);
+        m_numWriting = rows.size();
+        bool failed = (m_error != "");
+        lock.unlock();
+        AString error;
+        if (!failed)//after an error, drop the rest
+        {
+            try
+            {
+                writeRows(rows, staging);
+            } catch (CiftiException& e) {
+                error = e.whatString();
+            } catch (std::exception& e) {
+                error = e.what();
+            }
+        }
+        lock.lock();
+        if (error != "" && m_error == "") m_error = error;
+        for (map<int64_t, vector<float> >::iterator iter = rows.begin(); iter != rows.end(); ++iter)
+        {
+            m_pool.push_back(vector<float>());
+            m_pool.back().swap(iter->second);
+        }
+        m_numWriting = 0;
+        m_doneCond.notify_all();
+    }
+}
+
+void RowWriteBehind::writeRows(map<int64_t, vector<float> >& rows, vector<float>& staging)
+{//rows are in file order, gather them so NiftiIO can convert and submit them together
+    const int64_t rowBytes = m_rowLength * sizeof(float), STAGING_BYTES = 1<<23;//8MiB, unless a single row is larger
+    const int64_t stagingRows = max(int64_t(1), STAGING_BYTES / rowBytes);
+    vector<vector<int64_t> > indexSelects;
+    map<int64_t, vector<float> >::iterator iter = rows.begin();
+    while (iter != rows.end())
+    {
+        indexSelects.clear();
+        staging.resize(min(stagingRows, (int64_t)rows.size()) * m_rowLength);
+        int64_t firstRow = iter->first, lastRow = firstRow;
+        for (; iter != rows.end() && (int64_t)indexSelects.size() < stagingRows; ++iter)
+        {
+            memcpy(staging.data() + indexSelects.size() * m_rowLength, iter->second.data(), rowBytes);
+            indexSelects.push_back(rowIndices(m_rowDims, iter->first));
+            lastRow = iter->first;
+        }
+        if (lastRow - firstRow + 1 == (int64_t)indexSelects.size())
+        {//no gaps, so it is one contiguous write
+            m_nifti->writeDataRange(staging.data(), 5, indexSelects[0], indexSelects.size());
+        } else {
+            m_nifti->writeDataBatch(staging.data(), 5, indexSelects);
+        }
+    }
+}
+
+void CiftiOnDiskImpl::setColumn(const float* dataIn, const int64_t& index)
+{
+    CiftiAssert(m_xml.getNumberOfDimensions() == 2);//otherwise this shouldn't be called
+    CiftiAssert(index >= 0 && index < m_xml.getDimensionLength(CiftiXML::ALONG_ROW));
+    flushWrites();//the column overlaps queued rows
+    int64_t colLength = m_xml.getDimensionLength(CiftiXML::ALONG_COLUMN);
+    if (m_rowScales != NULL)
+    {//each element can change the range of its row, so this has to be RMW of whole rows
+        vector<float> tempRow(m_xml.getDimensionLength(CiftiXML::ALONG_ROW));
+        vector<int64_t> rowSelect(1);
+        for (int64_t i = 0; i < colLength; ++i)
+        {
+            rowSelect[0] = i;
+            m_rowScales->readRow(m_nifti, tempRow.data(), rowSelect, true);
+            tempRow[index] = dataIn[i];
+            m_rowScales->writeRow(m_nifti, tempRow.data(), rowSelect);
+        }
+        return;
+    }
+    vector<int64_t> indexSelect(2);
+    indexSelect[0] = index;
+    vector<char> scratch;
+    for (int64_t i = 0; i < colLength; ++i)//don't do RMW, so write it 1 element at a time
+    {
+        indexSelect[1] = i;
+        m_nifti.writeData(dataIn + i, 4, indexSelect, scratch);//4 means just the 4 reserved dimensions, so 1 element of the matrix
+    }
+}
+
+namespace
+{
+    const char ROW_SCALE_MAGIC[8] = { 'C', 'I', 'F', 'T', 'I', 'R', 'S', 1 };
+    const int64_t ROW_SCALE_DATA_START = 8 + 3 * sizeof(int64_t);//magic, then row length, rows, block length, all in the byte order of the file
+    
+    template<typename T>
+    void putSwapped(char* out, T value, const bool& swapped)
+    {
+        if (swapped) ByteSwapping::swap(value);
+        memcpy(out, &value, sizeof(T));
+    }
+    
+    template<typename T>
+    T getSwapped(const char* in, const bool& swapped)
+    {
+        T ret;
+        memcpy(&ret, in, sizeof(T));
+        if (swapped) ByteSwapping::swap(ret);
+        return ret;
+    }
+}
+
+RowScaleTable::RowScaleTable(const int16_t& datatype, const vector<int64_t>& dims, const int64_t& blockLength)
+{
+    if (datatype != NIFTI_TYPE_INT8 && datatype != NIFTI_TYPE_INT16) throw CiftiException("per-row scaling is only supported for int8 and int16 data");
+    if (blockLength < 0) throw CiftiException("per-row scaling block length can't be negative");
+    CiftiAssert(dims.size() > 1);
+    m_datatype = datatype;
+    m_rowLength = dims[0];
+    m_rowDims = vector<int64_t>(dims.begin() + 1, dims.end());
+    m_numRows = 1;
+    for (size_t i = 0; i < m_rowDims.size(); ++i) m_numRows *= m_rowDims[i];
+    m_blockLength = min(blockLength, m_rowLength);
+    if (m_blockLength == 0) m_blockLength = max(m_rowLength, int64_t(1));
+    m_blocksPerRow = (m_rowLength + m_blockLength - 1) / m_blockLength;
+    m_scales.resize(2 * m_numRows * m_blocksPerRow, 0.0f);
+}
+
+RowScaleTable::RowScaleTable(const int16_t& datatype, const vector<int64_t>& dims, const vector<char>& bytes, const bool& swapped, const AString& filename)
+{
+    if (datatype != NIFTI_TYPE_INT8 && datatype != NIFTI_TYPE_INT16) throw CiftiException("per-row scaling found in file '" + filename + "', but the data isn't int8 or int16");
+    CiftiAssert(dims.size() > 1);
+    m_datatype = datatype;
+    m_rowLength = dims[0];
+    m_rowDims = vector<int64_t>(dims.begin() + 1, dims.end());
+    m_numRows = 1;
+    for (size_t i = 0; i < m_rowDims.size(); ++i) m_numRows *= m_rowDims[i];
+    if ((int64_t)bytes.size() < ROW_SCALE_DATA_START || memcmp(bytes.data(), ROW_SCALE_MAGIC, 8) != 0 ||
+        getSwapped<int64_t>(bytes.data() + 8, swapped) != m_rowLength || getSwapped<int64_t>(bytes.data() + 16, swapped) != m_numRows)
+    {
+        throw CiftiException("invalid per-row scaling extension in file '" + filename + "'");
+    }
+    m_blockLength = getSwapped<int64_t>(bytes.data() + 24, swapped);
+    if (m_blockLength < 1 || m_blockLength > max(m_rowLength, int64_t(1))) throw CiftiException("invalid per-row scaling extension in file '" + filename + "'");
+    m_blocksPerRow = (m_rowLength + m_blockLength - 1) / m_blockLength;
+    m_scales.resize(2 * m_numRows * m_blocksPerRow);
+    int64_t tableBytes = ROW_SCALE_DATA_START + (int64_t)(m_scales.size() * sizeof(float));//the reader keeps the padding to a multiple of 16
+    if ((int64_t)bytes.size() < tableBytes || (int64_t)bytes.size() >= tableBytes + 16) throw CiftiException("invalid per-row scaling extension in file '" + filename + "'");
+    for (size_t i = 0; i < m_scales.size(); ++i) m_scales[i] = getSwapped<float>(bytes.data() + ROW_SCALE_DATA_START + i * sizeof(float), swapped);
+}
+
+vector<char> RowScaleTable::toBytes(const bool& swapped) const
+{
+    vector<char> ret(ROW_SCALE_DATA_START + m_scales.size() * sizeof(float));
+    memcpy(ret.data(), ROW_SCALE_MAGIC, 8);
+    putSwapped(ret.data() + 8, m_rowLength, swapped);
+    putSwapped(ret.data() + 16, m_numRows, swapped);
+    putSwapped(ret.data() + 24, m_blockLength, swapped);
+    for (size_t i = 0; i < m_scales.size(); ++i) putSwapped(ret.data() + ROW_SCALE_DATA_START + i * sizeof(float), m_scales[i], swapped);
+    return ret;
+}
+
+int64_t RowScaleTable::checkedRow(const vector<int64_t>& indexSelect) const
+{
+    int64_t ret = rowNumber(m_rowDims, indexSelect);
+    if (ret < 0) throw CiftiException("row index out of range for per-row scaling");
+    return ret;
+}
+
+float RowScaleTable::dequantize(const double& stored, const int64_t& row, const int64_t& index) const
+{
+    CiftiAssert(row >= 0 && row < m_numRows && index >= 0 && index < m_rowLength);
+    int64_t block = row * m_blocksPerRow + index / m_blockLength;
+    return (float)(m_scales[2 * block + 1] + m_scales[2 * block] * (long double)stored);//same as NiftiIO with a global scale
+}
+
+void RowScaleTable::readRow(NiftiIO& nifti, float* dataOut, const vector<int64_t>& indexSelect, const bool& tolerateShortRead) const
+{
+    if (m_datatype == NIFTI_TYPE_INT8)
+    {
+        readRowTyped<int8_t>(nifti, dataOut, indexSelect, tolerateShortRead);
+    } else {
+        readRowTyped<int16_t>(nifti, dataOut, indexSelect, tolerateShortRead);
+    }
+}
+
+void RowScaleTable::writeRow(NiftiIO& nifti, const float* dataIn, const vector<int64_t>& indexSelect)
+{
+    if (m_datatype == NIFTI_TYPE_INT8)
+    {
+        writeRowTyped<int8_t>(nifti, dataIn, indexSelect);
+    } else {
+        writeRowTyped<int16_t>(nifti, dataIn, indexSelect);
+    }
+}
+
+template<typename T>
+void RowScaleTable::readRowTyped(NiftiIO& nifti, float* dataOut, const vector<int64_t>& indexSelect, const bool& tolerateShortRead) const
+{
+    const float* rowScales = m_scales.data() + 2 * checkedRow(indexSelect) * m_blocksPerRow;
+    vector<T> stored(m_rowLength);
+    nifti.readData(stored.data(), 5, indexSelect, tolerateShortRead);//the header has no scaling, so this gets the stored integers
+    for (int64_t block = 0; block < m_blocksPerRow; ++block)
+    {
+        int64_t start = block * m_blockLength, count = min(m_blockLength, m_rowLength - start);
+        double mult = rowScales[2 * block], offset = rowScales[2 * block + 1];
+        if (DataConversion::convertRead(dataOut + start, stored.data() + start, count, false, true, mult, offset)) continue;
+        for (int64_t i = start; i < start + count; ++i)
+        {
+            dataOut[i] = (float)(offset + mult * (long double)stored[i]);
+        }
+    }
+}
+
+template<typename T>
+void RowScaleTable::writeRowTyped(NiftiIO& nifti, const float* dataIn, const vector<int64_t>& indexSelect)
+{
+    typedef numeric_limits<T> mylimits;
+    float* rowScales = m_scales.data() + 2 * checkedRow(indexSelect) * m_blocksPerRow;
+    vector<T> stored(m_rowLength, 0);
+    vector<float> newScales(2 * m_blocksPerRow);//don't change the table until the write succeeds
+    for (int64_t block = 0; block < m_blocksPerRow; ++block)
+    {
+        int64_t start = block * m_blockLength, count = min(m_blockLength, m_rowLength - start);
+        float minval = numeric_limits<float>::infinity(), maxval = -numeric_limits<float>::infinity();
+        DataConversion::updateRange(dataIn + start, count, minval, maxval);
+        float mult = 0.0f, offset = 0.0f;//NaN and infinities aren't representable, a block of only those decodes to zero
+        if (minval < maxval)
+        {//same fit as NiftiHeader::setDataTypeAndScaleRange, rounded to the stored precision before use, so writing and reading agree
+            mult = (float)(((double)maxval - minval) / ((double)mylimits::max() - mylimits::min()));
+            offset = (float)(minval - mylimits::min() * (double)mult);
+        }
+        if (mult == 0.0f)
+        {//constant block (or a range too small for float), stored values stay zero and decode to exactly the offset
+            if (minval <= maxval) offset = minval;
+        } else if (!DataConversion::convertWrite(stored.data() + start, dataIn + start, count, false, true, mult, offset)) {
+            for (int64_t i = start; i < start + count; ++i)
+            {
+                double rounded = floor((double)(0.5l + ((long double)dataIn[i] - offset) / mult));
+                if (rounded != rounded) rounded = 0.0;//NaN
+                stored[i] = (T)max((double)mylimits::min(), min((double)mylimits::max(), rounded));
+            }
+        }
+        newScales[2 * block] = mult;
+        newScales[2 * block + 1] = offset;
+    }
+    nifti.writeData(stored.data(), 5, indexSelect);
+    copy(newScales.begin(), newScales.end(), rowScales);
+}
+
+namespace
+{
+    const char TILE_MAGIC[8] = { 'C', 'I', 'F', 'T', 'I', 'T', 'L', 2 };
+    const int64_t TILE_HEADER_COUNT = 8;//file size, modification time, change time, inode, device, rows, row length, tile size
+    const int64_t TILE_DATA_START = 8 + TILE_HEADER_COUNT * sizeof(int64_t);
+}
+
+boost::shared_ptr<TileSidecar> TileSidecar::open(const AString& filename, const vector<int64_t>& dims)
+{
+    boost::shared_ptr<TileSidecar> ret;
+    FileSignature fileSig;
+    if (dims.size() != 2 || !pathSignature(filename, fileSig)) return ret;
+    try
+    {
+        boost::shared_ptr<TileSidecar> temp(new TileSidecar());
+        temp->m_file.open(sidecarName(filename));
+        char magic[8];
+        int64_t header[TILE_HEADER_COUNT];
+        temp->m_file.read(magic, 8);
+        temp->m_file.read(header, sizeof(header));
+        FileSignature recorded = { header[0], header[1], header[2], header[3], header[4] };
+        if (memcmp(magic, TILE_MAGIC, 8) != 0 || recorded != fileSig || header[5] != dims[1] || header[6] != dims[0] || header[7] < 1) return ret;//stale, different file, or different endianness
+        temp->m_numRows = dims[1];
+        temp->m_rowLength = dims[0];
+        temp->m_tileSize = header[7];
+        temp->m_numTileRows = (temp->m_numRows + temp->m_tileSize - 1) / temp->m_tileSize;
+        temp->m_numTileCols = (temp->m_rowLength + temp->m_tileSize - 1) / temp->m_tileSize;
+        if (temp->m_file.size() != TILE_DATA_START + temp->m_numTileRows * temp->m_numTileCols * temp->m_tileSize * temp->m_tileSize * (int64_t)sizeof(float)) return ret;//incomplete
+        ret = temp;
+    } catch (CiftiException&) {//the sidecar is only an optimization
+    }
+    return ret;
+}
+
+void TileSidecar::write(const CiftiFile::ReadImplInterface* from, const AString& filename, const vector<int64_t>& dims, const int64_t& tileSize)
+{
+    CiftiAssert(dims.size() == 2 && tileSize > 0);
+    FileSignature fileSig, sidecarSig;
+    if (!pathSignature(filename, fileSig)) throw CiftiException("unable to get size and modification time of file '" + filename + "'");
+    int64_t rowLength = dims[0], numRows = dims[1], tileElems = tileSize * tileSize;
+    int64_t numTileRows = (numRows + tileSize - 1) / tileSize, numTileCols = (rowLength + tileSize - 1) / tileSize;
+    BinaryFile outFile(sidecarName(filename), BinaryFile::WRITE_TRUNCATE);
+    int64_t header[TILE_HEADER_COUNT] = { fileSig.m_size, fileSig.m_modTime, fileSig.m_changeTime, fileSig.m_inode, fileSig.m_device, numRows, rowLength, tileSize };
+    vector<char> zeroHeader(TILE_DATA_START, 0);
+    outFile.write(zeroHeader.data(), TILE_DATA_START);//filled in last, so an interrupted write doesn't match
+    vector<float> band(tileSize * rowLength), tiles(numTileCols * tileElems);//one row of tiles at a time
+    for (int64_t tileRow = 0; tileRow < numTileRows; ++tileRow)
+    {
+        int64_t firstRow = tileRow * tileSize, bandRows = min(tileSize, numRows - firstRow);
+        from->getRowRange(band.data(), dims, vector<int64_t>(1, firstRow), bandRows);
+        fill(tiles.begin(), tiles.end(), 0.0f);//padding past the edges of the matrix
+        for (int64_t row = 0; row < bandRows; ++row)
+        {
+            for (int64_t tileCol = 0; tileCol < numTileCols; ++tileCol)
+            {
+                int64_t firstCol = tileCol * tileSize;
+                memcpy(tiles.data() + tileCol * tileElems + row * tileSize, band.data() + row * rowLength + firstCol, min(tileSize, rowLength - firstCol) * sizeof(float));
+            }
+        }
+        outFile.write(tiles.data(), tiles.size() * sizeof(float));
+    }
+    //an edit in the same clock tick as the signature would keep the same timestamps, so don't finish until the filesystem clock has moved past them
+    //(as seen on the sidecar) - after that, any change to the file gets a newer timestamp (like racily clean entries in git)
+    for (int tries = 0; true; ++tries)
+    {
+        outFile.writeAt(0, TILE_MAGIC, 8);
+        outFile.writeAt(8, header, sizeof(header));
+        outFile.close();
+        if (!pathSignature(sidecarName(filename), sidecarSig)) throw CiftiException("unable to get modification time of file '" + sidecarName(filename) + "'");
+        if (sidecarSig.m_changeTime > fileSig.m_changeTime || tries >= 300) break;//3 seconds covers clocks with 1 second resolution, the file's time may be in the future
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        outFile.open(sidecarName(filename), BinaryFile::READ_WRITE);
+    }
+    FileSignature afterSig;
+    if (!pathSignature(filename, afterSig) || afterSig != fileSig)
+    {//the tiles may have a mix of old and new data
+        remove(AString_to_std_string(sidecarName(filename)).c_str());
+        throw CiftiException("file '" + filename + "' changed while its tile sidecar was being written");
+    }
+}
+
+void TileSidecar::getColumn(float* dataOut, const int64_t& index) const
+{
+    CiftiAssert(index >= 0 && index < m_rowLength);
+    CiftiMutexLocker locked(&m_mutex);
+    int64_t tileCol = index / m_tileSize, tileElems = m_tileSize * m_tileSize;
+    if (tileCol != m_cachedTileCol)
+    {
+        m_cachedTileCol = -1;//in case of error
+        m_cache.resize(m_numTileRows * tileElems);
+        vector<BinaryFile::BatchRequest> requests(m_numTileRows);
+        for (int64_t i = 0; i < m_numTileRows; ++i)
+        {
+            requests[i] = BinaryFile::BatchRequest(TILE_DATA_START + (i * m_numTileCols + tileCol) * tileElems * (int64_t)sizeof(float),
+                                                   m_cache.data() + i * tileElems, tileElems * sizeof(float));
+        }
+        m_file.readAtBatch(requests);
+        m_cachedTileCol = tileCol;
+    }
+    int64_t inTile = index % m_tileSize;
+    for (int64_t row = 0; row < m_numRows; ++row)
+    {
+        dataOut[row] = m_cache[row * m_tileSize + inTile];//the tiles of one column are stacked, so this is row-major with a row length of the tile size
+    }
+}
+
+namespace
+{
+    const char SHARD_MAGIC[] = "CiftiLib sharded matrix 1";
+}
+
+CiftiShardedImpl::CiftiShardedImpl(const AString& manifestName)
+{//opens existing shards for reading
+    m_manifestName = manifestName;
+    BinaryFile manifestFile(manifestName);
+    int64_t manifestSize = manifestFile.size();
+    if (manifestSize < 0 || manifestSize > (1<<30)) throw CiftiException("file '" + manifestName + "' is too large to be a shard manifest");
+    vector<char> contents(manifestSize);
+    manifestFile.read(contents.data(), manifestSize);
+    manifestFile.close();
+    istringstream parse(string(contents.begin(), contents.end()));
+    string line, key;
+    int64_t numShards = -1, xmlBytes = -1;
+    vector<int64_t> dims;
+    getline(parse, line);
+    if (line != SHARD_MAGIC) throw CiftiException("file '" + manifestName + "' is not a cifti shard manifest");
+    while (getline(parse, line))
+    {
+        istringstream fields(line);
+        fields >> key;
+        if (key == "stripe_rows")
+        {
+            fields >> m_stripeRows;
+        } else if (key == "dims") {
+            int64_t length;
+            while (fields >> length) dims.push_back(length);
+        } else if (key == "shards") {
+            fields >> numShards;
+        } else if (key == "shard") {
+            getline(fields >> ws, line);//the rest of the line is the filename, which may contain spaces
+            m_shardNames.push_back(AString(line));//written as utf-8
+        } else if (key == "xml_bytes") {
+            fields >> xmlBytes;
+            break;//the XML follows, starting on the next line
+        }
+    }
+    if (numShards < 1 || (int64_t)m_shardNames.size() != numShards || xmlBytes < 0 || m_stripeRows < 1 || dims.empty()) throw CiftiException("invalid shard manifest in file '" + manifestName + "'");
+    vector<char> xmlText(xmlBytes);
+    if (!parse.read(xmlText.data(), xmlBytes)) throw CiftiException("premature end of shard manifest in file '" + manifestName + "'");
+    m_xml.readXML(xmlText);
+    if (m_xml.getNumberOfDimensions() != (int)dims.size()) throw CiftiException("XML does not match dimensions in shard manifest '" + manifestName + "'");
+    for (int i = 0; i < (int)dims.size(); ++i)
+    {
+        if (m_xml.getDimensionLength(i) < 0)//CiftiXML will only let this happen with cifti-1
+        {
+            m_xml.getSeriesMap(i).setLength(dims[i]);//and only in a series map
+        } else {
+            if (m_xml.getDimensionLength(i) != dims[i]) throw CiftiException("XML does not match dimensions in shard manifest '" + manifestName + "'");
+        }
+    }
+    setDimensions(dims);
+    m_shards.resize(numShards);
+    for (int64_t i = 0; i < numShards; ++i)
+    {
+        m_shardNames[i] = pathResolveFrom(m_shardNames[i], manifestName);//the writer stores names relative to the manifest, so the set can be moved
+        m_shards[i] = boost::shared_ptr<NiftiIO>(new NiftiIO());
+        m_shards[i]->openRead(m_shardNames[i]);
+        const vector<int64_t>& shardDims = m_shards[i]->getDimensions();
+        if (shardDims.size() != 6 || shardDims[0] != 1 || shardDims[1] != 1 || shardDims[2] != 1 || shardDims[3] != 1 ||
+            shardDims[4] != m_rowLength || shardDims[5] != shardRowCount(i) || m_shards[i]->getNumComponents() != 1)
+        {
+            throw CiftiException("shard file '" + m_shardNames[i] + "' does not match its manifest '" + manifestName + "'");
+        }
+    }
+}
+
+CiftiShardedImpl::CiftiShardedImpl(const AString& manifestName, const vector<AString>& shardNames, const int64_t& stripeRows, const CiftiXML& xml, const CiftiVersion& version,
+                                   const bool& swapEndian, const int16_t& datatype, const bool& rescale, const double& minval, const double& maxval)
+{//starts writing new shards
+    CiftiAssert(!shardNames.empty());
+    m_manifestName = manifestName;
+    m_shardNames = shardNames;
+    m_xml = xml;
+    setDimensions(xml.getDimensions());
+    int64_t numShards = (int64_t)shardNames.size();
+    m_stripeRows = stripeRows;
+    if (m_stripeRows < 1) m_stripeRows = max((int64_t)1, min(STRIPE_BYTES / (m_rowLength * (int64_t)sizeof(float)), (m_numRows + numShards - 1) / numShards));
+    if ((m_numRows + m_stripeRows - 1) / m_stripeRows < numShards)
+    {
+        throw CiftiException("can't split " + AString_number(m_numRows) + " rows into " + AString_number(numShards) + " shards with " +
+                             AString_number(m_stripeRows) + " rows per stripe, some shards would be empty");
+    }
+    NiftiHeader shardHeader;
+    if (rescale)
+    {
+        shardHeader.setDataTypeAndScaleRange(datatype, minval, maxval);
+    } else {
+        shardHeader.setDataType(datatype);
+    }
+    if (shardHeader.getNumComponents() != 1) throw CiftiException("cifti cannot be written with multi-component nifti datatypes (i.e., complex, RGB)");
+    vector<int64_t> shardDims(4, 1);//the reserved space and time dims, then row length and number of rows in the shard
+    shardDims.push_back(m_rowLength);
+    shardDims.push_back(0);
+    m_shards.resize(numShards);
+    for (int64_t i = 0; i < numShards; ++i)
+    {
+        shardDims[5] = shardRowCount(i);
+        shardHeader.setDimensions(shardDims);
+        m_shards[i] = boost::shared_ptr<NiftiIO>(new NiftiIO());
+        m_shards[i]->writeNew(m_shardNames[i], shardHeader, 2, true, swapEndian);
+        m_shards[i]->preallocateData();
+    }
+    writeManifest(version);
+}
+
+void CiftiShardedImpl::setDimensions(const vector<int64_t>& dims)
+{
+    CiftiAssert(!dims.empty());
+    m_rowLength = dims[0];
+    m_rowDims = vector<int64_t>(dims.begin() + 1, dims.end());
+    m_numRows = 1;
+    for (size_t i = 0; i < m_rowDims.size(); ++i)
+    {
+        m_numRows *= m_rowDims[i];
+    }
+}
+
+void CiftiShardedImpl::writeManifest(const CiftiVersion& version) const
+{
+    vector<char> xmlText = m_xml.writeXMLToVector(version);
+    ostringstream header;
+    header << SHARD_MAGIC << "\n";
+    header << "stripe_rows " << m_stripeRows << "\n";
+    header << "dims " << m_rowLength;
+    for (size_t i = 0; i < m_rowDims.size(); ++i)
+    {
+        header << " " << m_rowDims[i];
+    }
+    header << "\n";
+    header << "shards " << m_shardNames.size() << "\n";
+    for (size_t i = 0; i < m_shardNames.size(); ++i)
+    {
+        header << "shard " << ASTRING_UTF8_RAW(pathRelativeTo(m_shardNames[i], m_manifestName)) << "\n";
+    }
+    header << "xml_bytes " << xmlText.size() << "\n";
+    string headerText = header.str();
+    BinaryFile manifestFile(m_manifestName, BinaryFile::WRITE_TRUNCATE);
+    manifestFile.write(headerText.data(), headerText.size());
+    manifestFile.write(xmlText.data(), xmlText.size());
+    manifestFile.close();
+}
+
+vector<AString> CiftiShardedImpl::getFilenames() const
+{
+    vector<AString> ret(1, m_manifestName);
+    ret.insert(ret.end(), m_shardNames.begin(), m_shardNames.end());
+    return ret;
+}
+
+void CiftiShardedImpl::locate(const int64_t& row, int64_t& shard, int64_t& shardRow) const
+{
+    CiftiAssert(row >= 0 && row < m_numRows);
+    int64_t stripe = row / m_stripeRows, numShards = (int64_t)m_shards.size();
+    shard = stripe % numShards;
+    shardRow = (stripe / numShards) * m_stripeRows + row % m_stripeRows;
+}
+
+int64_t CiftiShardedImpl::shardRowCount(const int64_t& shard) const
+{//only the last stripe of the matrix can be short, and it is also the last stripe of its shard
+    int64_t ret = 0, numStripes = (m_numRows + m_stripeRows - 1) / m_stripeRows;
+    for (int64_t stripe = shard; stripe < numStripes; stripe += (int64_t)m_shardNames.size())
+    {
+        ret += min(m_stripeRows, m_numRows - stripe * m_stripeRows);
+    }
+    return ret;
+}
+
+void CiftiShardedImpl::addSegments(vector<Segment>& segments, const int64_t& firstRow, const int64_t& numRows, const int64_t& dataRow) const
+{
+    int64_t row = firstRow, endRow = firstRow + numRows;
+    while (row < endRow)
+    {
+        Segment temp;
+        locate(row, temp.m_shard, temp.m_shardRow);
+        temp.m_numRows = min(endRow, (row / m_stripeRows + 1) * m_stripeRows) - row;//to the end of the stripe
+        temp.m_dataRow = dataRow + row - firstRow;
+        if (!segments.empty())
+        {
+            Segment& last = segments.back();
+            if (last.m_shard == temp.m_shard && last.m_shardRow + last.m_numRows == temp.m_shardRow && last.m_dataRow + last.m_numRows == temp.m_dataRow)
+            {//happens with one shard, and when rows are requested one at a time
+                last.m_numRows += temp.m_numRows;
+                row += temp.m_numRows;
+                continue;
+            }
+        }
+        segments.push_back(temp);
+        row += temp.m_numRows;
+    }
+}
+
+void CiftiShardedImpl::transfer(float* data, const vector<Segment>& segments, const bool& writing) const
+{
+    vector<vector<Segment> > perShard(m_shards.size());
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        perShard[segments[i].m_shard].push_back(segments[i]);
+    }
+    vector<int64_t> involved;
+    for (size_t i = 0; i < perShard.size(); ++i)
+    {
+        if (!perShard[i].empty()) involved.push_back(i);
+    }
+    int numInvolved = (int)involved.size();
+    if (numInvolved == 0) return;//empty getRows/setRows, and num_threads(0) isn't allowed
+    vector<AString> errors(m_shards.size());
+    //waiting on IO rather than computing, so one thread per shard even with fewer cores
+#pragma omp parallel for schedule(dynamic) num_threads(numInvolved) if (numInvolved > 1)
+    for (int i = 0; i < numInvolved; ++i)
+    {
+        transferShard(data, perShard[involved[i]], writing, &(errors[involved[i]]));
+    }
+    for (size_t i = 0; i < errors.size(); ++i)
+    {
+        if (errors[i] != "") throw CiftiException(errors[i]);
+    }
+}
+
+void CiftiShardedImpl::transferShard(float* data, const vector<Segment>& segments, const bool& writing, AString* errorOut) const
+{//can't throw out of an openmp loop, so record the error for transfer() to throw
+    try
+    {
+        for (size_t i = 0; i < segments.size(); ++i)
+        {
+            const Segment& thisSeg = segments[i];
+            vector<int64_t> indexSelect(1, thisSeg.m_shardRow);
+            if (writing)
+            {
+                m_shards[thisSeg.m_shard]->writeDataRange(data + thisSeg.m_dataRow * m_rowLength, 5, indexSelect, thisSeg.m_numRows);
+            } else {
+                m_shards[thisSeg.m_shard]->readDataRange(data + thisSeg.m_dataRow * m_rowLength, 5, indexSelect, thisSeg.m_numRows);
+            }
+        }
+    } catch (CiftiException& e) {
+        *errorOut = e.whatString();
+    } catch (std::exception& e) {
+        *errorOut = e.what();
+    }
+}
+
+template<typename T>
+void CiftiShardedImpl::getRowTyped(T* dataOut, const vector<int64_t>& indexSelect, const bool& tolerateShortRead) const
+{
+    int64_t shard, shardRow;
+    locate(rowNumber(m_rowDims, indexSelect), shard, shardRow);
+    m_shards[shard]->readData(dataOut, 5, vector<int64_t>(1, shardRow), tolerateShortRead);
+}
+
+void CiftiShardedImpl::getColumn(float* dataOut, const int64_t& index) const
+{
+    CiftiAssert(m_rowDims.size() == 1);//otherwise this shouldn't be called
+    CiftiAssert(index >= 0 && index < m_rowLength);
+    vector<int64_t> indexSelect(2);
+    indexSelect[0] = index;
+    vector<char> scratch;
+    for (int64_t i = 0; i < m_numRows; ++i)//same as a single file, 1 element at a time
+    {
+        int64_t shard;
+        locate(i, shard, indexSelect[1]);
+        m_shards[shard]->readData(dataOut + i, 4, indexSelect, scratch);
+    }
+}
+
+void CiftiShardedImpl::getRows(float* dataOut, const int64_t& rowLength, const vector<vector<int64_t> >& indexSelects) const
+{
+    CiftiAssert(rowLength == m_rowLength);
+    vector<Segment> segments;
+    for (size_t i = 0; i < indexSelects.size(); ++i)
+    {
+        addSegments(segments, rowNumber(m_rowDims, indexSelects[i]), 1, i);
+    }
+    transfer(dataOut, segments, false);
+}
+
+void CiftiShardedImpl::getRowRange(float* dataOut, const vector<int64_t>&, const vector<int64_t>& indexSelect, const int64_t& numRows) const
+{
+    vector<Segment> segments;
+    addSegments(segments, rowNumber(m_rowDims, indexSelect), numRows, 0);
+    transfer(dataOut, segments, false);
+}
+
+template<typename T>
+void CiftiShardedImpl::setRowTyped(const T* dataIn, const vector<int64_t>& indexSelect)
+{
+    int64_t shard, shardRow;
+    locate(rowNumber(m_rowDims, indexSelect), shard, shardRow);
+    m_shards[shard]->writeData(dataIn, 5, vector<int64_t>(1, shardRow));
+}
+
+void CiftiShardedImpl::setColumn(const float* dataIn, const int64_t& index)
+{
+    CiftiAssert(m_rowDims.size() == 1);//otherwise this shouldn't be called
+    CiftiAssert(index >= 0 && index < m_rowLength);
+    vector<int64_t> indexSelect(2);
+    indexSelect[0] = index;
+    vector<char> scratch;
+    for (int64_t i = 0; i < m_numRows; ++i)//don't do RMW, so write it 1 element at a time
+    {
+        int64_t shard;
+        locate(i, shard, indexSelect[1]);
+        m_shards[shard]->writeData(dataIn + i, 4, indexSelect, scratch);
+    }
+}
+
+void CiftiShardedImpl::setRows(const float* dataIn, const int64_t& rowLength, const vector<vector<int64_t> >& indexSelects)
+{
+    CiftiAssert(rowLength == m_rowLength);
+    vector<Segment> segments;
+    for (size_t i = 0; i < indexSelects.size(); ++i)
+    {
+        addSegments(segments, rowNumber(m_rowDims, indexSelects[i]), 1, i);
+    }
+    transfer(const_cast<float*>(dataIn), segments, true);//only read from when writing
+}
+
+void CiftiShardedImpl::setRowRange(const float* dataIn, const vector<int64_t>&, const vector<int64_t>& indexSelect, const int64_t& numRows)
+{
+    vector<Segment> segments;
+    addSegments(segments, rowNumber(m_rowDims, indexSelect), numRows, 0);
+    transfer(const_cast<float*>(dataIn), segments, true);//only read from when writing
+}
+
+void CiftiShardedImpl::close()
+{
+    AString firstError;
+    for (size_t i = 0; i < m_shards.size(); ++i)
+    {
+        try
+        {
+            m_shards[i]->close();//close all of them even if one fails
+        } catch (CiftiException& e) {
+            if (firstError == "") firstError = e.whatString();
+        }
+    }
+    if (firstError != "") throw CiftiException(firstError);
+}
+
+CiftiAutoScaleImpl::CiftiAutoScaleImpl(const CiftiXML& xml, const AString& tempName)
+{
+    vector<int64_t> dims = xml.getDimensions();
+    CiftiAssert(!dims.empty());
+    m_rowLength = dims[0];
+    m_numRows = 1;
+    for (size_t i = 1; i < dims.size(); ++i) m_numRows *= dims[i];
+    m_min = numeric_limits<float>::infinity();
+    m_max = -numeric_limits<float>::infinity();
+    m_tempName = tempName;
+    if (m_tempName == "")
+    {
+        m_staging = boost::shared_ptr<CiftiMemoryImpl>(new CiftiMemoryImpl(xml));
+    } else {//native float32 without scaling, so staged rows are written and read back without conversion
+        m_staging = boost::shared_ptr<CiftiOnDiskImpl>(new CiftiOnDiskImpl(m_tempName, xml, CiftiVersion(), false, NIFTI_TYPE_FLOAT32, false, -1.0, 1.0));
+    }
+}
+
+CiftiAutoScaleImpl::~CiftiAutoScaleImpl()
+{
+    removeTemp();
+}
+
+void CiftiAutoScaleImpl::removeTemp()
+{
+    if (m_tempName == "") return;
+    m_staging.reset();//close it first
+    remove(AString_to_std_string(m_tempName).c_str());
+    m_tempName = "";
+}
+
+void CiftiAutoScaleImpl::replaceStaging(const boost::shared_ptr<CiftiFile::WriteImplInterface>& staging)
+{
+    removeTemp();
+    m_staging = staging;
+}
+
+void CiftiAutoScaleImpl::getRange(float& minOut, float& maxOut) const
+{
+    CiftiMutexLocker locked(&m_rangeMutex);
+    minOut = m_min;
+    maxOut = m_max;
+}
+
+void CiftiAutoScaleImpl::addRange(const float* data, const int64_t& count)
+{
+    float dataMin = numeric_limits<float>::infinity(), dataMax = -numeric_limits<float>::infinity();
+    DataConversion::updateRange(data, count, dataMin, dataMax);//outside the lock, setRow from several threads shouldn't wait on each other
+    CiftiMutexLocker locked(&m_rangeMutex);
+    if (dataMin < m_min) m_min = dataMin;
+    if (dataMax > m_max) m_max = dataMax;
+}
+
+void CiftiAutoScaleImpl::setRow(const float* dataIn, const vector<int64_t>& indexSelect)
+{
+    m_staging->setRow(dataIn, indexSelect);//first, so that a bad index doesn't change the range
+    addRange(dataIn, m_rowLength);
+}
+
+template<typename T>
+void CiftiAutoScaleImpl::setRowTyped(const T* dataIn, const vector<int64_t>& indexSelect)
+{//staged as float anyway, so convert here and track the range of what was stored
+    vector<float> tempRow(m_rowLength);
+    for (int64_t i = 0; i < m_rowLength; ++i) tempRow[i] = (float)dataIn[i];
+    setRow(tempRow.data(), indexSelect);
+}
+
+void CiftiAutoScaleImpl::setColumn(const float* dataIn, const int64_t& index)
+{
+    m_staging->setColumn(dataIn, index);
+    addRange(dataIn, m_numRows);
+}
+
+void CiftiAutoScaleImpl::setRows(const float* dataIn, const int64_t& rowLength, const vector<vector<int64_t> >& indexSelects)
+{
+    m_staging->setRows(dataIn, rowLength, indexSelects);
+    addRange(dataIn, rowLength * (int64_t)indexSelects.size());
+}
+
+void CiftiAutoScaleImpl::setRowRange(const float* dataIn, const vector<int64_t>& dims, const vector<int64_t>& indexSelect, const int64_t& numRows)
+{
+    m_staging->setRowRange(dataIn, dims, indexSelect, numRows);
+    addRange(dataIn, dims[0] * numRows);
+}
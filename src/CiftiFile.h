@@ -29,6 +29,7 @@
  */
 
 #include "Common/AString.h"
+#include "Common/BinaryFile.h"
 #include "Common/CiftiException.h"
 #include "Common/MultiDimIterator.h"
 #include "Cifti/CiftiXML.h"
@@ -55,20 +56,38 @@ namespace cifti
         };
         
         CiftiFile();
+        
+        ///finishes an auto-scaled file if close() wasn't called, errors can't be thrown from here, so they are only printed - call close() to catch them
+        ~CiftiFile();
 
         ///starts on-disk reading
         explicit CiftiFile(const AString &fileName);
         
-        ///starts on-disk reading
-        void openFile(const AString& fileName);
+        ///starts on-disk reading, MEMORY_MAP allows getRowPointer() to work on uncompressed, native-endian, unscaled float32 files, DIRECT avoids filling the page cache
+        void openFile(const AString& fileName, const BinaryFile::IOMethod& method = BinaryFile::BUFFERED);
+        
+        ///read a complete, uncompressed cifti file from caller-owned memory, without copying it - the memory must stay valid until close() or another open
+        void openBuffer(const void* data, const int64_t& size);
+        
+        ///write the file into a buffer instead of to disk, bufferOut must not be the memory given to openBuffer
+        void writeBuffer(std::vector<char>& bufferOut, const CiftiVersion& writingVersion = CiftiVersion(), const ENDIAN& endian = NATIVE);
         
-        ///starts on-disk writing
-        void setWritingFile(const AString& fileName, const CiftiVersion& writingVersion = CiftiVersion(), const ENDIAN& endian = NATIVE);
+        ///starts on-disk reading of a matrix that is split by rows across several nifti files, as written by setWritingShardedFile
+        void openShardedFile(const AString& manifestName);
+        
+        ///starts on-disk writing split by rows across several nifti-2 files (for instance, on different devices), manifestName is a small text file listing them, and holds the XML
+        ///rows go to the shards round-robin in stripes of stripeRows consecutive rows, so a large getRowRange reads or writes every shard at once - 0 picks about 16MiB per stripe
+        void setWritingShardedFile(const AString& manifestName, const std::vector<AString>& shardNames, const int64_t& stripeRows = 0,
+                                   const CiftiVersion& writingVersion = CiftiVersion(), const ENDIAN& endian = NATIVE);
+        
+        ///starts on-disk writing, DIRECT avoids filling the page cache
+        void setWritingFile(const AString& fileName, const CiftiVersion& writingVersion = CiftiVersion(), const ENDIAN& endian = NATIVE,
+                            const BinaryFile::IOMethod& method = BinaryFile::BUFFERED);
         
         ///does nothing if filename, version, and effective endianness match file currently open, otherwise writes complete file
         void writeFile(const AString& fileName, const CiftiVersion& writingVersion = CiftiVersion(), const ENDIAN& endian = ANY);
         
-        ///closes the underlying file to flush it, so that exceptions can be thrown
+        ///closes the underlying file to flush it, so that exceptions can be thrown - with setWritingDataTypeAutoScaling, this is when the output file is written
         void close();
 
         ///reads file into memory, closes file
@@ -78,6 +97,7 @@ namespace cifti
         bool isInMemory() const;
         
         ///the tolerateShortRead parameter is useful for on-disk writing when it is easiest to do RMW multiple times on a new file
+        ///multiple threads may call getRow at the same time, including when reading on-disk
         void getRow(float* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead = false) const;
         const std::vector<int64_t>& getDimensions() const { return m_dims; }
         
@@ -87,7 +107,10 @@ namespace cifti
             return MultiDimIterator<int64_t>(std::vector<int64_t>(m_dims.begin() + 1, m_dims.end()));
         }
         
-        ///for 2D only, will be slow if on disk!
+        ///zero-copy row access, returns NULL if the data is not available without conversion (see openFile), pointer is invalidated by any change to the file
+        const float* getRowPointer(const std::vector<int64_t>& indexSelect) const;
+        
+        ///for 2D only, will be slow if on disk, unless the file has a tile sidecar (see writeTileSidecar)
         void getColumn(float* dataOut, const int64_t& index) const;
         
         void setCiftiXML(const CiftiXML& xml, const bool useOldMetadata = true);
@@ -102,17 +125,107 @@ namespace cifti
         ///for 2D only, if you don't want to pass a vector for indexing
         void setRow(const float* dataIn, const int64_t& index);
         
+        ///for 2D only, if you don't want to pass a vector for indexing
+        const float* getRowPointer(const int64_t& index) const;
+        
+        ///getRow/setRow in other types, for instance int32_t for label keys or double for float64 files - on disk, the file data is converted straight to or from these types
+        ///conversion to integer types rounds to nearest and clamps, in-memory data is stored as float, so double can't get more precision from it
+        void getRow(double* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead = false) const;
+        void getRow(int32_t* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead = false) const;
+        void getRow(int16_t* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead = false) const;
+        void getRow(uint8_t* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead = false) const;
+        void setRow(const double* dataIn, const std::vector<int64_t>& indexSelect);
+        void setRow(const int32_t* dataIn, const std::vector<int64_t>& indexSelect);
+        void setRow(const int16_t* dataIn, const std::vector<int64_t>& indexSelect);
+        void setRow(const uint8_t* dataIn, const std::vector<int64_t>& indexSelect);
+        
+        ///for 2D only, if you don't want to pass a vector for indexing
+        void getRow(double* dataOut, const int64_t& index, const bool& tolerateShortRead = false) const;
+        void getRow(int32_t* dataOut, const int64_t& index, const bool& tolerateShortRead = false) const;
+        void getRow(int16_t* dataOut, const int64_t& index, const bool& tolerateShortRead = false) const;
+        void getRow(uint8_t* dataOut, const int64_t& index, const bool& tolerateShortRead = false) const;
+        void setRow(const double* dataIn, const int64_t& index);
+        void setRow(const int32_t* dataIn, const int64_t& index);
+        void setRow(const int16_t* dataIn, const int64_t& index);
+        void setRow(const uint8_t* dataIn, const int64_t& index);
+        
+        ///many rows at once, stored consecutively in dataOut/dataIn - when on disk, the IO is submitted together (io_uring on linux), which helps for scattered rows
+        void getRows(float* dataOut, const std::vector<std::vector<int64_t> >& indexSelects) const;
+        void setRows(const float* dataIn, const std::vector<std::vector<int64_t> >& indexSelects);
+        
+        ///for 2D only, if you don't want to pass vectors for indexing
+        void getRows(float* dataOut, const std::vector<int64_t>& indices) const;
+        
+        ///for 2D only, if you don't want to pass vectors for indexing
+        void setRows(const float* dataIn, const std::vector<int64_t>& indices);
+        
+        ///numRows consecutive rows in file order (as getIteratorOverRows() visits them), starting at indexSelect, stored consecutively - when on disk, this is one large read/write
+        void getRowRange(float* dataOut, const std::vector<int64_t>& indexSelect, const int64_t& numRows) const;
+        void setRowRange(const float* dataIn, const std::vector<int64_t>& indexSelect, const int64_t& numRows);
+        
+        ///for 2D only, rows firstRow through firstRow + numRows - 1
+        void getRows(float* dataOut, const int64_t& firstRow, const int64_t& numRows) const;
+        
+        ///for 2D only, rows firstRow through firstRow + numRows - 1
+        void setRows(const float* dataIn, const int64_t& firstRow, const int64_t& numRows);
+        
+        enum AccessPattern
+        {
+            NORMAL_ACCESS,
+            SEQUENTIAL_ROWS,//rows in file order, more readahead
+            RANDOM_ROWS,//scattered rows, no readahead
+            COLUMN_SCAN//getColumn or strided access, readahead only if rows are small
+        };
+        ///hint to the OS about how an on-disk file will be read, does nothing for in-memory data - call after openFile
+        void setAccessPattern(const AccessPattern& pattern) const;
+        
+        ///for 2D only, start reading these rows into the page cache in the background
+        void willNeedRows(const int64_t& firstRow, const int64_t& numRows) const;
+        
+        ///opt-in, reads and converts the rows following the last requested row on a helper thread, using at most maxBytes of buffer (but at least one row)
+        ///only affects files opened with openFile, 0 disables - helps when getRow is called in file order, as with getIteratorOverRows()
+        void setReadAhead(const int64_t& maxBytes);
+        
+        ///opt-in for writing to disk, setRow copies the row and returns, and a helper thread converts and writes queued rows in file order, using at most maxBytes of buffers (but at least one row)
+        ///write errors are reported by a later setRow, or by close() or writeFile(), 0 disables - can be set before setWritingFile
+        void setWriteBehind(const int64_t& maxBytes);
+        
+        ///for 2D only, writes a copy of the matrix in square tiles (tileSize by tileSize elements) to <fileName>.tiles, which openFile then uses for getColumn
+        ///getColumn reads one column of tiles instead of one element per row - the sidecar is ignored once the file changes, and removed when CiftiFile rewrites it
+        ///changes are seen through the file's size, inode, and modification and change times (nanoseconds where the system has them), so this waits until the
+        ///filesystem clock has moved past the file's times, which may take up to a second on systems with coarse timestamps
+        static void writeTileSidecar(const AString& fileName, const int64_t& tileSize = 128);
+        
         ///data type and scaling options - should be set before setRow, etc, to avoid rewriting of file
+        ///CIFTILIB_TYPE_FLOAT16 (half precision) is a CiftiLib extension that other nifti readers will refuse, see nifti1.h
         void setWritingDataTypeNoScaling(const int16_t& type = NIFTI_TYPE_FLOAT32);
         void setWritingDataTypeAndScaling(const int16_t& type, const double& minval, const double& maxval);
+        ///scaling chosen from the data, so no extra pass is needed to find the range: rows are staged as float32 (in memory, or in a hidden temporary file next to
+        ///the output when stageOnDisk), the range is tracked as they are set, and close() writes the file with the scaling that spans it - writeFile() and
+        ///writeBuffer() also use the range, overwritten values still count toward it, and reading before close() gives the unquantized values
+        void setWritingDataTypeAutoScaling(const int16_t& type, const bool& stageOnDisk = false);
+        ///NIFTI_TYPE_INT8 or NIFTI_TYPE_INT16 with a scale and offset for each row (or each blockLength elements of a row, 0 means whole rows), fit to its range when it is written,
+        ///for instance for dconns, where rows have very different ranges - the table is in a CiftiLib nifti extension (see nifti2.h), which CiftiFile reads transparently,
+        ///other nifti readers see the stored integers - can't be used with compressed or sharded files, setColumn rewrites whole rows
+        void setWritingDataTypeRowScaling(const int16_t& type, const int64_t& blockLength = 0);
 
         //implementation details from here down
         class ReadImplInterface
         {
         public:
             virtual void getRow(float* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const = 0;
+            virtual void getRow(double* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const = 0;
+            virtual void getRow(int32_t* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const = 0;
+            virtual void getRow(int16_t* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const = 0;
+            virtual void getRow(uint8_t* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const = 0;
             virtual void getColumn(float* dataOut, const int64_t& index) const = 0;
+            virtual const float* getRowPointer(const std::vector<int64_t>&) const { return NULL; }
+            virtual void getRows(float* dataOut, const int64_t& rowLength, const std::vector<std::vector<int64_t> >& indexSelects) const;//default loops over getRow
+            virtual void getRowRange(float* dataOut, const std::vector<int64_t>& dims, const std::vector<int64_t>& indexSelect, const int64_t& numRows) const;//ditto
             virtual bool isInMemory() const { return false; }
+            virtual void setAccessPattern(const AccessPattern&) const { }
+            virtual void willNeedRows(const int64_t&, const int64_t&, const int64_t&) const { }
+            virtual void setReadAhead(const int64_t&, const std::vector<int64_t>&) { }
             virtual ~ReadImplInterface();
         };
         //assume if you can write to it, you can also read from it
@@ -120,7 +233,15 @@ namespace cifti
         {
         public:
             virtual void setRow(const float* dataIn, const std::vector<int64_t>& indexSelect) = 0;
+            virtual void setRow(const double* dataIn, const std::vector<int64_t>& indexSelect) = 0;
+            virtual void setRow(const int32_t* dataIn, const std::vector<int64_t>& indexSelect) = 0;
+            virtual void setRow(const int16_t* dataIn, const std::vector<int64_t>& indexSelect) = 0;
+            virtual void setRow(const uint8_t* dataIn, const std::vector<int64_t>& indexSelect) = 0;
             virtual void setColumn(const float* dataIn, const int64_t& index) = 0;
+            virtual void setRows(const float* dataIn, const int64_t& rowLength, const std::vector<std::vector<int64_t> >& indexSelects);//default loops over setRow
+            virtual void setRowRange(const float* dataIn, const std::vector<int64_t>& dims, const std::vector<int64_t>& indexSelect, const int64_t& numRows);//ditto
+            virtual void setWriteBehind(const int64_t&, const std::vector<int64_t>&) { }
+            virtual void flush() { }//write anything that is queued, throw any pending write error
             virtual void close() {}
             virtual ~WriteImplInterface();
         };
@@ -129,14 +250,30 @@ namespace cifti
         boost::shared_ptr<WriteImplInterface> m_writingImpl;//this will be equal to m_readingImpl when non-null
         boost::shared_ptr<ReadImplInterface> m_readingImpl;
         AString m_writingFile;
+        std::vector<AString> m_writingShards;//when not empty, m_writingFile is the manifest
+        int64_t m_shardStripeRows;
         CiftiXML m_xml;
         CiftiVersion m_onDiskVersion;
         ENDIAN m_endianPref;
-        bool m_doWriteScaling;
+        BinaryFile::IOMethod m_writingMethod;
+        int64_t m_writeBehindBytes;
+        bool m_doWriteScaling, m_autoScaling, m_autoScaleOnDisk;
         int16_t m_writingDataType;
         double m_minScalingVal, m_maxScalingVal;
+        int64_t m_rowScaleBlock;//-1 unless using per-row scaling
         
         void verifyWriteImpl();
+        boost::shared_ptr<WriteImplInterface> makeFileWriter(const bool& rescale, const double& minval, const double& maxval) const;//to m_writingFile, or its shards
+        void getWritingScaling(bool& rescale, double& minval, double& maxval) const;//finds the range from the data in auto scaling mode
+        void checkRowRange(const std::vector<int64_t>& indexSelect, const int64_t& numRows) const;
+        template<typename T>
+        void getRowTyped(T* dataOut, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead) const;
+        template<typename T>
+        void getRowTyped(T* dataOut, const int64_t& index, const bool& tolerateShortRead) const;
+        template<typename T>
+        void setRowTyped(const T* dataIn, const std::vector<int64_t>& indexSelect);
+        template<typename T>
+        void setRowTyped(const T* dataIn, const int64_t& index);
         static void copyImplData(const ReadImplInterface* from, WriteImplInterface* to, const std::vector<int64_t>& dims);
     };
     
@@ -115,7 +115,7 @@ namespace cifti
     }
     inline bool AString_endsWith(const AString& test, const AString& pattern)
     {
-        return test.substr(test.size() - pattern.size()) == pattern;
+        return test.size() >= pattern.size() && test.substr(test.size() - pattern.size()) == pattern;//substr throws when the start is past the end
     }
     template <typename T>
     AString AString_number(const T& num)
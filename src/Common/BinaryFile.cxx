@@ -51,8 +51,31 @@
 #include "zlib.h"
 #endif //CIFTILIB_HAVE_ZLIB
 
+#ifdef CIFTILIB_HAVE_ZSTD
+#include "zstd.h"
+#if ZSTD_VERSION_NUMBER < 10400
+#undef CIFTILIB_HAVE_ZSTD //ZSTD_compress2 and the advanced parameters became stable in 1.4.0
+#endif
+#endif //CIFTILIB_HAVE_ZSTD
+
+#if defined(CIFTILIB_HAVE_MMAP) || defined(CIFTILIB_HAVE_PREAD)
+    #include "errno.h"
+    #include "fcntl.h"
+    #include "sys/stat.h"
+    #include "unistd.h"
+#endif
+#if defined(CIFTILIB_HAVE_MMAP) || defined(CIFTILIB_HAVE_IO_URING)
+    #include "sys/mman.h"
+#endif
+#ifdef CIFTILIB_HAVE_IO_URING
+    #include "linux/io_uring.h"
+    #include "sys/syscall.h"
+#endif //CIFTILIB_HAVE_IO_URING
+
 #include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <limits>
 
 using namespace cifti;
 using boost::shared_ptr;
@@ -79,8 +102,147 @@ namespace cifti
     };
 
     const int64_t ZFileImpl::CHUNK_SIZE = 1<<26;//64MiB, large enough for good performance, small enough for zlib, must convert to uint32
+
+    //multi-member gzip file in the BGZF layout (each member holds at most 64KiB, and has its compressed size in an extra header field),
+    //when writing, members are compressed on separate threads - stock zlib reads it as an ordinary concatenated gzip file
+    //when reading, the member sizes give random access, and batches of members are decompressed on separate threads
+    class BgzfFileImpl : public BinaryFile::ImplInterface
+    {
+        struct Block
+        {
+            int64_t m_inPos, m_outPos;//start of member in the file, and of its data in the uncompressed stream
+            int32_t m_inSize, m_outSize;
+        };
+        boost::shared_ptr<BinaryFile::ImplInterface> m_rawFile;
+        std::vector<char> m_pending;//when writing, uncompressed data not yet compressed
+        std::vector<Block> m_blocks;//when reading, all nonempty members
+        std::vector<char> m_batch;//when reading, decompressed data of members [m_batchFirst, m_batchEnd)
+        int64_t m_batchFirst, m_batchEnd;
+        int64_t m_curPos, m_totalSize;
+        BinaryFile::AccessPattern m_pattern;//controls how many members to decompress ahead of the reader
+        const static int64_t BLOCK_DATA_SIZE, BATCH_BLOCKS;
+        void flushBlocks(const bool& final);
+        void scanBlocks();
+        void decodeBatch(const int64_t& first, const int64_t& end);
+        int64_t findBlock(const int64_t& position) const;
+    public:
+        BgzfFileImpl() { m_curPos = 0; m_totalSize = -1; m_batchFirst = 0; m_batchEnd = 0; m_pattern = BinaryFile::NORMAL_ACCESS; }
+        void open(const AString& filename, const BinaryFile::OpenMode& opmode);
+        void close();
+        void seek(const int64_t& position);
+        int64_t pos();
+        int64_t size() { return m_totalSize; }
+        void read(void* dataOut, const int64_t& count, int64_t* numRead);
+        void write(const void* dataIn, const int64_t& count);
+        void adviseAccess(const BinaryFile::AccessPattern& pattern, const int64_t& offset, const int64_t& length);
+        ~BgzfFileImpl();
+    };
+
+    const int64_t BgzfFileImpl::BLOCK_DATA_SIZE = 0xff00;//same as bgzip, so that even incompressible data fits in a member of at most 64KiB
+    const int64_t BgzfFileImpl::BATCH_BLOCKS = 256;//compress or decompress about 16MiB at a time
+
+#if ZLIB_VERNUM >= 0x1280
+#define CIFTILIB_ZLIB_CHECKPOINTS
+    //reading implementation that records the decompressor state every so often (like zlib's examples/zran.c), so that seeking backwards
+    //doesn't need to start over from the beginning of the file - also saves these checkpoints to a sidecar file, so future opens can decompress in parallel
+    //the first pass can't be parallel, because deflate blocks can only be found by decoding from the start of the member
+    class IndexedZFileImpl : public BinaryFile::ImplInterface
+    {
+        struct Checkpoint
+        {
+            int64_t m_outPos, m_inPos;//uncompressed position, and compressed position after the byte containing the block boundary
+            int m_bits;//bits of the previous compressed byte that belong to the next block
+            std::vector<unsigned char> m_window;//empty means this is the start of a gzip member, so no dictionary is needed
+        };
+        struct Decoder
+        {
+            z_stream m_strm;
+            bool m_strmInit, m_rawMode, m_streamEnded;
+            std::vector<unsigned char> m_inBuf;
+            int64_t m_inPos;//compressed position of the next byte to put in m_inBuf
+            int64_t m_decodePos;//uncompressed position of the decoder
+            Decoder() { m_strmInit = false; m_rawMode = false; m_streamEnded = false; m_inPos = 0; m_decodePos = 0; }
+            ~Decoder() { if (m_strmInit) inflateEnd(&m_strm); }
+        };
+        boost::shared_ptr<BinaryFile::ImplInterface> m_rawFile;
+        Decoder m_decoder;//the one that records checkpoints, additional ones are used to decompress spans between checkpoints in parallel
+        int64_t m_curPos;//logical position, read() catches the decoder up to this
+        int64_t m_rawSize, m_totalSize;
+        std::vector<Checkpoint> m_index;
+        bool m_indexComplete, m_indexLoaded;
+        const static int64_t CHUNK_SIZE, CHECKPOINT_SPAN, IN_BUF_SIZE;
+        void restart(Decoder& dec, const Checkpoint* from);//NULL means start of file
+        void reposition(const int64_t& target);
+        int64_t firstCheckpointAfter(const int64_t& position) const;
+        int64_t decode(Decoder& dec, char* out, const int64_t& count, const bool& record);
+        int64_t fill(Decoder& dec);
+        void finishMember(Decoder& dec, const bool& record);
+        void addCheckpoint(Decoder& dec);
+        AString indexFileName() const { return m_fileName + ".zidx"; }
+        uint64_t fileSignature();
+        void loadIndex();
+        void saveIndex();
+    public:
+        IndexedZFileImpl() { m_curPos = 0; m_rawSize = -1; m_totalSize = -1; m_indexComplete = false; m_indexLoaded = false; }
+        void open(const AString& filename, const BinaryFile::OpenMode& opmode);
+        void close();
+        void seek(const int64_t& position);
+        int64_t pos();
+        int64_t size() { return m_totalSize; }//only known once the end has been reached, or from a saved index
+        void read(void* dataOut, const int64_t& count, int64_t* numRead);
+        void write(const void* dataIn, const int64_t& count);
+        void adviseAccess(const BinaryFile::AccessPattern& pattern, const int64_t& offset, const int64_t& length);
+        ~IndexedZFileImpl();
+    };
+
+    const int64_t IndexedZFileImpl::CHUNK_SIZE = 1<<26;//same as ZFileImpl
+    const int64_t IndexedZFileImpl::CHECKPOINT_SPAN = 1<<20;//1MiB of uncompressed data between checkpoints, each checkpoint holds a 32KiB window
+    const int64_t IndexedZFileImpl::IN_BUF_SIZE = 1<<18;
+#endif //ZLIB_VERNUM
 #endif //ZLIB_VERSION
 
+#ifdef CIFTILIB_HAVE_ZSTD
+    //zstd seekable format (independent frames, then a skippable frame listing the size of every frame), as in zstd's contrib/seekable_format,
+    //the zstd tool reads it as an ordinary multi-frame file - frames are compressed on separate threads, and only the frames a read touches are decompressed
+    class ZstdFileImpl : public BinaryFile::ImplInterface
+    {
+        struct Frame
+        {
+            int64_t m_inPos, m_outPos;//start of frame in the file, and of its data in the uncompressed stream
+            int64_t m_inSize, m_outSize;
+        };
+        boost::shared_ptr<BinaryFile::ImplInterface> m_rawFile;
+        std::vector<char> m_pending;//when writing, uncompressed data not yet compressed
+        std::vector<Frame> m_frames;//when reading, all nonempty frames - when writing, the frames written so far, for the seek table
+        std::vector<char> m_batch;//when reading, decompressed data of frames [m_batchFirst, m_batchEnd)
+        int64_t m_batchFirst, m_batchEnd;
+        int64_t m_curPos, m_totalSize, m_rawPos;
+        BinaryFile::AccessPattern m_pattern;//controls how many frames to decompress ahead of the reader
+        const static int64_t FRAME_DATA_SIZE, BATCH_FRAMES;
+        const static int COMPRESSION_LEVEL;
+        void flushFrames(const bool& final);
+        void readSeekTable();
+        void writeSeekTable();
+        void decodeBatch(const int64_t& first, const int64_t& end);
+        int64_t findFrame(const int64_t& position) const;
+    public:
+        ZstdFileImpl() { m_curPos = 0; m_totalSize = -1; m_rawPos = 0; m_batchFirst = 0; m_batchEnd = 0; m_pattern = BinaryFile::NORMAL_ACCESS; }
+        void open(const AString& filename, const BinaryFile::OpenMode& opmode);
+        void close();
+        void seek(const int64_t& position);
+        int64_t pos();
+        int64_t size() { return m_totalSize; }
+        void read(void* dataOut, const int64_t& count, int64_t* numRead);
+        void write(const void* dataIn, const int64_t& count);
+        void adviseAccess(const BinaryFile::AccessPattern& pattern, const int64_t& offset, const int64_t& length);
+        ~ZstdFileImpl();
+    };
+
+    const int64_t ZstdFileImpl::FRAME_DATA_SIZE = 1<<18;//256KiB, small enough that a random dconn row only decompresses a frame or two
+    const int64_t ZstdFileImpl::BATCH_FRAMES = 64;//compress or decompress 16MiB at a time
+    const int ZstdFileImpl::COMPRESSION_LEVEL = 3;//zstd's default
+#endif //CIFTILIB_HAVE_ZSTD
+
 #ifdef CIFTILIB_USE_QT
     class QFileImpl : public BinaryFile::ImplInterface
     {
@@ -94,6 +256,7 @@ namespace cifti
         int64_t size() { return m_file.size(); }
         void read(void* dataOut, const int64_t& count, int64_t* numRead);
         void write(const void* dataIn, const int64_t& count);
+        void preallocate(const int64_t& size) { if (m_file.size() < size) m_file.resize(size); }//sparse, but at least gives the full size
     };
 
     const int64_t QFileImpl::CHUNK_SIZE = 1<<30;//1GiB, QT4 apparently chokes at more than 2GiB via buffer.read using int32
@@ -114,15 +277,179 @@ namespace cifti
         ~StrFileImpl();
     };
 #endif //CIFTILIB_USE_QT
+
+#ifdef CIFTILIB_HAVE_PREAD
+    class PosixFileImpl : public BinaryFile::ImplInterface
+    {
+        int m_fd;
+        int64_t m_curPos;//all IO is positional, so the file descriptor's offset is never used
+        bool m_uncached, m_aligned;//O_DIRECT needs aligned offsets, sizes, and memory, so m_aligned routes through a bounce buffer
+        int64_t m_logicalSize;//when m_aligned, writes may extend the file past the data, so this is truncated to on close - guarded by m_seekMutex
+        bool m_sizeDirty;
+        int64_t logicalSize() { CiftiMutexLocker locked(&m_seekMutex); return m_logicalSize; }//for readers, which don't otherwise lock
+        const static int64_t DIRECT_ALIGN, DIRECT_CHUNK;
+        void directReadAt(const int64_t& position, void* dataOut, const int64_t& count, int64_t* numRead);
+        void directWriteAt(const int64_t& position, const void* dataIn, const int64_t& count);
+        int64_t preadFull(void* dataOut, const int64_t& count, const int64_t& position);//loops until count, end of file, or error
+    public:
+        PosixFileImpl(const bool& uncached = false) { m_fd = -1; m_curPos = -1; m_uncached = uncached; m_aligned = false; m_logicalSize = 0; m_sizeDirty = false; }
+        void open(const AString& filename, const BinaryFile::OpenMode& opmode);
+        void close();
+        void seek(const int64_t& position);
+        int64_t pos();
+        int64_t size();
+        void read(void* dataOut, const int64_t& count, int64_t* numRead);
+        void write(const void* dataIn, const int64_t& count);
+        void readAt(const int64_t& position, void* dataOut, const int64_t& count, int64_t* numRead);
+        void writeAt(const int64_t& position, const void* dataIn, const int64_t& count);
+        void readAtBatch(const std::vector<BinaryFile::BatchRequest>& requests);
+        void writeAtBatch(const std::vector<BinaryFile::BatchRequest>& requests);
+        void adviseAccess(const BinaryFile::AccessPattern& pattern, const int64_t& offset, const int64_t& length);
+        void preallocate(const int64_t& size);
+        ~PosixFileImpl();
+    };
+    
+    const int64_t PosixFileImpl::DIRECT_ALIGN = 4096;//safe for the logical block size of nearly all devices
+    const int64_t PosixFileImpl::DIRECT_CHUNK = 1<<23;//8MiB bounce buffer at most
+#endif //CIFTILIB_HAVE_PREAD
+
+    //caller-owned memory instead of a file, either a read-only view of a buffer, or a vector that grows when written past the end
+    class MemoryFileImpl : public BinaryFile::ImplInterface
+    {
+        const char* m_data;//read-only view
+        int64_t m_size;
+        std::vector<char>* m_buffer;//NULL for the read-only view
+        int64_t m_curPos;
+        bool m_writable;
+        void grow(const int64_t& newSize);
+    public:
+        MemoryFileImpl() { m_data = NULL; m_size = 0; m_buffer = NULL; m_curPos = -1; m_writable = false; }
+        void open(const AString& filename, const BinaryFile::OpenMode& opmode);
+        void openView(const void* data, const int64_t& size, const AString& name);
+        void openBuffer(std::vector<char>& buffer, const BinaryFile::OpenMode& opmode, const AString& name);
+        void close();
+        void seek(const int64_t& position);
+        int64_t pos();
+        int64_t size();
+        void read(void* dataOut, const int64_t& count, int64_t* numRead);
+        void write(const void* dataIn, const int64_t& count);
+        void readAt(const int64_t& position, void* dataOut, const int64_t& count, int64_t* numRead);
+        void writeAt(const int64_t& position, const void* dataIn, const int64_t& count);
+        const char* getMappedData() { return (m_writable ? NULL : m_data); }//writing can reallocate the vector
+        void preallocate(const int64_t& size);
+    };
+    
+#ifdef CIFTILIB_HAVE_IO_URING
+    //minimal io_uring setup using the raw system calls, so liburing isn't needed - one ring per thread, so batches from different threads don't interact
+    class IOUringBatch
+    {
+        int m_ringFd;
+        void* m_sqRing;
+        void* m_cqRing;
+        size_t m_sqRingSize, m_cqRingSize, m_sqesSize;
+        io_uring_sqe* m_sqes;
+        io_uring_cqe* m_cqes;
+        unsigned *m_sqHead, *m_sqTail, *m_sqMask, *m_sqArray, *m_cqHead, *m_cqTail, *m_cqMask;
+        unsigned m_entries;
+        const static unsigned RING_ENTRIES;
+        int64_t enter(const unsigned& toSubmit, const unsigned& minComplete);
+        bool init(const unsigned& entries);//false if io_uring isn't available (old kernel, blocked by seccomp, etc)
+        bool transfer(const int& fd, const std::vector<BinaryFile::BatchRequest>& requests, const bool& writing, const AString& filename);//false if the kernel doesn't have the needed operations
+    public:
+        IOUringBatch() { m_ringFd = -1; m_sqRing = MAP_FAILED; m_cqRing = MAP_FAILED; m_sqes = (io_uring_sqe*)MAP_FAILED; m_sqRingSize = 0; m_cqRingSize = 0; m_sqesSize = 0; m_entries = 0; }
+        //uses the calling thread's ring, set up on first use - false if io_uring can't be used, so the caller should use the plain system calls
+        static bool threadTransfer(const int& fd, const std::vector<BinaryFile::BatchRequest>& requests, const bool& writing, const AString& filename);
+        ~IOUringBatch();
+    };
+    
+    const unsigned IOUringBatch::RING_ENTRIES = 256;//requests in flight at once, larger batches are fed through as earlier requests complete
+#endif //CIFTILIB_HAVE_IO_URING
+
+#ifdef CIFTILIB_HAVE_MMAP
+    class MMapFileImpl : public BinaryFile::ImplInterface
+    {
+        int m_fd;
+        char* m_data;
+        int64_t m_size, m_curPos;
+    public:
+        MMapFileImpl() { m_fd = -1; m_data = NULL; m_size = -1; m_curPos = -1; }
+        void open(const AString& filename, const BinaryFile::OpenMode& opmode);
+        void close();
+        void seek(const int64_t& position);
+        int64_t pos();
+        int64_t size() { return m_size; }
+        void read(void* dataOut, const int64_t& count, int64_t* numRead);
+        void write(const void* dataIn, const int64_t& count);
+        void readAt(const int64_t& position, void* dataOut, const int64_t& count, int64_t* numRead);
+        const char* getMappedData() { return m_data; }
+        void adviseAccess(const BinaryFile::AccessPattern& pattern, const int64_t& offset, const int64_t& length);
+        ~MMapFileImpl();
+    };
+#endif //CIFTILIB_HAVE_MMAP
+}
+
+namespace
+{
+    bool s_saveCompressedIndexes = true;//by default, so that only the first full read of a plain .gz file is serial
+    bool s_warnCompressedIndexes = false;//the directory may be read-only, only complain if saving was asked for
+    
+    boost::shared_ptr<BinaryFile::ImplInterface> makeUncompressedImpl()
+    {
+#ifdef CIFTILIB_HAVE_PREAD
+        return boost::shared_ptr<PosixFileImpl>(new PosixFileImpl());//positional IO, so multiple threads can read at once
+#else //CIFTILIB_HAVE_PREAD
+#ifdef CIFTILIB_USE_QT
+        return boost::shared_ptr<QFileImpl>(new QFileImpl());
+#else
+        return boost::shared_ptr<StrFileImpl>(new StrFileImpl());
+#endif
+#endif //CIFTILIB_HAVE_PREAD
+    }
 }
 
 BinaryFile::ImplInterface::~ImplInterface()
 {
 }
 
-BinaryFile::BinaryFile(const AString& filename, const OpenMode& fileMode)
+void BinaryFile::setSaveCompressedIndexes(const bool& save)
+{
+    s_saveCompressedIndexes = save;
+    s_warnCompressedIndexes = save;
+}
+
+void BinaryFile::ImplInterface::readAt(const int64_t& position, void* dataOut, const int64_t& count, int64_t* numRead)
+{//fallback for implementations without positional IO
+    CiftiMutexLocker locked(&m_seekMutex);
+    seek(position);
+    read(dataOut, count, numRead);
+}
+
+void BinaryFile::ImplInterface::writeAt(const int64_t& position, const void* dataIn, const int64_t& count)
+{
+    CiftiMutexLocker locked(&m_seekMutex);
+    seek(position);
+    write(dataIn, count);
+}
+
+void BinaryFile::ImplInterface::readAtBatch(const vector<BatchRequest>& requests)
+{
+    for (size_t i = 0; i < requests.size(); ++i)
+    {
+        readAt(requests[i].m_position, requests[i].m_data, requests[i].m_count, NULL);
+    }
+}
+
+void BinaryFile::ImplInterface::writeAtBatch(const vector<BatchRequest>& requests)
+{
+    for (size_t i = 0; i < requests.size(); ++i)
+    {
+        writeAt(requests[i].m_position, requests[i].m_data, requests[i].m_count);
+    }
+}
+
+BinaryFile::BinaryFile(const AString& filename, const OpenMode& fileMode, const IOMethod& method)
 {
-    open(filename, fileMode);
+    open(filename, fileMode, method);
 }
 
 void BinaryFile::close()
@@ -139,6 +466,26 @@ AString BinaryFile::getFilename() const
     return m_impl->getFilename();
 }
 
+const char* BinaryFile::getMappedData() const
+{
+    if (m_impl == NULL) return NULL;
+    return m_impl->getMappedData();
+}
+
+void BinaryFile::preallocate(const int64_t& size)
+{
+    CiftiAssert(size >= 0);
+    if (m_impl == NULL) throw CiftiException("preallocate called on unopened BinaryFile");
+    m_impl->preallocate(size);
+}
+
+void BinaryFile::adviseAccess(const AccessPattern& pattern, const int64_t& offset, const int64_t& length)
+{
+    CiftiAssert(offset >= 0 && length >= 0);
+    if (m_impl == NULL) return;//it is only a hint
+    m_impl->adviseAccess(pattern, offset, length);
+}
+
 bool BinaryFile::getOpenForRead()
 {
     return (m_curMode & READ) != 0;
@@ -149,23 +496,105 @@ bool BinaryFile::getOpenForWrite()
     return (m_curMode & WRITE) != 0;
 }
 
-void BinaryFile::open(const AString& filename, const OpenMode& opmode)
+bool BinaryFile::isCompressedName(const AString& filename)
+{
+    return AString_endsWith(filename, ".gz") || AString_endsWith(filename, ".zst");
+}
+
+void BinaryFile::openMemory(const void* data, const int64_t& size, const AString& name)
+{
+    close();
+    if (data == NULL && size != 0) throw CiftiException("openMemory called with NULL data");
+    boost::shared_ptr<MemoryFileImpl> memImpl(new MemoryFileImpl());
+    memImpl->openView(data, size, name);
+    m_impl = memImpl;
+    m_curMode = READ;
+}
+
+void BinaryFile::openMemory(std::vector<char>& buffer, const OpenMode& opmode, const AString& name)
+{
+    close();
+    if (opmode == NONE) throw CiftiException("can't open memory buffer with NONE mode");
+    boost::shared_ptr<MemoryFileImpl> memImpl(new MemoryFileImpl());
+    memImpl->openBuffer(buffer, opmode, name);
+    m_impl = memImpl;
+    m_curMode = opmode;
+}
+
+void BinaryFile::open(const AString& filename, const OpenMode& opmode, const IOMethod& method)
 {
     close();
     if (opmode == NONE) throw CiftiException("can't open file with NONE mode");
-    if (AString_substr(filename, filename.size() - 3) == ".gz")
+    bool compressed = isCompressedName(filename);
+#ifdef CIFTILIB_HAVE_PREAD
+    if (method == DIRECT && !compressed)
+    {
+        try
+        {
+            boost::shared_ptr<PosixFileImpl> direct(new PosixFileImpl(true));
+            direct->open(filename, opmode);
+            m_impl = direct;
+            m_curMode = opmode;
+            return;
+        } catch (CiftiException&) {//filesystem may not support O_DIRECT (tmpfs, some network filesystems), use the normal implementation, which also gives better open errors
+        }
+    }
+#endif //CIFTILIB_HAVE_PREAD
+#ifdef CIFTILIB_HAVE_MMAP
+    if (method == MEMORY_MAP && opmode == READ && !compressed)
+    {
+        try
+        {
+            boost::shared_ptr<MMapFileImpl> mapped(new MMapFileImpl());
+            mapped->open(filename, opmode);
+            m_impl = mapped;
+            m_curMode = opmode;
+            return;
+        } catch (CiftiException&) {//mapping isn't possible for some files (empty, special files, too large for address space), use the normal implementation, which also gives better open errors
+        }
+    }
+#endif //CIFTILIB_HAVE_MMAP
+    if (AString_endsWith(filename, ".zst"))
     {
+#ifdef CIFTILIB_HAVE_ZSTD
+        m_impl = boost::shared_ptr<ZstdFileImpl>(new ZstdFileImpl());
+#else //CIFTILIB_HAVE_ZSTD
+        throw CiftiException("can't open .zst file '" + filename + "', compiled without zstd support");
+#endif //CIFTILIB_HAVE_ZSTD
+    } else if (compressed) {
 #ifdef ZLIB_VERSION
-        m_impl = boost::shared_ptr<ZFileImpl>(new ZFileImpl());
+        if (opmode == READ)
+        {
+            try
+            {
+                boost::shared_ptr<BgzfFileImpl> blocked(new BgzfFileImpl());
+                blocked->open(filename, opmode);
+                m_impl = blocked;
+                m_curMode = opmode;
+                return;
+            } catch (CiftiException&) {//not BGZF, or some other problem that the generic reader will report
+            }
+        }
+#ifdef CIFTILIB_ZLIB_CHECKPOINTS
+        if (opmode == READ)
+        {
+            m_impl = boost::shared_ptr<IndexedZFileImpl>(new IndexedZFileImpl());
+        } else {
+            m_impl = boost::shared_ptr<BgzfFileImpl>(new BgzfFileImpl());
+        }
+#else //CIFTILIB_ZLIB_CHECKPOINTS
+        if (opmode == READ)
+        {
+            m_impl = boost::shared_ptr<ZFileImpl>(new ZFileImpl());
+        } else {
+            m_impl = boost::shared_ptr<BgzfFileImpl>(new BgzfFileImpl());
+        }
+#endif //CIFTILIB_ZLIB_CHECKPOINTS
 #else //ZLIB_VERSION
         throw CiftiException("can't open .gz file '" + filename + "', compiled without zlib support");
 #endif //ZLIB_VERSION
     } else {
-#ifdef CIFTILIB_USE_QT
-        m_impl = boost::shared_ptr<QFileImpl>(new QFileImpl());
-#else
-        m_impl = boost::shared_ptr<StrFileImpl>(new StrFileImpl());
-#endif
+        m_impl = makeUncompressedImpl();
     }
     m_impl->open(filename, opmode);
     m_curMode = opmode;
@@ -204,6 +633,34 @@ void BinaryFile::write(const void* dataIn, const int64_t& count)
     m_impl->write(dataIn, count);
 }
 
+void BinaryFile::readAt(const int64_t& position, void* dataOut, const int64_t& count, int64_t* numRead)
+{
+    CiftiAssert(position >= 0);
+    CiftiAssert(count >= 0);
+    if (!getOpenForRead()) throw CiftiException("file is not open for reading");
+    m_impl->readAt(position, dataOut, count, numRead);
+}
+
+void BinaryFile::writeAt(const int64_t& position, const void* dataIn, const int64_t& count)
+{
+    CiftiAssert(position >= 0);
+    CiftiAssert(count >= 0);
+    if (!getOpenForWrite()) throw CiftiException("file is not open for writing");
+    m_impl->writeAt(position, dataIn, count);
+}
+
+void BinaryFile::readAtBatch(const vector<BatchRequest>& requests)
+{
+    if (!getOpenForRead()) throw CiftiException("file is not open for reading");
+    m_impl->readAtBatch(requests);
+}
+
+void BinaryFile::writeAtBatch(const vector<BatchRequest>& requests)
+{
+    if (!getOpenForWrite()) throw CiftiException("file is not open for writing");
+    m_impl->writeAtBatch(requests);
+}
+
 #ifdef ZLIB_VERSION
 void ZFileImpl::open(const AString& filename, const BinaryFile::OpenMode& opmode)
 {
@@ -326,208 +783,1970 @@ ZFileImpl::~ZFileImpl()
         cerr << AString_to_std_string("caught unknown exception type while closing compressed file '" + m_fileName + "'") << endl;
     }
 }
-#endif //ZLIB_VERSION
-
-#ifdef CIFTILIB_USE_QT
+namespace
+{
+    const unsigned char BGZF_EOF[28] = { 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0x1b, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    
+    void putLE(unsigned char* out, const uint32_t& value, const int& bytes)
+    {
+        for (int i = 0; i < bytes; ++i)
+        {
+            out[i] = (unsigned char)(value >> (8 * i));
+        }
+    }
+}
 
-void QFileImpl::open(const AString& filename, const BinaryFile::OpenMode& opmode)
+void BgzfFileImpl::open(const AString& filename, const BinaryFile::OpenMode& opmode)
 {
-    close();//don't need to, but just because
+    close();
     m_fileName = filename;
-    QIODevice::OpenMode mode = QIODevice::NotOpen;//means 0
-    if (opmode & BinaryFile::READ) mode |= QIODevice::ReadOnly;
-    if (opmode & BinaryFile::WRITE) mode |= QIODevice::WriteOnly;
-    if (opmode & BinaryFile::TRUNCATE) mode |= QIODevice::Truncate;//expect QFile to recognize silliness like TRUNCATE by itself
-    m_file.setFileName(filename);
-    if (!m_file.open(mode))
+    if (opmode != BinaryFile::READ && opmode != BinaryFile::WRITE_TRUNCATE) throw CiftiException("compressed file only supports READ and WRITE_TRUNCATE modes");
+    boost::shared_ptr<BinaryFile::ImplInterface> rawFile = makeUncompressedImpl();
+    try
     {
-        if (!m_file.exists())
+        rawFile->open(filename, opmode);
+    } catch (CiftiException& e) {
+        throw CiftiException("failed to open compressed file '" + filename + "': " + e.whatString());
+    }
+    m_rawFile = rawFile;
+    m_curPos = 0;
+    m_batchFirst = 0;
+    m_batchEnd = 0;
+    if (opmode == BinaryFile::READ)
+    {
+        try
         {
-            if (!(opmode & BinaryFile::TRUNCATE))
+            scanBlocks();
+        } catch (...) {
+            m_rawFile.reset();
+            throw;
+        }
+    } else {
+        m_totalSize = -1;
+        m_pending.clear();
+        m_pending.reserve(BLOCK_DATA_SIZE * BATCH_BLOCKS);
+    }
+}
+
+namespace
+{//returns the size of the gzip member (BSIZE + 1) if the header is BGZF, otherwise -1
+    int32_t parseBgzfHeader(const unsigned char* header, const int64_t& available, int32_t& headerSize)
+    {
+        if (available < 18 || header[0] != 0x1f || header[1] != 0x8b || header[2] != 8 || header[3] != 4) return -1;//FEXTRA and nothing else, as the BGZF spec requires, so the header ends after the extra field
+        int32_t extraLength = header[10] | (header[11] << 8);
+        headerSize = 12 + extraLength;
+        if (headerSize > available) return -1;
+        for (int32_t i = 12; i + 4 <= headerSize; )
+        {
+            int32_t fieldLength = header[i + 2] | (header[i + 3] << 8);
+            if (header[i] == 'B' && header[i + 1] == 'C' && fieldLength == 2 && i + 6 <= headerSize)
             {
-                throw CiftiException("failed to open file '" + filename + "', file does not exist, or folder permissions prevent seeing it");
-            } else {//m_file.error() doesn't help identify this case, see below
-                throw CiftiException("failed to open file '" + filename + "', unable to create file");
+                return (header[i + 4] | (header[i + 5] << 8)) + 1;
             }
+            i += 4 + fieldLength;
         }
-        switch (m_file.error())
+        return -1;
+    }
+}
+
+void BgzfFileImpl::scanBlocks()
+{//the member headers are all we need to find every member, they are small, and there is one per 64KiB of compressed data
+    m_blocks.clear();
+    int64_t rawSize = m_rawFile->size(), inPos = 0, outPos = 0;
+    vector<unsigned char> headers(512);
+    int64_t headersStart = 0, headersRead = 0;
+    while (inPos < rawSize)
+    {
+        if (inPos + (int64_t)headers.size() > headersStart + headersRead && headersStart + headersRead < rawSize)
+        {//refill, but don't bother reading data between headers - the reads are small, one per member
+            headersStart = inPos;
+            m_rawFile->readAt(inPos, headers.data(), min((int64_t)headers.size(), rawSize - inPos), &headersRead);
+        }
+        int32_t headerSize = 0;
+        int32_t memberSize = parseBgzfHeader(headers.data() + (inPos - headersStart), headersStart + headersRead - inPos, headerSize);
+        if (memberSize < 0)
+        {//could be a valid gzip member of another kind, or trailing garbage - let the generic reader sort it out
+            throw CiftiException("file '" + m_fileName + "' is not entirely in BGZF format");
+        }
+        if (memberSize < headerSize + 8 || inPos + memberSize > rawSize) break;//truncated file, reading past this will give premature end of file
+        unsigned char trailer[4];
+        m_rawFile->readAt(inPos + memberSize - 4, trailer, 4, NULL);
+        int32_t outSize = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((int32_t)trailer[3] << 24);
+        if (outSize < 0 || outSize > 65536) throw CiftiException("invalid BGZF member in file '" + m_fileName + "'");
+        if (outSize > 0)
         {
-            case QFile::ResourceError://on linux at least, it never gives another code besides the unhelpful OpenError
-                throw CiftiException("failed to open file '" + filename + "', too many open files");
-            default:
-                throw CiftiException("failed to open file '" + filename + "'");
+            Block temp;
+            temp.m_inPos = inPos;
+            temp.m_inSize = memberSize;
+            temp.m_outPos = outPos;
+            temp.m_outSize = outSize;
+            m_blocks.push_back(temp);
+            outPos += outSize;
         }
+        inPos += memberSize;
     }
+    m_totalSize = outPos;
 }
 
-void QFileImpl::close()
-{
-    if (!m_file.isOpen()) return; //not sure what flush() does if file isn't open, so let's not try it
-    //WARNING: QFileDevice::close() calls flush, ignores if it fails, then closes
-    //so flush manually and check its error condition instead
-    if (!m_file.flush()) throw CiftiException("failed to flush file '" + m_file.fileName() + "' before closing, data may be corrupted");
-    m_file.close();
+int64_t BgzfFileImpl::findBlock(const int64_t& position) const
+{//last block starting at or before position
+    int64_t low = 0, high = (int64_t)m_blocks.size();
+    while (low < high)
+    {
+        int64_t mid = (low + high) / 2;
+        if (m_blocks[mid].m_outPos <= position)
+        {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low - 1;
 }
 
-void QFileImpl::read(void* dataOut, const int64_t& count, int64_t* numRead)
+void BgzfFileImpl::decodeBatch(const int64_t& first, const int64_t& end)
 {
-    int64_t total = 0;
-    int64_t readret = -1;
-    while (total < count)
+    CiftiAssert(first >= 0 && first < end && end <= (int64_t)m_blocks.size());
+    const Block& lastBlock = m_blocks[end - 1];
+    int64_t inStart = m_blocks[first].m_inPos, outStart = m_blocks[first].m_outPos;
+    vector<unsigned char> compressed(lastBlock.m_inPos + lastBlock.m_inSize - inStart);
+    m_rawFile->readAt(inStart, compressed.data(), compressed.size(), NULL);//members are contiguous, except for empty ones
+    m_batchFirst = 0;
+    m_batchEnd = 0;//in case of error
+    m_batch.resize(lastBlock.m_outPos + lastBlock.m_outSize - outStart);
+    bool failed = false;
+#pragma omp parallel
     {
-        int64_t maxToRead = min(count - total, CHUNK_SIZE);
-        readret = m_file.read(((char*)dataOut) + total, maxToRead);//QFile chokes on large reads also
-        if (readret < 1) break;//0 or -1 means error or eof
-        total += readret;
+        z_stream strm;
+        memset(&strm, 0, sizeof(z_stream));
+        bool strmOK = (inflateInit2(&strm, -15) == Z_OK);//raw deflate, the headers were already parsed
+#pragma omp for schedule(dynamic)
+        for (int64_t i = first; i < end; ++i)
+        {
+            const Block& thisBlock = m_blocks[i];
+            const unsigned char* member = compressed.data() + (thisBlock.m_inPos - inStart);
+            int32_t headerSize = 0;
+            Bytef* outPtr = (Bytef*)m_batch.data() + (thisBlock.m_outPos - outStart);
+            if (!strmOK || parseBgzfHeader(member, thisBlock.m_inSize, headerSize) != thisBlock.m_inSize)
+            {
+                failed = true;
+                continue;
+            }
+            inflateReset(&strm);
+            strm.next_in = (Bytef*)member + headerSize;
+            strm.avail_in = thisBlock.m_inSize - headerSize - 8;
+            strm.next_out = outPtr;
+            strm.avail_out = thisBlock.m_outSize;
+            if (inflate(&strm, Z_FINISH) != Z_STREAM_END || strm.avail_out != 0)
+            {
+                failed = true;
+                continue;
+            }
+            const unsigned char* trailer = member + thisBlock.m_inSize - 8;
+            uint32_t expectCRC = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((uint32_t)trailer[3] << 24);
+            if (crc32(crc32(0L, Z_NULL, 0), outPtr, thisBlock.m_outSize) != expectCRC) failed = true;
+        }
+        if (strmOK) inflateEnd(&strm);
     }
-    if (numRead == NULL)
+    if (failed) throw CiftiException("error while reading compressed file '" + m_fileName + "'");
+    m_batchFirst = first;
+    m_batchEnd = end;
+}
+
+void BgzfFileImpl::read(void* dataOut, const int64_t& count, int64_t* numRead)
+{
+    if (m_rawFile == NULL) throw CiftiException("read called on unopened BgzfFileImpl");//shouldn't happen
+    if (m_totalSize < 0) throw CiftiException("read called on compressed file '" + m_fileName + "' opened for writing");
+    int64_t totalRead = 0;
+    while (totalRead < count && m_curPos < m_totalSize)
     {
-        if (total != count)
+        int64_t batchOutStart = (m_batchEnd > m_batchFirst ? m_blocks[m_batchFirst].m_outPos : 0);
+        if (m_batchEnd == m_batchFirst || m_curPos < batchOutStart || m_curPos >= batchOutStart + (int64_t)m_batch.size())
         {
-            if (readret < 0) throw CiftiException("error while reading file '" + m_fileName + "'");
-            throw CiftiException("premature end of file in '" + m_fileName + "'");
+            int64_t first = findBlock(m_curPos), end = findBlock(min(m_curPos + count - totalRead, m_totalSize) - 1) + 1;//members needed for this read
+            bool readAhead = (m_pattern == BinaryFile::SEQUENTIAL || (m_pattern != BinaryFile::RANDOM && m_batchEnd > m_batchFirst && first == m_batchEnd));
+            if (readAhead) end = max(end, first + BATCH_BLOCKS);//sequential reading, also decompress the following members
+            decodeBatch(first, min(end, min(first + BATCH_BLOCKS, (int64_t)m_blocks.size())));
+            batchOutStart = m_blocks[m_batchFirst].m_outPos;
         }
+        int64_t offset = m_curPos - batchOutStart;
+        int64_t iterSize = min(count - totalRead, (int64_t)m_batch.size() - offset);
+        memcpy(((char*)dataOut) + totalRead, m_batch.data() + offset, iterSize);
+        totalRead += iterSize;
+        m_curPos += iterSize;
+    }
+    if (numRead == NULL)
+    {
+        if (totalRead != count) throw CiftiException("premature end of file in compressed file '" + m_fileName + "'");
     } else {
-        *numRead = total;
+        *numRead = totalRead;
     }
 }
 
-void QFileImpl::seek(const int64_t& position)
+void BgzfFileImpl::close()
 {
-    if (m_file.pos() == position) return; //QFile::seek always does a flush in qt5, so try to avoid calling it
-    if (!m_file.seek(position)) throw CiftiException("seek failed in file '" + m_fileName + "'");
+    if (m_rawFile == NULL) return;
+    boost::shared_ptr<BinaryFile::ImplInterface> temp = m_rawFile;
+    if (m_totalSize >= 0)
+    {//opened for reading
+        m_rawFile.reset();
+        m_blocks.clear();
+        m_batch.clear();
+        m_batchFirst = 0;
+        m_batchEnd = 0;
+        temp->close();
+        return;
+    }
+    try
+    {
+        flushBlocks(true);
+        m_rawFile->write(BGZF_EOF, sizeof(BGZF_EOF));//empty member, marks that the file wasn't truncated
+    } catch (...) {
+        m_rawFile.reset();
+        m_pending.clear();
+        temp->close();
+        throw;
+    }
+    m_rawFile.reset();
+    m_pending.clear();
+    temp->close();
 }
 
-int64_t QFileImpl::pos()
+void BgzfFileImpl::flushBlocks(const bool& final)
 {
-    return m_file.pos();
-}
-
+    int64_t numBlocks = m_pending.size() / BLOCK_DATA_SIZE;
+    if (final && (int64_t)m_pending.size() > numBlocks * BLOCK_DATA_SIZE) ++numBlocks;
+    if (numBlocks == 0) return;
+    vector<vector<unsigned char> > compressed(numBlocks);
+    bool failed = false;
+#pragma omp parallel
+    {
+        z_stream strm;
+        memset(&strm, 0, sizeof(z_stream));
+        bool strmOK = (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK);//raw deflate, we write the gzip header ourselves
+#pragma omp for schedule(dynamic)
+        for (int64_t i = 0; i < numBlocks; ++i)
+        {
+            if (!strmOK)
+            {
+                failed = true;
+                continue;
+            }
+            const unsigned char* blockIn = (const unsigned char*)m_pending.data() + i * BLOCK_DATA_SIZE;
+            uInt blockSize = (uInt)min(BLOCK_DATA_SIZE, (int64_t)m_pending.size() - i * BLOCK_DATA_SIZE);
+            vector<unsigned char>& blockOut = compressed[i];
+            blockOut.resize(18 + deflateBound(&strm, blockSize) + 8);
+            int level = Z_DEFAULT_COMPRESSION;
+            uLong deflatedSize = 0;
+            for (int attempt = 0; attempt < 2; ++attempt)
+            {
+                deflateReset(&strm);
+                if (attempt > 0) deflateParams(&strm, 0, Z_DEFAULT_STRATEGY);//incompressible data, store it instead
+                strm.next_in = (Bytef*)blockIn;
+                strm.avail_in = blockSize;
+                strm.next_out = blockOut.data() + 18;
+                strm.avail_out = blockOut.size() - 18 - 8;
+                if (deflate(&strm, Z_FINISH) != Z_STREAM_END)
+                {
+                    failed = true;
+                    break;
+                }
+                deflatedSize = strm.total_out;
+                if (18 + deflatedSize + 8 <= 65536) break;
+                level = 0;
+            }
+            if (level == 0) deflateParams(&strm, Z_DEFAULT_COMPRESSION, Z_DEFAULT_STRATEGY);
+            if (failed) continue;
+            int64_t memberSize = 18 + deflatedSize + 8;
+            const unsigned char header[12] = { 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0 };//FEXTRA, no mtime, unknown OS, extra length 6
+            memcpy(blockOut.data(), header, 12);
+            blockOut[12] = 'B';
+            blockOut[13] = 'C';
+            putLE(blockOut.data() + 14, 2, 2);
+            putLE(blockOut.data() + 16, memberSize - 1, 2);
+            putLE(blockOut.data() + 18 + deflatedSize, crc32(crc32(0L, Z_NULL, 0), blockIn, blockSize), 4);
+            putLE(blockOut.data() + 18 + deflatedSize + 4, blockSize, 4);
+            blockOut.resize(memberSize);
+        }
+        if (strmOK) deflateEnd(&strm);
+    }
+    if (failed) throw CiftiException("error compressing data for file '" + m_fileName + "'");
+    for (int64_t i = 0; i < numBlocks; ++i)
+    {
+        m_rawFile->write(compressed[i].data(), compressed[i].size());
+    }
+    int64_t consumed = min((int64_t)m_pending.size(), numBlocks * BLOCK_DATA_SIZE);
+    m_pending.erase(m_pending.begin(), m_pending.begin() + consumed);
+}
+
+void BgzfFileImpl::write(const void* dataIn, const int64_t& count)
+{
+    if (m_rawFile == NULL) throw CiftiException("write called on unopened BgzfFileImpl");//shouldn't happen
+    if (m_totalSize >= 0) throw CiftiException("write called on compressed file '" + m_fileName + "' opened for reading");
+    const char* charIn = (const char*)dataIn;
+    int64_t batchSize = BLOCK_DATA_SIZE * BATCH_BLOCKS, totalWritten = 0;
+    while (totalWritten < count)
+    {
+        int64_t iterSize = min(count - totalWritten, batchSize - (int64_t)m_pending.size());
+        m_pending.insert(m_pending.end(), charIn + totalWritten, charIn + totalWritten + iterSize);
+        totalWritten += iterSize;
+        if ((int64_t)m_pending.size() >= batchSize) flushBlocks(false);
+    }
+    m_curPos += count;
+}
+
+void BgzfFileImpl::seek(const int64_t& position)
+{
+    if (m_rawFile == NULL) throw CiftiException("seek called on unopened BgzfFileImpl");//shouldn't happen
+    if (m_totalSize >= 0)
+    {//reading has random access
+        m_curPos = position;
+        return;
+    }
+    if (position < m_curPos) throw CiftiException("seek failed in compressed file '" + m_fileName + "', can't seek backwards while writing");
+    if (position > m_curPos)
+    {//same as gzseek when writing, fill with zeros
+        vector<char> zeros(min(position - m_curPos, BLOCK_DATA_SIZE * BATCH_BLOCKS), 0);
+        while (m_curPos < position)
+        {
+            write(zeros.data(), min(position - m_curPos, (int64_t)zeros.size()));
+        }
+    }
+}
+
+int64_t BgzfFileImpl::pos()
+{
+    if (m_rawFile == NULL) throw CiftiException("pos called on unopened BgzfFileImpl");//shouldn't happen
+    return m_curPos;
+}
+
+void BgzfFileImpl::adviseAccess(const BinaryFile::AccessPattern& pattern, const int64_t&, const int64_t&)
+{
+    if (m_rawFile == NULL) return;
+    if (pattern == BinaryFile::WILL_NEED || pattern == BinaryFile::DONT_NEED) return;//uncompressed ranges don't map simply to the compressed file
+    m_pattern = pattern;
+    m_rawFile->adviseAccess(pattern, 0, 0);
+}
+
+BgzfFileImpl::~BgzfFileImpl()
+{
+    try//throwing from a destructor is a bad idea
+    {
+        close();
+    } catch (const CiftiException& e) {
+        cerr << AString_to_std_string(e.whatString()) << endl;
+    } catch (exception& e) {
+        cerr << e.what() << endl;
+    } catch (...) {
+        cerr << AString_to_std_string("caught unknown exception type while closing compressed file '" + m_fileName + "'") << endl;
+    }
+}
+
+#ifdef CIFTILIB_ZLIB_CHECKPOINTS
+void IndexedZFileImpl::open(const AString& filename, const BinaryFile::OpenMode& opmode)
+{
+    close();
+    m_fileName = filename;
+    if (opmode != BinaryFile::READ) throw CiftiException("indexed compressed file only supports READ mode");
+    boost::shared_ptr<BinaryFile::ImplInterface> rawFile = makeUncompressedImpl();
+    try
+    {
+        rawFile->open(filename, opmode);
+    } catch (CiftiException& e) {
+        throw CiftiException("failed to open compressed file '" + filename + "': " + e.whatString());
+    }
+    m_rawFile = rawFile;
+    m_rawSize = m_rawFile->size();
+    m_index.clear();
+    m_indexComplete = false;
+    m_indexLoaded = false;
+    m_totalSize = -1;
+    loadIndex();
+    restart(m_decoder, NULL);
+    m_curPos = 0;
+}
+
+void IndexedZFileImpl::close()
+{
+    if (m_rawFile == NULL) return;
+    if (s_saveCompressedIndexes && m_indexComplete && !m_indexLoaded && !m_index.empty())
+    {
+        saveIndex();
+    }
+    if (m_decoder.m_strmInit) inflateEnd(&m_decoder.m_strm);
+    m_decoder.m_strmInit = false;
+    m_index.clear();
+    boost::shared_ptr<BinaryFile::ImplInterface> temp = m_rawFile;
+    m_rawFile.reset();
+    temp->close();
+}
+
+void IndexedZFileImpl::restart(Decoder& dec, const Checkpoint* from)
+{
+    if (dec.m_strmInit) inflateEnd(&dec.m_strm);
+    dec.m_strmInit = false;
+    memset(&dec.m_strm, 0, sizeof(z_stream));
+    dec.m_streamEnded = false;
+    dec.m_inBuf.resize(IN_BUF_SIZE);
+    if (from == NULL || from->m_window.empty())
+    {//start of a gzip member, let zlib parse the header
+        if (inflateInit2(&dec.m_strm, 47) != Z_OK) throw CiftiException("failed to initialize zlib for file '" + m_fileName + "'");//47 is 32 + 15: detect header, max window size
+        dec.m_rawMode = false;
+        dec.m_inPos = (from == NULL ? 0 : from->m_inPos);
+        dec.m_decodePos = (from == NULL ? 0 : from->m_outPos);
+        dec.m_strmInit = true;
+    } else {
+        if (inflateInit2(&dec.m_strm, -15) != Z_OK) throw CiftiException("failed to initialize zlib for file '" + m_fileName + "'");//raw deflate, as we start mid-stream
+        dec.m_strmInit = true;
+        dec.m_rawMode = true;
+        dec.m_inPos = from->m_inPos;
+        dec.m_decodePos = from->m_outPos;
+        if (from->m_bits != 0)
+        {
+            unsigned char partial;
+            m_rawFile->readAt(from->m_inPos - 1, &partial, 1, NULL);
+            inflatePrime(&dec.m_strm, from->m_bits, partial >> (8 - from->m_bits));
+        }
+        inflateSetDictionary(&dec.m_strm, from->m_window.data(), from->m_window.size());
+    }
+}
+
+int64_t IndexedZFileImpl::firstCheckpointAfter(const int64_t& position) const
+{
+    int64_t low = 0, high = (int64_t)m_index.size();
+    while (low < high)
+    {
+        int64_t mid = (low + high) / 2;
+        if (m_index[mid].m_outPos <= position)
+        {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+void IndexedZFileImpl::reposition(const int64_t& target)
+{
+    const Checkpoint* best = NULL;//find last checkpoint at or before target
+    int64_t after = firstCheckpointAfter(target);
+    if (after > 0) best = &(m_index[after - 1]);
+    if (target < m_decoder.m_decodePos || (best != NULL && best->m_outPos > m_decoder.m_decodePos))
+    {
+        restart(m_decoder, best);
+    }
+    vector<char> discard(min(target - m_decoder.m_decodePos, (int64_t)1<<20));
+    while (m_decoder.m_decodePos < target && !m_decoder.m_streamEnded)
+    {
+        decode(m_decoder, discard.data(), min(target - m_decoder.m_decodePos, (int64_t)discard.size()), true);
+    }
+}
+
+int64_t IndexedZFileImpl::fill(Decoder& dec)
+{
+    int64_t numRead = 0;
+    m_rawFile->readAt(dec.m_inPos, dec.m_inBuf.data(), dec.m_inBuf.size(), &numRead);
+    dec.m_inPos += numRead;
+    dec.m_strm.next_in = dec.m_inBuf.data();
+    dec.m_strm.avail_in = numRead;
+    return numRead;
+}
+
+int64_t IndexedZFileImpl::decode(Decoder& dec, char* out, const int64_t& count, const bool& record)
+{
+    int64_t total = 0;
+    while (total < count && !dec.m_streamEnded)
+    {
+        if (dec.m_strm.avail_in == 0 && fill(dec) == 0)
+        {//truncated compressed data, treat like end of file, read() will complain if needed
+            dec.m_streamEnded = true;
+            break;
+        }
+        uInt iterSize = (uInt)min(count - total, CHUNK_SIZE);
+        dec.m_strm.next_out = (Bytef*)(out + total);
+        dec.m_strm.avail_out = iterSize;
+        int ret = inflate(&dec.m_strm, Z_BLOCK);//stop at block boundaries, so we can make checkpoints
+        int64_t produced = iterSize - dec.m_strm.avail_out;
+        total += produced;
+        dec.m_decodePos += produced;
+        if (ret == Z_STREAM_END)
+        {
+            finishMember(dec, record);
+            continue;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) throw CiftiException("error while reading compressed file '" + m_fileName + "'");
+        if ((dec.m_strm.data_type & 128) && !(dec.m_strm.data_type & 64) && record && !m_indexLoaded)//at end of a block that isn't the last block
+        {
+            if (dec.m_decodePos - (m_index.empty() ? 0 : m_index.back().m_outPos) >= CHECKPOINT_SPAN) addCheckpoint(dec);
+        }
+    }
+    if (record && !m_indexLoaded)
+    {//reading exactly to the end of the data fills the output before zlib reports the end of the stream, and seeking back would lose the chance to see it,
+        //so let zlib continue without output space, which gets through the end of the stream, or stops at the next literal or match
+        Bytef unused;
+        while (!dec.m_streamEnded && (dec.m_strm.avail_in != 0 || fill(dec) != 0))
+        {
+            uInt availBefore = dec.m_strm.avail_in;
+            dec.m_strm.next_out = &unused;
+            dec.m_strm.avail_out = 0;
+            int ret = inflate(&dec.m_strm, Z_BLOCK);
+            if (ret == Z_STREAM_END)
+            {
+                finishMember(dec, record);
+                continue;
+            }
+            if (ret != Z_OK && ret != Z_BUF_ERROR) throw CiftiException("error while reading compressed file '" + m_fileName + "'");
+            if ((dec.m_strm.data_type & 128) && !(dec.m_strm.data_type & 64))
+            {
+                if (dec.m_decodePos - (m_index.empty() ? 0 : m_index.back().m_outPos) >= CHECKPOINT_SPAN) addCheckpoint(dec);
+            }
+            if (dec.m_strm.avail_in == availBefore) break;//needs output space, so this isn't the end
+        }
+    }
+    return total;
+}
+
+void IndexedZFileImpl::finishMember(Decoder& dec, const bool& record)
+{
+    int64_t next = dec.m_inPos - dec.m_strm.avail_in;//first byte not consumed
+    if (dec.m_rawMode) next += 8;//raw inflate doesn't read the gzip trailer
+    unsigned char magic[2];
+    int64_t numRead = 0;
+    m_rawFile->readAt(next, magic, 2, &numRead);
+    if (numRead == 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+    {//another gzip member follows, as in concatenated .gz files
+        if (inflateReset2(&dec.m_strm, 47) != Z_OK) throw CiftiException("failed to reset zlib for file '" + m_fileName + "'");
+        dec.m_rawMode = false;
+        dec.m_strm.avail_in = 0;
+        dec.m_inPos = next;
+        if (record && !m_indexLoaded && dec.m_decodePos - (m_index.empty() ? 0 : m_index.back().m_outPos) >= CHECKPOINT_SPAN)
+        {//member boundaries make free checkpoints
+            Checkpoint temp;
+            temp.m_outPos = dec.m_decodePos;
+            temp.m_inPos = next;
+            temp.m_bits = 0;
+            m_index.push_back(temp);
+        }
+    } else {//anything else after a member is ignored, like gzip does with trailing zeros
+        dec.m_streamEnded = true;
+        if (record)
+        {
+            m_totalSize = dec.m_decodePos;
+            if (!m_indexLoaded) m_indexComplete = true;//we always decode contiguously from a checkpoint, so reaching the end means every span has a checkpoint
+        }
+    }
+}
+
+void IndexedZFileImpl::addCheckpoint(Decoder& dec)
+{
+    Checkpoint temp;
+    temp.m_outPos = dec.m_decodePos;
+    temp.m_inPos = dec.m_inPos - dec.m_strm.avail_in;
+    temp.m_bits = dec.m_strm.data_type & 7;
+    temp.m_window.resize(32768);
+    uInt windowSize = 32768;
+    if (inflateGetDictionary(&dec.m_strm, temp.m_window.data(), &windowSize) != Z_OK || windowSize == 0) return;//empty window would look like a member start
+    temp.m_window.resize(windowSize);
+    m_index.push_back(temp);
+}
+
+uint64_t IndexedZFileImpl::fileSignature()
+{//gzip trailer of the last member has a crc and length, combine with file size to detect a changed file
+    uint64_t ret = 0;
+    if (m_rawSize >= 8) m_rawFile->readAt(m_rawSize - 8, &ret, 8, NULL);
+    return ret;
+}
+
+namespace
+{
+    const char INDEX_MAGIC[8] = { 'C', 'I', 'F', 'T', 'I', 'Z', 'X', 1 };
+}
+
+void IndexedZFileImpl::loadIndex()
+{
+    if (m_rawSize < 0) return;
+    try
+    {
+        boost::shared_ptr<BinaryFile::ImplInterface> indexFile = makeUncompressedImpl();
+        try
+        {
+            indexFile->open(indexFileName(), BinaryFile::READ);
+        } catch (CiftiException&) {
+            return;//no index file is normal
+        }
+        char magic[8];
+        int64_t header[5];//raw size, signature, span, total size, number of checkpoints
+        indexFile->read(magic, 8, NULL);
+        indexFile->read(header, sizeof(header), NULL);
+        if (memcmp(magic, INDEX_MAGIC, 8) != 0 || header[0] != m_rawSize || (uint64_t)header[1] != fileSignature()) return;//different file, or different endianness
+        const int64_t entryBytes = 2 * sizeof(int64_t) + 2 * sizeof(int32_t);//not counting the window
+        int64_t indexSize = indexFile->size();
+        if (indexSize < 0 || header[3] < 0 || header[4] < 0 || header[4] > (indexSize - 8 - (int64_t)sizeof(header)) / entryBytes) return;//corrupt, don't trust the count enough to allocate it
+        vector<Checkpoint> newIndex(header[4]);
+        for (int64_t i = 0; i < header[4]; ++i)
+        {
+            int64_t positions[2];
+            int32_t sizes[2];
+            indexFile->read(positions, sizeof(positions), NULL);
+            indexFile->read(sizes, sizeof(sizes), NULL);
+            if (sizes[1] < 0 || sizes[1] > 32768 || sizes[0] < 0 || sizes[0] > 7) return;
+            if (positions[0] < 0 || positions[0] > header[3] || positions[1] < 0 || positions[1] > m_rawSize) return;
+            if (i > 0 && (positions[0] <= newIndex[i - 1].m_outPos || positions[1] <= newIndex[i - 1].m_inPos)) return;//checkpoints are recorded in order
+            newIndex[i].m_outPos = positions[0];
+            newIndex[i].m_inPos = positions[1];
+            newIndex[i].m_bits = sizes[0];
+            newIndex[i].m_window.resize(sizes[1]);
+            if (sizes[1] > 0) indexFile->read(newIndex[i].m_window.data(), sizes[1], NULL);
+        }
+        m_index.swap(newIndex);
+        m_totalSize = header[3];
+        m_indexLoaded = true;
+        m_indexComplete = true;
+    } catch (CiftiException&) {//truncated or unreadable index file, just don't use it
+    }
+}
+
+void IndexedZFileImpl::saveIndex()
+{
+    try
+    {
+        boost::shared_ptr<BinaryFile::ImplInterface> indexFile = makeUncompressedImpl();
+        indexFile->open(indexFileName(), BinaryFile::WRITE_TRUNCATE);
+        int64_t header[5] = { m_rawSize, (int64_t)fileSignature(), CHECKPOINT_SPAN, m_totalSize, (int64_t)m_index.size() };
+        indexFile->write(INDEX_MAGIC, 8);
+        indexFile->write(header, sizeof(header));
+        for (size_t i = 0; i < m_index.size(); ++i)
+        {
+            int64_t positions[2] = { m_index[i].m_outPos, m_index[i].m_inPos };
+            int32_t sizes[2] = { m_index[i].m_bits, (int32_t)m_index[i].m_window.size() };
+            indexFile->write(positions, sizeof(positions));
+            indexFile->write(sizes, sizeof(sizes));
+            if (!m_index[i].m_window.empty()) indexFile->write(m_index[i].m_window.data(), m_index[i].m_window.size());
+        }
+        indexFile->close();
+    } catch (CiftiException& e) {//the index is only an optimization, so don't fail because of it
+        if (s_warnCompressedIndexes) cerr << AString_to_std_string("warning: unable to save index for compressed file '" + m_fileName + "': " + e.whatString()) << endl;
+    }
+}
+
+void IndexedZFileImpl::read(void* dataOut, const int64_t& count, int64_t* numRead)
+{
+    if (m_rawFile == NULL) throw CiftiException("read called on unopened IndexedZFileImpl");//shouldn't happen
+    char* charOut = (char*)dataOut;
+    int64_t totalRead = 0;
+    int64_t firstInside = firstCheckpointAfter(m_curPos), endInside = firstCheckpointAfter(m_curPos + count - 1);//checkpoints strictly inside the requested range, the spans between them can be decompressed independently
+    if (endInside - firstInside > 1)
+    {
+        int64_t headSize = m_index[firstInside].m_outPos - m_curPos;
+        if (m_curPos != m_decoder.m_decodePos) reposition(m_curPos);
+        if (headSize > 0 && decode(m_decoder, charOut, headSize, true) != headSize) throw CiftiException("error while reading compressed file '" + m_fileName + "'");
+        bool failed = false;
+#pragma omp parallel for schedule(dynamic)
+        for (int64_t i = firstInside; i < endInside - 1; ++i)
+        {
+            try
+            {
+                Decoder spanDecoder;
+                restart(spanDecoder, &(m_index[i]));
+                int64_t spanSize = m_index[i + 1].m_outPos - m_index[i].m_outPos;
+                if (decode(spanDecoder, charOut + (m_index[i].m_outPos - m_curPos), spanSize, false) != spanSize) failed = true;
+            } catch (CiftiException&) {//can't throw out of an openmp loop
+                failed = true;
+            }
+        }
+        if (failed) throw CiftiException("error while reading compressed file '" + m_fileName + "'");
+        totalRead = m_index[endInside - 1].m_outPos - m_curPos;
+        m_curPos += totalRead;//the main decoder restarts from the last checkpoint for the rest
+    }
+    if (m_curPos != m_decoder.m_decodePos) reposition(m_curPos);
+    if (m_curPos == m_decoder.m_decodePos)
+    {//if the seek was past the end, there is nothing to read
+        int64_t tailRead = decode(m_decoder, charOut + totalRead, count - totalRead, true);
+        totalRead += tailRead;
+        m_curPos += tailRead;
+    }
+    if (numRead == NULL)
+    {
+        if (totalRead != count) throw CiftiException("premature end of file in compressed file '" + m_fileName + "'");
+    } else {
+        *numRead = totalRead;
+    }
+}
+
+void IndexedZFileImpl::seek(const int64_t& position)
+{
+    if (m_rawFile == NULL) throw CiftiException("seek called on unopened IndexedZFileImpl");//shouldn't happen
+    m_curPos = position;//the decoder catches up when reading, so seeking and then seeking back costs nothing
+}
+
+int64_t IndexedZFileImpl::pos()
+{
+    if (m_rawFile == NULL) throw CiftiException("pos called on unopened IndexedZFileImpl");//shouldn't happen
+    return m_curPos;
+}
+
+void IndexedZFileImpl::write(const void*, const int64_t&)
+{
+    throw CiftiException("write called on compressed file '" + m_fileName + "' opened for reading");
+}
+
+void IndexedZFileImpl::adviseAccess(const BinaryFile::AccessPattern& pattern, const int64_t&, const int64_t&)
+{
+    if (m_rawFile == NULL) return;
+    if (pattern == BinaryFile::WILL_NEED || pattern == BinaryFile::DONT_NEED) return;//uncompressed ranges don't map simply to the compressed file
+    m_rawFile->adviseAccess(pattern, 0, 0);
+}
+
+IndexedZFileImpl::~IndexedZFileImpl()
+{
+    try//throwing from a destructor is a bad idea
+    {
+        close();
+    } catch (const CiftiException& e) {
+        cerr << AString_to_std_string(e.whatString()) << endl;
+    } catch (exception& e) {
+        cerr << e.what() << endl;
+    } catch (...) {
+        cerr << AString_to_std_string("caught unknown exception type while closing compressed file '" + m_fileName + "'") << endl;
+    }
+}
+#endif //CIFTILIB_ZLIB_CHECKPOINTS
+#endif //ZLIB_VERSION
+
+#ifdef CIFTILIB_HAVE_ZSTD
+namespace
+{
+    const uint32_t ZSTD_SEEK_TABLE_MAGIC = 0x184D2A5E;//skippable frame magic number reserved for the seek table
+    const uint32_t ZSTD_SEEKABLE_MAGIC = 0x8F92EAB1;//last 4 bytes of a seekable file
+    const int64_t ZSTD_SEEK_FOOTER_SIZE = 9;//number of frames, descriptor byte, magic
+    
+    uint32_t getLE32(const unsigned char* in)
+    {
+        return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+    }
+    
+    void putLE32(unsigned char* out, const uint32_t& value)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            out[i] = (unsigned char)(value >> (8 * i));
+        }
+    }
+}
+
+void ZstdFileImpl::open(const AString& filename, const BinaryFile::OpenMode& opmode)
+{
+    close();
+    m_fileName = filename;
+    if (opmode != BinaryFile::READ && opmode != BinaryFile::WRITE_TRUNCATE) throw CiftiException("compressed file only supports READ and WRITE_TRUNCATE modes");
+    boost::shared_ptr<BinaryFile::ImplInterface> rawFile = makeUncompressedImpl();
+    try
+    {
+        rawFile->open(filename, opmode);
+    } catch (CiftiException& e) {
+        throw CiftiException("failed to open compressed file '" + filename + "': " + e.whatString());
+    }
+    m_rawFile = rawFile;
+    m_curPos = 0;
+    m_rawPos = 0;
+    m_batchFirst = 0;
+    m_batchEnd = 0;
+    m_frames.clear();
+    if (opmode == BinaryFile::READ)
+    {
+        try
+        {
+            readSeekTable();
+        } catch (...) {
+            m_rawFile.reset();
+            throw;
+        }
+    } else {
+        m_totalSize = -1;
+        m_pending.clear();
+        m_pending.reserve(FRAME_DATA_SIZE * BATCH_FRAMES);
+    }
+}
+
+void ZstdFileImpl::readSeekTable()
+{//the seek table is at the end of the file, so opening doesn't need to look at any frames
+    int64_t rawSize = m_rawFile->size();
+    unsigned char footer[ZSTD_SEEK_FOOTER_SIZE];
+    if (rawSize >= 8 + ZSTD_SEEK_FOOTER_SIZE) m_rawFile->readAt(rawSize - ZSTD_SEEK_FOOTER_SIZE, footer, ZSTD_SEEK_FOOTER_SIZE, NULL);
+    if (rawSize < 8 + ZSTD_SEEK_FOOTER_SIZE || getLE32(footer + 5) != ZSTD_SEEKABLE_MAGIC || (footer[4] & 0x7c) != 0)
+    {
+        throw CiftiException("file '" + m_fileName + "' is not in the zstd seekable format, it must be written by this library or zstd's seekable format tools");
+    }
+    int64_t numFrames = getLE32(footer);
+    int64_t entrySize = ((footer[4] & 0x80) ? 12 : 8);//optional per-frame checksums aren't checked here, zstd checks the frames' own checksums when present
+    int64_t tableSize = numFrames * entrySize + ZSTD_SEEK_FOOTER_SIZE;
+    if (8 + tableSize > rawSize) throw CiftiException("invalid seek table in zstd file '" + m_fileName + "'");
+    vector<unsigned char> table(8 + tableSize);
+    m_rawFile->readAt(rawSize - (int64_t)table.size(), table.data(), table.size(), NULL);
+    if (getLE32(table.data()) != ZSTD_SEEK_TABLE_MAGIC || getLE32(table.data() + 4) != tableSize) throw CiftiException("invalid seek table in zstd file '" + m_fileName + "'");
+    int64_t inPos = 0, outPos = 0;
+    for (int64_t i = 0; i < numFrames; ++i)
+    {
+        const unsigned char* entry = table.data() + 8 + i * entrySize;
+        Frame temp;
+        temp.m_inPos = inPos;
+        temp.m_inSize = getLE32(entry);
+        temp.m_outPos = outPos;
+        temp.m_outSize = getLE32(entry + 4);
+        if (temp.m_outSize > 0) m_frames.push_back(temp);
+        inPos += temp.m_inSize;
+        outPos += temp.m_outSize;
+    }
+    if (inPos != rawSize - (int64_t)table.size()) throw CiftiException("seek table in zstd file '" + m_fileName + "' doesn't match the file size, file may be truncated");
+    m_totalSize = outPos;
+}
+
+int64_t ZstdFileImpl::findFrame(const int64_t& position) const
+{//last frame starting at or before position
+    int64_t low = 0, high = (int64_t)m_frames.size();
+    while (low < high)
+    {
+        int64_t mid = (low + high) / 2;
+        if (m_frames[mid].m_outPos <= position)
+        {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low - 1;
+}
+
+void ZstdFileImpl::decodeBatch(const int64_t& first, const int64_t& end)
+{
+    CiftiAssert(first >= 0 && first < end && end <= (int64_t)m_frames.size());
+    const Frame& lastFrame = m_frames[end - 1];
+    int64_t inStart = m_frames[first].m_inPos, outStart = m_frames[first].m_outPos;
+    vector<char> compressed(lastFrame.m_inPos + lastFrame.m_inSize - inStart);
+    m_rawFile->readAt(inStart, compressed.data(), compressed.size(), NULL);//frames are contiguous, except for empty ones
+    m_batchFirst = 0;
+    m_batchEnd = 0;//in case of error
+    m_batch.resize(lastFrame.m_outPos + lastFrame.m_outSize - outStart);
+    bool failed = false;
+#pragma omp parallel
+    {
+        ZSTD_DCtx* dctx = ZSTD_createDCtx();
+#pragma omp for schedule(dynamic)
+        for (int64_t i = first; i < end; ++i)
+        {
+            const Frame& thisFrame = m_frames[i];
+            if (dctx == NULL)
+            {
+                failed = true;
+                continue;
+            }
+            size_t result = ZSTD_decompressDCtx(dctx, m_batch.data() + (thisFrame.m_outPos - outStart), thisFrame.m_outSize,
+                                                compressed.data() + (thisFrame.m_inPos - inStart), thisFrame.m_inSize);
+            if (ZSTD_isError(result) || (int64_t)result != thisFrame.m_outSize) failed = true;
+        }
+        ZSTD_freeDCtx(dctx);//accepts NULL
+    }
+    if (failed) throw CiftiException("error while reading compressed file '" + m_fileName + "'");
+    m_batchFirst = first;
+    m_batchEnd = end;
+}
+
+void ZstdFileImpl::read(void* dataOut, const int64_t& count, int64_t* numRead)
+{
+    if (m_rawFile == NULL) throw CiftiException("read called on unopened ZstdFileImpl");//shouldn't happen
+    if (m_totalSize < 0) throw CiftiException("read called on compressed file '" + m_fileName + "' opened for writing");
+    int64_t totalRead = 0;
+    while (totalRead < count && m_curPos < m_totalSize)
+    {
+        int64_t batchOutStart = (m_batchEnd > m_batchFirst ? m_frames[m_batchFirst].m_outPos : 0);
+        if (m_batchEnd == m_batchFirst || m_curPos < batchOutStart || m_curPos >= batchOutStart + (int64_t)m_batch.size())
+        {
+            int64_t first = findFrame(m_curPos), end = findFrame(min(m_curPos + count - totalRead, m_totalSize) - 1) + 1;//frames needed for this read
+            bool readAhead = (m_pattern == BinaryFile::SEQUENTIAL || (m_pattern != BinaryFile::RANDOM && m_batchEnd > m_batchFirst && first == m_batchEnd));
+            if (readAhead) end = max(end, first + BATCH_FRAMES);//sequential reading, also decompress the following frames
+            decodeBatch(first, min(end, min(first + BATCH_FRAMES, (int64_t)m_frames.size())));
+            batchOutStart = m_frames[m_batchFirst].m_outPos;
+        }
+        int64_t offset = m_curPos - batchOutStart;
+        int64_t iterSize = min(count - totalRead, (int64_t)m_batch.size() - offset);
+        memcpy(((char*)dataOut) + totalRead, m_batch.data() + offset, iterSize);
+        totalRead += iterSize;
+        m_curPos += iterSize;
+    }
+    if (numRead == NULL)
+    {
+        if (totalRead != count) throw CiftiException("premature end of file in compressed file '" + m_fileName + "'");
+    } else {
+        *numRead = totalRead;
+    }
+}
+
+void ZstdFileImpl::close()
+{
+    if (m_rawFile == NULL) return;
+    boost::shared_ptr<BinaryFile::ImplInterface> temp = m_rawFile;
+    if (m_totalSize >= 0)
+    {//opened for reading
+        m_rawFile.reset();
+        m_frames.clear();
+        m_batch.clear();
+        m_batchFirst = 0;
+        m_batchEnd = 0;
+        temp->close();
+        return;
+    }
+    try
+    {
+        flushFrames(true);
+        writeSeekTable();
+    } catch (...) {
+        m_rawFile.reset();
+        m_pending.clear();
+        m_frames.clear();
+        temp->close();
+        throw;
+    }
+    m_rawFile.reset();
+    m_pending.clear();
+    m_frames.clear();
+    temp->close();
+}
+
+void ZstdFileImpl::flushFrames(const bool& final)
+{
+    int64_t numFrames = m_pending.size() / FRAME_DATA_SIZE;
+    if (final && (int64_t)m_pending.size() > numFrames * FRAME_DATA_SIZE) ++numFrames;
+    if (numFrames == 0) return;
+    vector<vector<char> > compressed(numFrames);
+    bool failed = false;
+#pragma omp parallel
+    {
+        ZSTD_CCtx* cctx = ZSTD_createCCtx();
+        bool cctxOK = (cctx != NULL && !ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, COMPRESSION_LEVEL)) &&
+                       !ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1)));//the frame checksum lets the seek table skip its optional checksums
+#pragma omp for schedule(dynamic)
+        for (int64_t i = 0; i < numFrames; ++i)
+        {
+            if (!cctxOK)
+            {
+                failed = true;
+                continue;
+            }
+            const char* frameIn = m_pending.data() + i * FRAME_DATA_SIZE;
+            size_t frameSize = (size_t)min(FRAME_DATA_SIZE, (int64_t)m_pending.size() - i * FRAME_DATA_SIZE);
+            vector<char>& frameOut = compressed[i];
+            frameOut.resize(ZSTD_compressBound(frameSize));
+            size_t result = ZSTD_compress2(cctx, frameOut.data(), frameOut.size(), frameIn, frameSize);
+            if (ZSTD_isError(result))
+            {
+                failed = true;
+                continue;
+            }
+            frameOut.resize(result);
+        }
+        ZSTD_freeCCtx(cctx);//accepts NULL
+    }
+    if (failed) throw CiftiException("error compressing data for file '" + m_fileName + "'");
+    int64_t outPos = (m_frames.empty() ? 0 : m_frames.back().m_outPos + m_frames.back().m_outSize);
+    for (int64_t i = 0; i < numFrames; ++i)
+    {
+        m_rawFile->write(compressed[i].data(), compressed[i].size());
+        Frame temp;
+        temp.m_inPos = m_rawPos;
+        temp.m_inSize = compressed[i].size();
+        temp.m_outPos = outPos;
+        temp.m_outSize = min(FRAME_DATA_SIZE, (int64_t)m_pending.size() - i * FRAME_DATA_SIZE);
+        m_frames.push_back(temp);
+        m_rawPos += temp.m_inSize;
+        outPos += temp.m_outSize;
+    }
+    int64_t consumed = min((int64_t)m_pending.size(), numFrames * FRAME_DATA_SIZE);
+    m_pending.erase(m_pending.begin(), m_pending.begin() + consumed);
+}
+
+void ZstdFileImpl::writeSeekTable()
+{
+    int64_t numFrames = (int64_t)m_frames.size();
+    int64_t tableSize = numFrames * 8 + ZSTD_SEEK_FOOTER_SIZE;
+    if (tableSize > (int64_t)numeric_limits<uint32_t>::max()) throw CiftiException("compressed file '" + m_fileName + "' has too many frames for a zstd seek table");
+    vector<unsigned char> table(8 + tableSize);
+    putLE32(table.data(), ZSTD_SEEK_TABLE_MAGIC);
+    putLE32(table.data() + 4, tableSize);
+    for (int64_t i = 0; i < numFrames; ++i)
+    {
+        unsigned char* entry = table.data() + 8 + i * 8;
+        putLE32(entry, m_frames[i].m_inSize);
+        putLE32(entry + 4, m_frames[i].m_outSize);
+    }
+    unsigned char* footer = table.data() + 8 + numFrames * 8;
+    putLE32(footer, numFrames);
+    footer[4] = 0;//no per-frame checksums in the table
+    putLE32(footer + 5, ZSTD_SEEKABLE_MAGIC);
+    m_rawFile->write(table.data(), table.size());
+}
+
+void ZstdFileImpl::write(const void* dataIn, const int64_t& count)
+{
+    if (m_rawFile == NULL) throw CiftiException("write called on unopened ZstdFileImpl");//shouldn't happen
+    if (m_totalSize >= 0) throw CiftiException("write called on compressed file '" + m_fileName + "' opened for reading");
+    const char* charIn = (const char*)dataIn;
+    int64_t batchSize = FRAME_DATA_SIZE * BATCH_FRAMES, totalWritten = 0;
+    while (totalWritten < count)
+    {
+        int64_t iterSize = min(count - totalWritten, batchSize - (int64_t)m_pending.size());
+        m_pending.insert(m_pending.end(), charIn + totalWritten, charIn + totalWritten + iterSize);
+        totalWritten += iterSize;
+        if ((int64_t)m_pending.size() >= batchSize) flushFrames(false);
+    }
+    m_curPos += count;
+}
+
+void ZstdFileImpl::seek(const int64_t& position)
+{
+    if (m_rawFile == NULL) throw CiftiException("seek called on unopened ZstdFileImpl");//shouldn't happen
+    if (m_totalSize >= 0)
+    {//reading has random access
+        m_curPos = position;
+        return;
+    }
+    if (position < m_curPos) throw CiftiException("seek failed in compressed file '" + m_fileName + "', can't seek backwards while writing");
+    if (position > m_curPos)
+    {//fill with zeros, like the gzip implementations
+        vector<char> zeros(min(position - m_curPos, FRAME_DATA_SIZE * BATCH_FRAMES), 0);
+        while (m_curPos < position)
+        {
+            write(zeros.data(), min(position - m_curPos, (int64_t)zeros.size()));
+        }
+    }
+}
+
+int64_t ZstdFileImpl::pos()
+{
+    if (m_rawFile == NULL) throw CiftiException("pos called on unopened ZstdFileImpl");//shouldn't happen
+    return m_curPos;
+}
+
+void ZstdFileImpl::adviseAccess(const BinaryFile::AccessPattern& pattern, const int64_t&, const int64_t&)
+{
+    if (m_rawFile == NULL) return;
+    if (pattern == BinaryFile::WILL_NEED || pattern == BinaryFile::DONT_NEED) return;//uncompressed ranges don't map simply to the compressed file
+    m_pattern = pattern;
+    m_rawFile->adviseAccess(pattern, 0, 0);
+}
+
+ZstdFileImpl::~ZstdFileImpl()
+{
+    try//throwing from a destructor is a bad idea
+    {
+        close();
+    } catch (const CiftiException& e) {
+        cerr << AString_to_std_string(e.whatString()) << endl;
+    } catch (exception& e) {
+        cerr << e.what() << endl;
+    } catch (...) {
+        cerr << AString_to_std_string("caught unknown exception type while closing compressed file '" + m_fileName + "'") << endl;
+    }
+}
+#endif //CIFTILIB_HAVE_ZSTD
+
+#ifdef CIFTILIB_USE_QT
+
+void QFileImpl::open(const AString& filename, const BinaryFile::OpenMode& opmode)
+{
+    close();//don't need to, but just because
+    m_fileName = filename;
+    QIODevice::OpenMode mode = QIODevice::NotOpen;//means 0
+    if (opmode & BinaryFile::READ) mode |= QIODevice::ReadOnly;
+    if (opmode & BinaryFile::WRITE) mode |= QIODevice::WriteOnly;
+    if (opmode & BinaryFile::TRUNCATE) mode |= QIODevice::Truncate;//expect QFile to recognize silliness like TRUNCATE by itself
+    m_file.setFileName(filename);
+    if (!m_file.open(mode))
+    {
+        if (!m_file.exists())
+        {
+            if (!(opmode & BinaryFile::TRUNCATE))
+            {
+                throw CiftiException("failed to open file '" + filename + "', file does not exist, or folder permissions prevent seeing it");
+            } else {//m_file.error() doesn't help identify this case, see below
+                throw CiftiException("failed to open file '" + filename + "', unable to create file");
+            }
+        }
+        switch (m_file.error())
+        {
+            case QFile::ResourceError://on linux at least, it never gives another code besides the unhelpful OpenError
+                throw CiftiException("failed to open file '" + filename + "', too many open files");
+            default:
+                throw CiftiException("failed to open file '" + filename + "'");
+        }
+    }
+}
+
+void QFileImpl::close()
+{
+    if (!m_file.isOpen()) return; //not sure what flush() does if file isn't open, so let's not try it
+    //WARNING: QFileDevice::close() calls flush, ignores if it fails, then closes
+    //so flush manually and check its error condition instead
+    if (!m_file.flush()) throw CiftiException("failed to flush file '" + m_file.fileName() + "' before closing, data may be corrupted");
+    m_file.close();
+}
+
+void QFileImpl::read(void* dataOut, const int64_t& count, int64_t* numRead)
+{
+    int64_t total = 0;
+    int64_t readret = -1;
+    while (total < count)
+    {
+        int64_t maxToRead = min(count - total, CHUNK_SIZE);
+        readret = m_file.read(((char*)dataOut) + total, maxToRead);//QFile chokes on large reads also
+        if (readret < 1) break;//0 or -1 means error or eof
+        total += readret;
+    }
+    if (numRead == NULL)
+    {
+        if (total != count)
+        {
+            if (readret < 0) throw CiftiException("error while reading file '" + m_fileName + "'");
+            throw CiftiException("premature end of file in '" + m_fileName + "'");
+        }
+    } else {
+        *numRead = total;
+    }
+}
+
+void QFileImpl::seek(const int64_t& position)
+{
+    if (m_file.pos() == position) return; //QFile::seek always does a flush in qt5, so try to avoid calling it
+    if (!m_file.seek(position)) throw CiftiException("seek failed in file '" + m_fileName + "'");
+}
+
+int64_t QFileImpl::pos()
+{
+    return m_file.pos();
+}
+
 void QFileImpl::write(const void* dataIn, const int64_t& count)
 {
     int64_t total = 0;
-    int64_t writeret = -1;
+    int64_t writeret = -1;
+    while (total < count)
+    {
+        int64_t maxToWrite = min(count - total, CHUNK_SIZE);
+        writeret = m_file.write(((const char*)dataIn) + total, maxToWrite);//QFile probably also chokes on large writes
+        if (writeret < 1) break;//0 or -1 means error or eof
+        total += writeret;
+    }
+    if (total != count) throw CiftiException("failed to write to file '" + m_fileName + "'");
+}
+
+#else //CIFTILIB_USE_QT
+
+void StrFileImpl::open(const AString& filename, const BinaryFile::OpenMode& opmode)
+{
+    close();
+    m_fileName = filename;
+    const char* mode = NULL;
+    switch (opmode)
+    {
+        case BinaryFile::READ:
+            mode = "rb";
+            break;
+        case BinaryFile::READ_WRITE:
+            mode = "r+b";
+            break;
+        case BinaryFile::WRITE_TRUNCATE:
+            mode = "wb";
+            break;
+        case BinaryFile::READ_WRITE_TRUNCATE:
+            mode = "w+b";
+            break;
+        default:
+            throw CiftiException("unsupported open mode in StrFileImpl");
+    }
+    errno = 0;
+    m_file = fopen(ASTRING_TO_CSTR(filename), mode);
+    int save_err = errno;
+    if (m_file == NULL)
+    {
+        if (!boost::filesystem::exists(AString_to_std_string(filename)))
+        {
+            if (!(opmode & BinaryFile::TRUNCATE))
+            {
+                throw CiftiException("failed to open file '" + filename + "', file does not exist, or folder permissions prevent seeing it");
+            } else {
+                throw CiftiException("failed to open file '" + filename + "', unable to create file");
+            }
+        }
+        switch (save_err)
+        {
+            case EMFILE:
+            case ENFILE:
+                throw CiftiException("failed to open file '" + filename + "', too many open files");
+            default:
+                throw CiftiException("failed to open file '" + filename + "'");
+        }
+    }
+    m_curPos = 0;
+}
+
+void StrFileImpl::close()
+{
+    if (m_file == NULL) return;
+    int ret = fclose(m_file);
+    m_file = NULL;
+    m_curPos = -1;
+    if (ret != 0) throw CiftiException("error closing file '" + m_fileName + "'");
+}
+
+void StrFileImpl::read(void* dataOut, const int64_t& count, int64_t* numRead)
+{
+    if (m_file == NULL) throw CiftiException("read called on unopened StrFileImpl");//shouldn't happen
+    int64_t readret = fread(dataOut, 1, count, m_file);//expect fread to not have read size limitations compared to memory
+    m_curPos += readret;//the item size is 1
+    CiftiAssert(m_curPos == ftello(m_file));//double check it in debug, ftello is fast on linux at least
+    if (numRead == NULL)
+    {
+        if (readret != count)
+        {
+            if (feof(m_file)) throw CiftiException("premature end of file in file '" + m_fileName + "'");
+            throw CiftiException("error while reading file '" + m_fileName + "'");
+        }
+    } else {
+        *numRead = readret;
+    }
+}
+
+void StrFileImpl::seek(const int64_t& position)
+{
+    if (m_file == NULL) throw CiftiException("seek called on unopened StrFileImpl");//shouldn't happen
+    if (position == m_curPos) return;//optimization: calling fseeko causes nontrivial system call time, on linux at least
+    int ret = fseeko(m_file, position, SEEK_SET);
+    if (ret != 0) throw CiftiException("seek failed in file '" + m_fileName + "'");
+    m_curPos = position;
+}
+
+int64_t StrFileImpl::pos()
+{
+    if (m_file == NULL) throw CiftiException("pos called on unopened StrFileImpl");//shouldn't happen
+    CiftiAssert(m_curPos == ftello(m_file));//make sure it is right in debug
+    return m_curPos;//we can avoid a call here also
+}
+
+int64_t StrFileImpl::size()
+{
+    struct stat mystat;
+    int result = fstat(fileno(m_file), &mystat);
+    if (result != 0) return -1;
+    return mystat.st_size;
+}
+
+void StrFileImpl::write(const void* dataIn, const int64_t& count)
+{
+    if (m_file == NULL) throw CiftiException("write called on unopened StrFileImpl");//shouldn't happen
+    int64_t writeret = fwrite(dataIn, 1, count, m_file);//expect fwrite to not have write size limitations compared to memory
+    m_curPos += writeret;//the item size is 1
+    CiftiAssert(m_curPos == ftello(m_file));//double check it in debug, ftello is fast on linux at least
+    if (writeret != count) throw CiftiException("failed to write to file '" + m_fileName + "'");
+}
+
+StrFileImpl::~StrFileImpl()
+{
+    try//throwing from a destructor is a bad idea
+    {
+        close();
+    } catch (const CiftiException& e) {
+        cerr << AString_to_std_string(e.whatString()) << endl;
+    } catch (exception& e) {
+        cerr << e.what() << endl;
+    } catch (...) {
+        cerr << AString_to_std_string("caught unknown exception type while closing file '" + m_fileName + "'") << endl;
+    }
+}
+
+#endif //CIFTILIB_USE_QT
+
+#ifdef CIFTILIB_HAVE_PREAD
+
+void PosixFileImpl::open(const AString& filename, const BinaryFile::OpenMode& opmode)
+{
+    close();
+    m_fileName = filename;
+    int flags = 0;
+    switch (opmode)
+    {
+        case BinaryFile::READ:
+            flags = O_RDONLY;
+            break;
+        case BinaryFile::READ_WRITE:
+            flags = O_RDWR;
+            break;
+        case BinaryFile::WRITE_TRUNCATE:
+            flags = O_WRONLY | O_CREAT | O_TRUNC;
+            break;
+        case BinaryFile::READ_WRITE_TRUNCATE:
+            flags = O_RDWR | O_CREAT | O_TRUNC;
+            break;
+        default:
+            throw CiftiException("unsupported open mode in PosixFileImpl");
+    }
+    m_aligned = false;
+#ifdef O_DIRECT
+    if (m_uncached)
+    {
+        flags |= O_DIRECT;
+        if ((flags & O_ACCMODE) == O_WRONLY) flags = (flags & ~O_ACCMODE) | O_RDWR;//partial blocks need read-modify-write
+        m_aligned = true;
+    }
+#endif //O_DIRECT
+    errno = 0;
+    m_fd = ::open(ASTRING_TO_CSTR(filename), flags, 0666);//same permissions as fopen, before umask
+    int save_err = errno;
+    if (m_fd < 0)
+    {
+        switch (save_err)
+        {
+            case ENOENT:
+                if (!(opmode & BinaryFile::TRUNCATE))
+                {
+                    throw CiftiException("failed to open file '" + filename + "', file does not exist, or folder permissions prevent seeing it");
+                } else {
+                    throw CiftiException("failed to open file '" + filename + "', unable to create file");
+                }
+            case EMFILE:
+            case ENFILE:
+                throw CiftiException("failed to open file '" + filename + "', too many open files");
+            case EINVAL:
+                if (m_aligned) throw CiftiException("failed to open file '" + filename + "', filesystem doesn't support direct IO");
+                throw CiftiException("failed to open file '" + filename + "'");
+            default:
+                throw CiftiException("failed to open file '" + filename + "'");
+        }
+    }
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+    if (m_uncached) fcntl(m_fd, F_NOCACHE, 1);//OS X equivalent, doesn't need alignment
+#endif
+    m_curPos = 0;
+    m_sizeDirty = false;
+    if (m_aligned)
+    {
+        struct stat mystat;
+        m_logicalSize = (fstat(m_fd, &mystat) == 0 ? mystat.st_size : 0);
+    }
+}
+
+void PosixFileImpl::close()
+{
+    if (m_fd < 0) return;
+    bool truncFailed = false;
+    if (m_aligned && m_sizeDirty)
+    {//remove the padding from the last aligned write
+        truncFailed = (ftruncate(m_fd, m_logicalSize) != 0);
+    }
+    int ret = ::close(m_fd);
+    m_fd = -1;
+    m_curPos = -1;
+    if (ret != 0 || truncFailed) throw CiftiException("error closing file '" + m_fileName + "'");
+}
+
+void PosixFileImpl::read(void* dataOut, const int64_t& count, int64_t* numRead)
+{
+    int64_t total = 0;
+    readAt(m_curPos, dataOut, count, &total);
+    m_curPos += total;
+    if (numRead == NULL)
+    {
+        if (total != count) throw CiftiException("premature end of file in file '" + m_fileName + "'");
+    } else {
+        *numRead = total;
+    }
+}
+
+void PosixFileImpl::readAt(const int64_t& position, void* dataOut, const int64_t& count, int64_t* numRead)
+{
+    if (m_fd < 0) throw CiftiException("read called on unopened PosixFileImpl");//shouldn't happen
+    if (m_aligned)
+    {
+        directReadAt(position, dataOut, count, numRead);
+        return;
+    }
+    int64_t total = 0;
+    while (total < count)
+    {
+        ssize_t readret = pread(m_fd, ((char*)dataOut) + total, count - total, position + total);//large reads get split by the kernel, so just loop
+        if (readret < 0)
+        {
+            if (errno == EINTR) continue;
+            if (numRead != NULL) *numRead = total;
+            throw CiftiException("error while reading file '" + m_fileName + "'");
+        }
+        if (readret == 0) break;//end of file
+        total += readret;
+    }
+    if (numRead == NULL)
+    {
+        if (total != count) throw CiftiException("premature end of file in file '" + m_fileName + "'");
+    } else {
+        *numRead = total;
+    }
+}
+
+void PosixFileImpl::seek(const int64_t& position)
+{
+    if (m_fd < 0) throw CiftiException("seek called on unopened PosixFileImpl");//shouldn't happen
+    m_curPos = position;//no system call needed, since we always use positional IO
+}
+
+int64_t PosixFileImpl::pos()
+{
+    if (m_fd < 0) throw CiftiException("pos called on unopened PosixFileImpl");//shouldn't happen
+    return m_curPos;
+}
+
+int64_t PosixFileImpl::size()
+{
+    if (m_aligned) return logicalSize();
+    struct stat mystat;
+    int result = fstat(m_fd, &mystat);
+    if (result != 0) return -1;
+    return mystat.st_size;
+}
+
+void PosixFileImpl::write(const void* dataIn, const int64_t& count)
+{
+    writeAt(m_curPos, dataIn, count);
+    m_curPos += count;
+}
+
+void PosixFileImpl::writeAt(const int64_t& position, const void* dataIn, const int64_t& count)
+{
+    if (m_fd < 0) throw CiftiException("write called on unopened PosixFileImpl");//shouldn't happen
+    if (m_aligned)
+    {
+        directWriteAt(position, dataIn, count);
+        return;
+    }
+    int64_t total = 0;
+    while (total < count)
+    {
+        ssize_t writeret = pwrite(m_fd, ((const char*)dataIn) + total, count - total, position + total);
+        if (writeret < 0 && errno == EINTR) continue;
+        if (writeret < 1) throw CiftiException("failed to write to file '" + m_fileName + "'");
+        total += writeret;
+    }
+}
+
+void PosixFileImpl::readAtBatch(const vector<BinaryFile::BatchRequest>& requests)
+{
+    if (m_fd < 0) throw CiftiException("read called on unopened PosixFileImpl");//shouldn't happen
+#ifdef CIFTILIB_HAVE_IO_URING
+    if (requests.size() > 1 && !m_aligned && IOUringBatch::threadTransfer(m_fd, requests, false, m_fileName)) return;
+#endif //CIFTILIB_HAVE_IO_URING
+    BinaryFile::ImplInterface::readAtBatch(requests);
+}
+
+void PosixFileImpl::writeAtBatch(const vector<BinaryFile::BatchRequest>& requests)
+{
+    if (m_fd < 0) throw CiftiException("write called on unopened PosixFileImpl");//shouldn't happen
+#ifdef CIFTILIB_HAVE_IO_URING
+    if (requests.size() > 1 && !m_aligned && IOUringBatch::threadTransfer(m_fd, requests, true, m_fileName)) return;
+#endif //CIFTILIB_HAVE_IO_URING
+    BinaryFile::ImplInterface::writeAtBatch(requests);
+}
+
+int64_t PosixFileImpl::preadFull(void* dataOut, const int64_t& count, const int64_t& position)
+{
+    int64_t total = 0;
+    while (total < count)
+    {
+        ssize_t readret = pread(m_fd, ((char*)dataOut) + total, count - total, position + total);
+        if (readret < 0)
+        {
+            if (errno == EINTR) continue;
+            throw CiftiException("error while reading file '" + m_fileName + "'");
+        }
+        if (readret == 0) break;
+        total += readret;
+    }
+    return total;
+}
+
+namespace
+{
+    char* alignPointer(char* pointer, const int64_t& alignment)
+    {
+        return (char*)((((size_t)pointer) + alignment - 1) & ~(size_t)(alignment - 1));
+    }
+}
+
+void PosixFileImpl::directReadAt(const int64_t& position, void* dataOut, const int64_t& count, int64_t* numRead)
+{
+    int64_t total = 0, available = max((int64_t)0, min(count, logicalSize() - position));//don't return the padding past the end of a file being written
+    vector<char> bounceMem;
+    char* bounce = NULL;
+    while (total < available)
+    {
+        int64_t start = position + total, alignedStart = start & ~(DIRECT_ALIGN - 1), headPad = start - alignedStart;
+        int64_t want = min(available - total, DIRECT_CHUNK - headPad);
+        int64_t alignedLength = (headPad + want + DIRECT_ALIGN - 1) & ~(DIRECT_ALIGN - 1);
+        int64_t got = 0;
+        if (headPad == 0 && alignedLength == want && ((size_t)(((char*)dataOut) + total)) % DIRECT_ALIGN == 0)
+        {//caller's memory is already aligned, skip the copy
+            got = preadFull(((char*)dataOut) + total, want, start);
+            total += got;
+            if (got < want) break;
+            continue;
+        }
+        if (bounce == NULL)
+        {
+            bounceMem.resize(min(DIRECT_CHUNK, (available + 2 * DIRECT_ALIGN) & ~(DIRECT_ALIGN - 1)) + DIRECT_ALIGN);
+            bounce = alignPointer(bounceMem.data(), DIRECT_ALIGN);
+        }
+        got = preadFull(bounce, alignedLength, alignedStart) - headPad;
+        int64_t toCopy = min(want, got);
+        if (toCopy <= 0) break;
+        memcpy(((char*)dataOut) + total, bounce + headPad, toCopy);
+        total += toCopy;
+        if (toCopy < want) break;//end of file
+    }
+    if (numRead == NULL)
+    {
+        if (total != count) throw CiftiException("premature end of file in file '" + m_fileName + "'");
+    } else {
+        *numRead = total;
+    }
+}
+
+void PosixFileImpl::directWriteAt(const int64_t& position, const void* dataIn, const int64_t& count)
+{
+    CiftiMutexLocker locked(&m_seekMutex);//partial blocks are read-modify-write, so writes that share a block must not overlap
+    int64_t total = 0;
+    vector<char> bounceMem;
+    char* bounce = NULL;
     while (total < count)
     {
-        int64_t maxToWrite = min(count - total, CHUNK_SIZE);
-        writeret = m_file.write(((const char*)dataIn) + total, maxToWrite);//QFile probably also chokes on large writes
-        if (writeret < 1) break;//0 or -1 means error or eof
-        total += writeret;
+        int64_t start = position + total, alignedStart = start & ~(DIRECT_ALIGN - 1), headPad = start - alignedStart;
+        int64_t want = min(count - total, DIRECT_CHUNK - headPad);
+        int64_t alignedLength = (headPad + want + DIRECT_ALIGN - 1) & ~(DIRECT_ALIGN - 1);
+        const char* source = NULL;
+        if (headPad == 0 && alignedLength == want && ((size_t)(((const char*)dataIn) + total)) % DIRECT_ALIGN == 0)
+        {
+            source = ((const char*)dataIn) + total;
+        } else {
+            if (bounce == NULL)
+            {
+                bounceMem.resize(min(DIRECT_CHUNK, (count + 2 * DIRECT_ALIGN) & ~(DIRECT_ALIGN - 1)) + DIRECT_ALIGN);
+                bounce = alignPointer(bounceMem.data(), DIRECT_ALIGN);
+            }
+            if (headPad != 0)
+            {//keep what is already in the first block
+                memset(bounce, 0, DIRECT_ALIGN);
+                if (alignedStart < m_logicalSize) preadFull(bounce, DIRECT_ALIGN, alignedStart);
+            }
+            int64_t lastBlock = alignedStart + alignedLength - DIRECT_ALIGN;
+            if (((headPad + want) % DIRECT_ALIGN) != 0 && (lastBlock != alignedStart || headPad == 0))
+            {//and in the last block, unless that is the first block, which was already read
+                memset(bounce + alignedLength - DIRECT_ALIGN, 0, DIRECT_ALIGN);
+                if (lastBlock < m_logicalSize) preadFull(bounce + alignedLength - DIRECT_ALIGN, DIRECT_ALIGN, lastBlock);
+            }
+            memcpy(bounce + headPad, ((const char*)dataIn) + total, want);
+            source = bounce;
+        }
+        int64_t written = 0;
+        while (written < alignedLength)
+        {
+            ssize_t writeret = pwrite(m_fd, source + written, alignedLength - written, alignedStart + written);
+            if (writeret < 0 && errno == EINTR) continue;
+            if (writeret < 1) throw CiftiException("failed to write to file '" + m_fileName + "'");
+            written += writeret;
+        }
+        total += want;
+        if (start + want > m_logicalSize)
+        {
+            m_logicalSize = start + want;
+        }
+        if (alignedStart + alignedLength > m_logicalSize) m_sizeDirty = true;
     }
-    if (total != count) throw CiftiException("failed to write to file '" + m_fileName + "'");
 }
 
-#else //CIFTILIB_USE_QT
-
-void StrFileImpl::open(const AString& filename, const BinaryFile::OpenMode& opmode)
+void PosixFileImpl::adviseAccess(const BinaryFile::AccessPattern& pattern, const int64_t& offset, const int64_t& length)
 {
-    close();
-    m_fileName = filename;
-    const char* mode = NULL;
-    switch (opmode)
+#ifdef CIFTILIB_HAVE_FADVISE
+    if (m_fd < 0) return;
+    int advice = POSIX_FADV_NORMAL;
+    switch (pattern)
     {
-        case BinaryFile::READ:
-            mode = "rb";
+        case BinaryFile::NORMAL_ACCESS:
+            advice = POSIX_FADV_NORMAL;
             break;
-        case BinaryFile::READ_WRITE:
-            mode = "r+b";
+        case BinaryFile::SEQUENTIAL:
+            advice = POSIX_FADV_SEQUENTIAL;
             break;
-        case BinaryFile::WRITE_TRUNCATE:
-            mode = "wb";
+        case BinaryFile::RANDOM:
+            advice = POSIX_FADV_RANDOM;
             break;
-        case BinaryFile::READ_WRITE_TRUNCATE:
-            mode = "w+b";
+        case BinaryFile::WILL_NEED:
+            advice = POSIX_FADV_WILLNEED;
+            break;
+        case BinaryFile::DONT_NEED:
+            advice = POSIX_FADV_DONTNEED;
             break;
-        default:
-            throw CiftiException("unsupported open mode in StrFileImpl");
     }
-    errno = 0;
-    m_file = fopen(ASTRING_TO_CSTR(filename), mode);
-    int save_err = errno;
-    if (m_file == NULL)
+    posix_fadvise(m_fd, offset, length, advice);//only a hint, ignore errors
+#else //CIFTILIB_HAVE_FADVISE
+    (void)pattern; (void)offset; (void)length;
+#endif //CIFTILIB_HAVE_FADVISE
+}
+
+void PosixFileImpl::preallocate(const int64_t& size)
+{
+    if (m_fd < 0) throw CiftiException("preallocate called on unopened PosixFileImpl");//shouldn't happen
+    struct stat mystat;
+    if (fstat(m_fd, &mystat) != 0) return;//it is only an optimization
+    if (mystat.st_size >= size) return;
+    bool done = false;
+#ifdef CIFTILIB_HAVE_FALLOCATE
+    //not posix_fallocate, because where the filesystem can't allocate (NFS, some Lustre setups), glibc emulates it by writing every block
+    int ret;
+    do
     {
-        if (!boost::filesystem::exists(AString_to_std_string(filename)))
+        ret = fallocate(m_fd, 0, 0, size);
+    } while (ret != 0 && errno == EINTR);
+    if (ret == 0)
+    {
+        done = true;
+    } else if (errno == ENOSPC) {
+        throw CiftiException("not enough disk space for file '" + m_fileName + "'");
+    } else if (errno == EFBIG) {
+        throw CiftiException("file '" + m_fileName + "' would exceed the maximum file size");
+    }//EOPNOTSUPP and anything else, just set the size
+#endif //CIFTILIB_HAVE_FALLOCATE
+    if (!done && ftruncate(m_fd, size) != 0)
+    {//at least set the full size, sparse
+        if (errno == EFBIG) throw CiftiException("file '" + m_fileName + "' would exceed the maximum file size");
+        return;//other failures will show up when writing
+    }
+    if (m_aligned)
+    {
+        CiftiMutexLocker locked(&m_seekMutex);
+        m_logicalSize = max(m_logicalSize, size);//the file really is this size now, so close() doesn't need to truncate
+    }
+}
+
+PosixFileImpl::~PosixFileImpl()
+{
+    try//throwing from a destructor is a bad idea
+    {
+        close();
+    } catch (const CiftiException& e) {
+        cerr << AString_to_std_string(e.whatString()) << endl;
+    } catch (exception& e) {
+        cerr << e.what() << endl;
+    } catch (...) {
+        cerr << AString_to_std_string("caught unknown exception type while closing file '" + m_fileName + "'") << endl;
+    }
+}
+
+#endif //CIFTILIB_HAVE_PREAD
+
+#ifdef CIFTILIB_HAVE_IO_URING
+bool IOUringBatch::init(const unsigned& entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_ringFd = syscall(__NR_io_uring_setup, entries, &params);
+    if (m_ringFd < 0) return false;
+    m_entries = params.sq_entries;
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        m_sqRingSize = max(m_sqRingSize, m_cqRingSize);
+        m_cqRingSize = 0;//shared with the submission ring, don't unmap it twice
+    }
+    m_sqRing = mmap(NULL, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED) return false;
+    if (m_cqRingSize == 0)
+    {
+        m_cqRing = m_sqRing;
+    } else {
+        m_cqRing = mmap(NULL, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED) return false;
+    }
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe*)mmap(NULL, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED) return false;
+    char* sqBase = (char*)m_sqRing, *cqBase = (char*)m_cqRing;
+    m_sqHead = (unsigned*)(sqBase + params.sq_off.head);
+    m_sqTail = (unsigned*)(sqBase + params.sq_off.tail);
+    m_sqMask = (unsigned*)(sqBase + params.sq_off.ring_mask);
+    m_sqArray = (unsigned*)(sqBase + params.sq_off.array);
+    m_cqHead = (unsigned*)(cqBase + params.cq_off.head);
+    m_cqTail = (unsigned*)(cqBase + params.cq_off.tail);
+    m_cqMask = (unsigned*)(cqBase + params.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(cqBase + params.cq_off.cqes);
+    return true;
+}
+
+int64_t IOUringBatch::enter(const unsigned& toSubmit, const unsigned& minComplete)
+{
+    int64_t ret;
+    do
+    {
+        ret = syscall(__NR_io_uring_enter, m_ringFd, toSubmit, minComplete, IORING_ENTER_GETEVENTS, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+bool IOUringBatch::threadTransfer(const int& fd, const vector<BinaryFile::BatchRequest>& requests, const bool& writing, const AString& filename)
+{//setting up a ring is a system call and three mappings, too slow to do for every small batch
+    static thread_local boost::shared_ptr<IOUringBatch> ring;
+    static thread_local bool unavailable = false;
+    if (unavailable) return false;
+    if (ring == NULL)
+    {
+        ring.reset(new IOUringBatch());
+        if (!ring->init(RING_ENTRIES))
         {
-            if (!(opmode & BinaryFile::TRUNCATE))
+            ring.reset();
+            unavailable = true;
+            return false;
+        }
+    }
+    bool ret = false;
+    try
+    {
+        ret = ring->transfer(fd, requests, writing, filename);
+    } catch (CiftiException&) {//the ring may still hold requests that were never submitted, start over with a new one
+        ring.reset();
+        throw;
+    }
+    if (!ret)
+    {//the kernel rejected the requests, don't keep trying on this thread
+        ring.reset();
+        unavailable = true;
+    }
+    return ret;
+}
+
+bool IOUringBatch::transfer(const int& fd, const vector<BinaryFile::BatchRequest>& requests, const bool& writing, const AString& filename)
+{
+    int64_t numRequests = (int64_t)requests.size(), numFinished = 0, numInFlight = 0;
+    vector<int64_t> done(numRequests, 0), toQueue;
+    for (int64_t i = 0; i < numRequests; ++i)
+    {
+        if (requests[i].m_count > 0)
+        {
+            toQueue.push_back(i);
+        } else {
+            ++numFinished;//a zero length transfer completes with res == 0, which would look like end of file, so don't submit it
+        }
+    }
+    const int64_t numEmpty = numFinished;
+    size_t queueNext = 0;
+    bool unsupported = false, failed = false, shortTransfer = false;
+    while (numFinished < numRequests && !unsupported && !failed)
+    {
+        unsigned sqTail = *m_sqTail;//only we write the tail
+        unsigned toSubmit = sqTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);//any the kernel didn't take last time are still in the ring
+        while (numInFlight + toSubmit < m_entries && queueNext < toQueue.size())
+        {
+            int64_t which = toQueue[queueNext];
+            ++queueNext;
+            const BinaryFile::BatchRequest& thisReq = requests[which];
+            unsigned index = sqTail & *m_sqMask;
+            io_uring_sqe* sqe = m_sqes + index;
+            memset(sqe, 0, sizeof(io_uring_sqe));
+            sqe->opcode = (writing ? IORING_OP_WRITE : IORING_OP_READ);
+            sqe->fd = fd;
+            sqe->off = thisReq.m_position + done[which];
+            sqe->addr = (uint64_t)(((char*)thisReq.m_data) + done[which]);
+            sqe->len = (uint32_t)min(thisReq.m_count - done[which], (int64_t)1<<30);
+            sqe->user_data = which;
+            m_sqArray[index] = index;
+            ++sqTail;
+            ++toSubmit;
+        }
+        __atomic_store_n(m_sqTail, sqTail, __ATOMIC_RELEASE);
+        int64_t submitted = enter(toSubmit, 1);//only waits if it took all of them
+        if (submitted < 0 || (submitted == 0 && numInFlight == 0))
+        {
+            if (numInFlight == 0 && numFinished == numEmpty) return false;//nothing done yet, so the caller can use the plain system calls
+            failed = true;
+            break;
+        }
+        numInFlight += submitted;
+        unsigned cqHead = *m_cqHead, cqTail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        for (; cqHead != cqTail; ++cqHead)
+        {
+            const io_uring_cqe* cqe = m_cqes + (cqHead & *m_cqMask);
+            int64_t which = (int64_t)cqe->user_data;
+            --numInFlight;
+            if (cqe->res < 0)
             {
-                throw CiftiException("failed to open file '" + filename + "', file does not exist, or folder permissions prevent seeing it");
+                if (cqe->res == -EINTR || cqe->res == -EAGAIN)
+                {
+                    toQueue.push_back(which);
+                } else if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {//kernel too old for IORING_OP_READ/WRITE
+                    unsupported = true;
+                } else {
+                    failed = true;
+                }
+            } else if (cqe->res == 0) {
+                shortTransfer = true;//end of file when reading
+                ++numFinished;
             } else {
-                throw CiftiException("failed to open file '" + filename + "', unable to create file");
+                done[which] += cqe->res;
+                if (done[which] < requests[which].m_count)
+                {
+                    toQueue.push_back(which);
+                } else {
+                    ++numFinished;
+                }
             }
         }
-        switch (save_err)
-        {
-            case EMFILE:
-            case ENFILE:
-                throw CiftiException("failed to open file '" + filename + "', too many open files");
-            default:
-                throw CiftiException("failed to open file '" + filename + "'");
-        }
+        __atomic_store_n(m_cqHead, cqHead, __ATOMIC_RELEASE);
+    }
+    while (numInFlight > 0)
+    {//the kernel may still be using the buffers, wait for it before returning
+        if (enter(0, numInFlight) < 0) break;//if this fails, the ring's destructor will have to deal with it
+        unsigned cqHead = *m_cqHead, cqTail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        numInFlight -= cqTail - cqHead;
+        __atomic_store_n(m_cqHead, cqTail, __ATOMIC_RELEASE);
+    }
+    if (unsupported && !failed) return false;
+    if (failed)
+    {
+        if (writing) throw CiftiException("failed to write to file '" + filename + "'");
+        throw CiftiException("error while reading file '" + filename + "'");
+    }
+    if (shortTransfer)
+    {
+        if (writing) throw CiftiException("failed to write to file '" + filename + "'");
+        throw CiftiException("premature end of file in file '" + filename + "'");
+    }
+    return true;
+}
+
+IOUringBatch::~IOUringBatch()
+{//closing the ring waits for any outstanding requests
+    if (m_sqes != MAP_FAILED) munmap(m_sqes, m_sqesSize);
+    if (m_cqRing != MAP_FAILED && m_cqRingSize != 0) munmap(m_cqRing, m_cqRingSize);
+    if (m_sqRing != MAP_FAILED) munmap(m_sqRing, m_sqRingSize);
+    if (m_ringFd >= 0) ::close(m_ringFd);
+}
+#endif //CIFTILIB_HAVE_IO_URING
+
+#ifdef CIFTILIB_HAVE_MMAP
+
+void MMapFileImpl::open(const AString& filename, const BinaryFile::OpenMode& opmode)
+{
+    close();
+    m_fileName = filename;
+    if (opmode != BinaryFile::READ) throw CiftiException("memory mapped file only supports READ mode");
+    m_fd = ::open(ASTRING_TO_CSTR(filename), O_RDONLY);
+    if (m_fd < 0) throw CiftiException("failed to open file '" + filename + "'");
+    struct stat mystat;
+    if (fstat(m_fd, &mystat) != 0 || !S_ISREG(mystat.st_mode) || mystat.st_size <= 0 || (uint64_t)mystat.st_size > (uint64_t)numeric_limits<size_t>::max())
+    {//mmap can't do 0 length, and isn't what we want for pipes, etc
+        ::close(m_fd);
+        m_fd = -1;
+        throw CiftiException("file '" + filename + "' can't be memory mapped");
+    }
+    void* mapret = mmap(NULL, mystat.st_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (mapret == MAP_FAILED)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+        throw CiftiException("failed to memory map file '" + filename + "'");
     }
+    m_data = (char*)mapret;
+    m_size = mystat.st_size;
     m_curPos = 0;
 }
 
-void StrFileImpl::close()
+void MMapFileImpl::close()
 {
-    if (m_file == NULL) return;
-    int ret = fclose(m_file);
-    m_file = NULL;
+    if (m_fd < 0) return;
+    munmap(m_data, m_size);
+    int ret = ::close(m_fd);
+    m_fd = -1;
+    m_data = NULL;
+    m_size = -1;
     m_curPos = -1;
     if (ret != 0) throw CiftiException("error closing file '" + m_fileName + "'");
 }
 
-void StrFileImpl::read(void* dataOut, const int64_t& count, int64_t* numRead)
+void MMapFileImpl::read(void* dataOut, const int64_t& count, int64_t* numRead)
 {
-    if (m_file == NULL) throw CiftiException("read called on unopened StrFileImpl");//shouldn't happen
-    int64_t readret = fread(dataOut, 1, count, m_file);//expect fread to not have read size limitations compared to memory
-    m_curPos += readret;//the item size is 1
-    CiftiAssert(m_curPos == ftello(m_file));//double check it in debug, ftello is fast on linux at least
+    int64_t total = 0;
+    readAt(m_curPos, dataOut, count, &total);
+    m_curPos += total;
     if (numRead == NULL)
     {
-        if (readret != count)
-        {
-            if (feof(m_file)) throw CiftiException("premature end of file in file '" + m_fileName + "'");
-            throw CiftiException("error while reading file '" + m_fileName + "'");
-        }
+        if (total != count) throw CiftiException("premature end of file in file '" + m_fileName + "'");
     } else {
-        *numRead = readret;
+        *numRead = total;
     }
 }
 
-void StrFileImpl::seek(const int64_t& position)
+void MMapFileImpl::readAt(const int64_t& position, void* dataOut, const int64_t& count, int64_t* numRead)
 {
-    if (m_file == NULL) throw CiftiException("seek called on unopened StrFileImpl");//shouldn't happen
-    if (position == m_curPos) return;//optimization: calling fseeko causes nontrivial system call time, on linux at least
-    int ret = fseeko(m_file, position, SEEK_SET);
-    if (ret != 0) throw CiftiException("seek failed in file '" + m_fileName + "'");
-    m_curPos = position;
+    if (m_data == NULL) throw CiftiException("read called on unopened MMapFileImpl");//shouldn't happen
+    int64_t toCopy = max((int64_t)0, min(count, m_size - position));
+    if (toCopy > 0) memcpy(dataOut, m_data + position, toCopy);
+    if (numRead == NULL)
+    {
+        if (toCopy != count) throw CiftiException("premature end of file in file '" + m_fileName + "'");
+    } else {
+        *numRead = toCopy;
+    }
 }
 
-int64_t StrFileImpl::pos()
+void MMapFileImpl::seek(const int64_t& position)
 {
-    if (m_file == NULL) throw CiftiException("pos called on unopened StrFileImpl");//shouldn't happen
-    CiftiAssert(m_curPos == ftello(m_file));//make sure it is right in debug
-    return m_curPos;//we can avoid a call here also
+    if (m_data == NULL) throw CiftiException("seek called on unopened MMapFileImpl");//shouldn't happen
+    m_curPos = position;//seeking past the end is allowed, reads will just come up short
 }
 
-int64_t StrFileImpl::size()
+int64_t MMapFileImpl::pos()
 {
-    struct stat mystat;
-    int result = fstat(fileno(m_file), &mystat);
-    if (result != 0) return -1;
-    return mystat.st_size;
+    if (m_data == NULL) throw CiftiException("pos called on unopened MMapFileImpl");//shouldn't happen
+    return m_curPos;
 }
 
-void StrFileImpl::write(const void* dataIn, const int64_t& count)
+void MMapFileImpl::write(const void*, const int64_t&)
 {
-    if (m_file == NULL) throw CiftiException("write called on unopened StrFileImpl");//shouldn't happen
-    int64_t writeret = fwrite(dataIn, 1, count, m_file);//expect fwrite to not have write size limitations compared to memory
-    m_curPos += writeret;//the item size is 1
-    CiftiAssert(m_curPos == ftello(m_file));//double check it in debug, ftello is fast on linux at least
-    if (writeret != count) throw CiftiException("failed to write to file '" + m_fileName + "'");
+    throw CiftiException("write called on memory mapped file '" + m_fileName + "', which is read-only");
 }
 
-StrFileImpl::~StrFileImpl()
+void MMapFileImpl::adviseAccess(const BinaryFile::AccessPattern& pattern, const int64_t& offset, const int64_t& length)
+{
+    if (m_data == NULL || offset >= m_size) return;
+    int advice = POSIX_MADV_NORMAL;
+    switch (pattern)
+    {
+        case BinaryFile::NORMAL_ACCESS:
+            advice = POSIX_MADV_NORMAL;
+            break;
+        case BinaryFile::SEQUENTIAL:
+            advice = POSIX_MADV_SEQUENTIAL;
+            break;
+        case BinaryFile::RANDOM:
+            advice = POSIX_MADV_RANDOM;
+            break;
+        case BinaryFile::WILL_NEED:
+            advice = POSIX_MADV_WILLNEED;
+            break;
+        case BinaryFile::DONT_NEED:
+            advice = POSIX_MADV_DONTNEED;//for a read-only mapping, pages just get reloaded from the file if touched again
+            break;
+    }
+    int64_t pageSize = sysconf(_SC_PAGESIZE);
+    int64_t start = offset - (offset % pageSize), end = (length == 0 ? m_size : min(m_size, offset + length));
+    posix_madvise(m_data + start, end - start, advice);//only a hint, ignore errors
+}
+
+MMapFileImpl::~MMapFileImpl()
 {
     try//throwing from a destructor is a bad idea
     {
@@ -541,4 +2760,124 @@ StrFileImpl::~StrFileImpl()
     }
 }
 
-#endif //CIFTILIB_USE_QT
+#endif //CIFTILIB_HAVE_MMAP
+
+void MemoryFileImpl::open(const AString& filename, const BinaryFile::OpenMode&)
+{
+    throw CiftiException("internal error, MemoryFileImpl can't open file '" + filename + "'");//BinaryFile uses openView or openBuffer
+}
+
+void MemoryFileImpl::openView(const void* data, const int64_t& size, const AString& name)
+{
+    m_fileName = name;
+    m_data = (const char*)data;
+    m_size = size;
+    m_buffer = NULL;
+    m_writable = false;
+    m_curPos = 0;
+}
+
+void MemoryFileImpl::openBuffer(std::vector<char>& buffer, const BinaryFile::OpenMode& opmode, const AString& name)
+{
+    m_fileName = name;
+    m_buffer = &buffer;
+    if (opmode & BinaryFile::TRUNCATE) buffer.clear();
+    m_writable = ((opmode & BinaryFile::WRITE) != 0);
+    m_data = buffer.data();
+    m_size = buffer.size();
+    m_curPos = 0;
+}
+
+void MemoryFileImpl::close()
+{
+    m_data = NULL;
+    m_buffer = NULL;
+    m_size = 0;
+    m_curPos = -1;
+}
+
+void MemoryFileImpl::seek(const int64_t& position)
+{
+    if (m_curPos < 0) throw CiftiException("seek called on unopened MemoryFileImpl");//shouldn't happen
+    m_curPos = position;//past the end is allowed, as with files
+}
+
+int64_t MemoryFileImpl::pos()
+{
+    if (m_curPos < 0) throw CiftiException("pos called on unopened MemoryFileImpl");//shouldn't happen
+    return m_curPos;
+}
+
+int64_t MemoryFileImpl::size()
+{
+    CiftiMutexLocker locked(&m_seekMutex);
+    return m_size;
+}
+
+void MemoryFileImpl::read(void* dataOut, const int64_t& count, int64_t* numRead)
+{
+    int64_t total = 0;
+    readAt(m_curPos, dataOut, count, &total);
+    m_curPos += total;
+    if (numRead == NULL)
+    {
+        if (total != count) throw CiftiException("premature end of data in '" + m_fileName + "'");
+    } else {
+        *numRead = total;
+    }
+}
+
+void MemoryFileImpl::readAt(const int64_t& position, void* dataOut, const int64_t& count, int64_t* numRead)
+{
+    if (m_curPos < 0) throw CiftiException("read called on unopened MemoryFileImpl");//shouldn't happen
+    int64_t toCopy;
+    if (m_writable)
+    {//a write from another thread could reallocate the vector
+        CiftiMutexLocker locked(&m_seekMutex);
+        toCopy = max((int64_t)0, min(count, m_size - position));
+        if (toCopy > 0) memcpy(dataOut, m_data + position, toCopy);
+    } else {
+        toCopy = max((int64_t)0, min(count, m_size - position));
+        if (toCopy > 0) memcpy(dataOut, m_data + position, toCopy);
+    }
+    if (numRead == NULL)
+    {
+        if (toCopy != count) throw CiftiException("premature end of data in '" + m_fileName + "'");
+    } else {
+        *numRead = toCopy;
+    }
+}
+
+void MemoryFileImpl::write(const void* dataIn, const int64_t& count)
+{
+    writeAt(m_curPos, dataIn, count);
+    m_curPos += count;
+}
+
+void MemoryFileImpl::writeAt(const int64_t& position, const void* dataIn, const int64_t& count)
+{
+    if (m_curPos < 0) throw CiftiException("write called on unopened MemoryFileImpl");//shouldn't happen
+    if (!m_writable) throw CiftiException("write called on read-only memory buffer '" + m_fileName + "'");
+    CiftiMutexLocker locked(&m_seekMutex);
+    if (position + count > m_size) grow(position + count);
+    if (count > 0) memcpy(m_buffer->data() + position, dataIn, count);
+}
+
+void MemoryFileImpl::preallocate(const int64_t& size)
+{
+    if (!m_writable) return;
+    CiftiMutexLocker locked(&m_seekMutex);
+    if (size > m_size) grow(size);//one allocation up front, instead of growing as data arrives
+}
+
+void MemoryFileImpl::grow(const int64_t& newSize)
+{//call with m_seekMutex locked
+    try
+    {
+        m_buffer->resize(newSize);//zero fills, like extending a file
+    } catch (std::bad_alloc&) {
+        throw CiftiException("failed to allocate memory for '" + m_fileName + "'");
+    }
+    m_data = m_buffer->data();
+    m_size = newSize;
+}
@@ -31,8 +31,10 @@
 #include "boost/shared_ptr.hpp"
 
 #include "AString.h"
+#include "CiftiMutex.h"
 
 #include <stdint.h>
+#include <vector>
 
 namespace cifti {
     
@@ -50,10 +52,35 @@ namespace cifti {
             WRITE_TRUNCATE = 6,//ditto
             READ_WRITE_TRUNCATE = 7//ditto
         };
+        enum IOMethod
+        {
+            BUFFERED,//QFile or stdio, depending on build
+            MEMORY_MAP,//read-only mapping of the whole file, falls back to BUFFERED when mapping isn't possible (compressed file, writing, no mmap)
+            DIRECT//bypass the page cache (O_DIRECT), so long streaming passes don't evict other data, falls back to BUFFERED when unsupported
+        };
+        enum AccessPattern
+        {
+            NORMAL_ACCESS,
+            SEQUENTIAL,//more readahead
+            RANDOM,//no readahead
+            WILL_NEED,//start reading the range in the background
+            DONT_NEED//drop the range from the page cache
+        };
+        struct BatchRequest
+        {
+            int64_t m_position, m_count;
+            void* m_data;//only read from when writing
+            BatchRequest() { m_position = 0; m_count = 0; m_data = NULL; }
+            BatchRequest(const int64_t& position, void* data, const int64_t& count) { m_position = position; m_count = count; m_data = data; }
+        };
         BinaryFile() { }
         ///constructor that opens file
-        BinaryFile(const AString& filename, const OpenMode& fileMode = READ);
-        void open(const AString& filename, const OpenMode& opmode = READ);
+        BinaryFile(const AString& filename, const OpenMode& fileMode = READ, const IOMethod& method = BUFFERED);
+        void open(const AString& filename, const OpenMode& opmode = READ, const IOMethod& method = BUFFERED);
+        ///read-only access to caller-owned memory, without copying (getMappedData() returns it) - data must stay valid until close
+        void openMemory(const void* data, const int64_t& size, const AString& name = "<memory>");
+        ///access to a caller-owned vector as if it were a file, writing past the end grows it - buffer must stay valid until close
+        void openMemory(std::vector<char>& buffer, const OpenMode& opmode = READ_WRITE, const AString& name = "<memory>");
         void close();
         AString getFilename() const;//not a reference because when no file is open, m_impl is NULL
         bool getOpenForRead();
@@ -62,11 +89,30 @@ namespace cifti {
         int64_t pos();
         void read(void* dataOut, const int64_t& count, int64_t* numRead = NULL);//throw if numRead is NULL and (error or end of file reached early)
         void write(const void* dataIn, const int64_t& count);//failure to complete write is always an exception
+        //positional versions, may be called from multiple threads at once - they don't use pos(), but may change it on implementations that have to emulate them
+        void readAt(const int64_t& position, void* dataOut, const int64_t& count, int64_t* numRead = NULL);
+        void writeAt(const int64_t& position, const void* dataIn, const int64_t& count);
+        //many positional reads or writes at once, so the OS can work on them together (io_uring on linux), any request that can't be completed is an exception
+        void readAtBatch(const std::vector<BatchRequest>& requests);
+        void writeAtBatch(const std::vector<BatchRequest>& requests);
         int64_t size();//may return -1 if size cannot be determined efficiently
+        const char* getMappedData() const;//start of the file in memory if it is memory mapped, otherwise NULL - valid until the file is closed
+        //hint to the OS (posix_fadvise or madvise) about how a byte range will be accessed, length 0 means to the end of the file - does nothing where unsupported
+        void adviseAccess(const AccessPattern& pattern, const int64_t& offset = 0, const int64_t& length = 0);
+        //reserve disk space so the file is at least this large and laid out contiguously, throws if the disk is full - does nothing for compressed files
+        void preallocate(const int64_t& size);
+        ///reading .gz files records decompression checkpoints for fast seeking and parallel decompression, and saves them to <filename>.zidx when the whole file was read
+        ///this is on by default, and failing to save is only reported when it was turned on explicitly - existing .zidx files are always used
+        ///BGZF files (as written by CiftiLib) decompress in parallel from the start, but the first read of a plain single-member .gz file is serial, because
+        ///deflate blocks can only be found by decoding from the start - only reads after the checkpoints exist (later in the same open, or with a .zidx) are parallel
+        static void setSaveCompressedIndexes(const bool& save);
+        ///whether the filename is one that open() treats as compressed (.gz or .zst) - these can only be written sequentially, and not read until closed
+        static bool isCompressedName(const AString& filename);
         class ImplInterface
         {
         protected:
             AString m_fileName;//filename is tracked here so error messages can be implementation-specific
+            CiftiMutex m_seekMutex;//for the default readAt/writeAt, which use seek
         public:
             virtual void open(const AString& filename, const OpenMode& opmode) = 0;
             virtual void close() = 0;
@@ -76,6 +122,13 @@ namespace cifti {
             virtual int64_t size() = 0;
             virtual void read(void* dataOut, const int64_t& count, int64_t* numRead) = 0;
             virtual void write(const void* dataIn, const int64_t& count) = 0;
+            virtual void readAt(const int64_t& position, void* dataOut, const int64_t& count, int64_t* numRead);//default implementations lock, seek, and read/write
+            virtual void writeAt(const int64_t& position, const void* dataIn, const int64_t& count);
+            virtual void readAtBatch(const std::vector<BatchRequest>& requests);//default implementations just loop
+            virtual void writeAtBatch(const std::vector<BatchRequest>& requests);
+            virtual const char* getMappedData() { return NULL; }
+            virtual void adviseAccess(const AccessPattern&, const int64_t&, const int64_t&) { }
+            virtual void preallocate(const int64_t&) { }
             virtual ~ImplInterface();
         };
     private:
@@ -28,6 +28,7 @@
  *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <cstring>
 #include <stdint.h>
 
 namespace cifti {
@@ -57,6 +58,37 @@ namespace cifti {
     void ByteSwapping::swap(T& toSwap)
     {
         if (sizeof(T) == 1) return;//we could specialize 1-byte types, but this should optimize out
+#ifdef __GNUC__
+        switch (sizeof(T))//whole-word swaps compile to a single instruction, and loops of them can vectorize - void* casts are for wrapper classes like Float16
+        {
+            case 2:
+            {
+                uint16_t word;
+                memcpy(&word, (const void*)&toSwap, 2);
+                word = __builtin_bswap16(word);
+                memcpy((void*)&toSwap, &word, 2);
+                return;
+            }
+            case 4:
+            {
+                uint32_t word;
+                memcpy(&word, (const void*)&toSwap, 4);
+                word = __builtin_bswap32(word);
+                memcpy((void*)&toSwap, &word, 4);
+                return;
+            }
+            case 8:
+            {
+                uint64_t word;
+                memcpy(&word, (const void*)&toSwap, 8);
+                word = __builtin_bswap64(word);
+                memcpy((void*)&toSwap, &word, 8);
+                return;
+            }
+            default:
+                break;
+        }
+#endif
         T temp = toSwap;
         char* from = (char*)&temp;
         char* to = (char*)&toSwap;
@@ -0,0 +1,935 @@
+/*LICENSE_START*/ 
+/*
+ *  Copyright (c) 2014, Washington University School of Medicine
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without modification,
+ *  are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "DataConversion.h"
+
+#include "ByteSwapping.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#ifdef CIFTILIB_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace cifti;
+
+namespace
+{
+    template<bool SWAPPED, typename T>
+    T fileOrder(T value)//converts either direction between native and file byte order
+    {
+        if (SWAPPED) ByteSwapping::swap(value);
+        return value;
+    }
+    
+    //scalar versions of the NiftiIO conversions, for loop remainders and for any element the vector code can't prove gets the same answer
+    template<typename TO, typename FROM>
+    TO clampInt(const FROM& in)
+    {
+        if (numeric_limits<TO>::max() < in) return numeric_limits<TO>::max();
+        if (numeric_limits<TO>::min() > in) return numeric_limits<TO>::min();
+        return (TO)in;
+    }
+    
+    template<typename FROM>
+    float readScalar(const FROM& in, const double& mult, const double& offset)
+    {
+        return (float)(offset + mult * (long double)in);
+    }
+    
+    template<typename TO>
+    TO writeScalar(const float& in)
+    {
+        return clampInt<TO, double>(floor(0.5 + in));
+    }
+    
+    template<typename TO>
+    TO writeScalar(const float& in, const double& mult, const double& offset)
+    {//the floor() visible from NiftiIO.h is ::floor(double), so the long double value gets rounded to double before flooring
+        return clampInt<TO, long double>(floor((double)(0.5l + ((long double)in - offset) / mult)));
+    }
+    
+    DataConversion::KernelLevel s_maxKernelLevel = DataConversion::KERNELS_AVX512;
+    
+    void rangeScalar(const float* in, const int64_t& count, float& minval, float& maxval)
+    {
+        for (int64_t i = 0; i < count; ++i)
+        {
+            if (!(fabs(in[i]) < numeric_limits<float>::infinity())) continue;//also skips NaN
+            if (in[i] < minval) minval = in[i];
+            if (in[i] > maxval) maxval = in[i];
+        }
+    }
+    
+#ifdef CIFTILIB_HAVE_X86_SIMD
+    //the scaled kernels compute in double rather than long double, so they check that everything within ERROR_BOUND (relative to the
+    //magnitude of the terms) of the double result rounds to the same output - the difference between the two is at most a few parts in 2^53,
+    //so when the check passes the result is identical, and when it doesn't (ties, NaN, overflow), that element is redone with the scalar code
+    const double ERROR_BOUND = 1.0 / (double)(1LL << 48);
+    
+    enum SimdLevel
+    {
+        SIMD_NONE,//only from setMaxKernelLevel
+        SIMD_SSE2,//always present on x86_64
+        SIMD_AVX2,
+        SIMD_AVX512
+    };
+    
+    SimdLevel detectSimdLevel()
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+        if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+        return SIMD_SSE2;
+    }
+    
+    SimdLevel simdLevel()
+    {
+        static const SimdLevel detected = detectSimdLevel();
+        switch (s_maxKernelLevel)
+        {
+            case DataConversion::KERNELS_NONE:
+                return SIMD_NONE;
+            case DataConversion::KERNELS_SSE2:
+                return SIMD_SSE2;
+            case DataConversion::KERNELS_AVX2:
+                return min(detected, SIMD_AVX2);
+            default:
+                return detected;
+        }
+    }
+    
+    bool detectF16C()
+    {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("f16c");
+    }
+    
+    bool haveF16C()//separate from AVX2 as far as cpuid is concerned, AVX-512F includes it
+    {
+        static const bool ret = detectF16C();
+        return ret;
+    }
+    
+    template<bool SWAPPED, typename FROM>
+    void fixupRead(float* out, const FROM* in, const int& width, const int& goodMask, const double& mult, const double& offset)
+    {
+        for (int i = 0; i < width; ++i)
+        {
+            if ((goodMask & (1 << i)) == 0) out[i] = readScalar(fileOrder<SWAPPED>(in[i]), mult, offset);
+        }
+    }
+    
+    template<bool SWAPPED, typename TO>
+    void fixupWrite(TO* out, const float* in, const int& width, const int& goodMask)
+    {
+        for (int i = 0; i < width; ++i)
+        {
+            if ((goodMask & (1 << i)) == 0) out[i] = fileOrder<SWAPPED>(writeScalar<TO>(in[i]));
+        }
+    }
+    
+    template<bool SWAPPED, typename TO>
+    void fixupWrite(TO* out, const float* in, const int& width, const int& goodMask, const double& mult, const double& offset)
+    {
+        for (int i = 0; i < width; ++i)
+        {
+            if ((goodMask & (1 << i)) == 0) out[i] = fileOrder<SWAPPED>(writeScalar<TO>(in[i], mult, offset));
+        }
+    }
+    
+    namespace sse2
+    {//2 doubles at a time - only unscaled, with two lanes the check for the scaled conversions costs more than the long double code
+        //no pshufb in sse2, so byteswap with shifts and word shuffles
+        inline __m128i swap16(const __m128i& x)
+        {
+            return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+        }
+        
+        inline __m128i swap32(const __m128i& x)
+        {
+            __m128i half = swap16(x);
+            return _mm_or_si128(_mm_slli_epi32(half, 16), _mm_srli_epi32(half, 16));
+        }
+        
+        inline __m128i swap64(const __m128i& x)
+        {
+            return _mm_shufflehi_epi16(_mm_shufflelo_epi16(swap16(x), _MM_SHUFFLE(0, 1, 2, 3)), _MM_SHUFFLE(0, 1, 2, 3));
+        }
+        
+        template<bool SWAPPED>
+        inline __m128d load(const int16_t* in)
+        {
+            int32_t bits;
+            memcpy(&bits, in, sizeof(bits));
+            __m128i x = _mm_cvtsi32_si128(bits);
+            if (SWAPPED) x = swap16(x);
+            return _mm_cvtepi32_pd(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+        }
+        
+        template<bool SWAPPED>
+        inline __m128d load(const uint8_t* in)
+        {
+            uint16_t bits;
+            memcpy(&bits, in, sizeof(bits));
+            __m128i x = _mm_cvtsi32_si128(bits), zero = _mm_setzero_si128();
+            return _mm_cvtepi32_pd(_mm_unpacklo_epi16(_mm_unpacklo_epi8(x, zero), zero));
+        }
+        
+        template<bool SWAPPED>
+        inline __m128d load(const int8_t* in)
+        {
+            uint16_t bits;
+            memcpy(&bits, in, sizeof(bits));
+            __m128i x = _mm_cvtsi32_si128(bits);
+            x = _mm_unpacklo_epi8(x, x);
+            return _mm_cvtepi32_pd(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 24));
+        }
+        
+        template<bool SWAPPED>
+        inline __m128d load(const double* in)
+        {
+            if (SWAPPED) return _mm_castsi128_pd(swap64(_mm_loadu_si128((const __m128i*)in)));
+            return _mm_loadu_pd(in);
+        }
+        
+        inline __m128d load(const float* in)//memory side, always native
+        {
+            return _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)in)));
+        }
+        
+        inline void store(float* out, const __m128d& val)
+        {
+            _mm_storel_pi((__m64*)out, _mm_cvtpd_ps(val));
+        }
+        
+        //integer stores expect values that are already floored and clamped to the output range
+        template<bool SWAPPED>
+        inline void store(int16_t* out, const __m128d& val)
+        {
+            __m128i x = _mm_cvttpd_epi32(val);
+            x = _mm_packs_epi32(x, x);
+            if (SWAPPED) x = swap16(x);
+            int32_t bits = _mm_cvtsi128_si32(x);
+            memcpy(out, &bits, sizeof(bits));
+        }
+        
+        template<bool SWAPPED>
+        inline void store(uint8_t* out, const __m128d& val)
+        {
+            __m128i x = _mm_cvttpd_epi32(val);
+            x = _mm_packs_epi32(x, x);
+            uint16_t bits = (uint16_t)_mm_cvtsi128_si32(_mm_packus_epi16(x, x));
+            memcpy(out, &bits, sizeof(bits));
+        }
+        
+        inline __m128d clampFloor(const __m128d& val, const __m128d& vmin, const __m128d& vmax)
+        {//sse2 has no floor instruction, but anything clamped to the range of a small integer type fits in int32
+            __m128d clamped = _mm_min_pd(_mm_max_pd(val, vmin), vmax);
+            __m128d trunc = _mm_cvtepi32_pd(_mm_cvttpd_epi32(clamped));
+            return _mm_sub_pd(trunc, _mm_and_pd(_mm_cmpgt_pd(trunc, clamped), _mm_set1_pd(1.0)));
+        }
+        
+        void swapCopy(float* out, const float* in, const int64_t& count)
+        {
+            int64_t i = 0;
+            for (; i + 4 <= count; i += 4) _mm_storeu_si128((__m128i*)(out + i), swap32(_mm_loadu_si128((const __m128i*)(in + i))));
+            for (; i < count; ++i) out[i] = fileOrder<true>(in[i]);
+        }
+        
+        template<bool SWAPPED, typename FROM>
+        void read(float* out, const FROM* in, const int64_t& count)
+        {
+            int64_t i = 0;
+            for (; i + 2 <= count; i += 2) store(out + i, load<SWAPPED>(in + i));
+            for (; i < count; ++i) out[i] = (float)fileOrder<SWAPPED>(in[i]);
+        }
+        
+        template<bool SWAPPED, typename TO>
+        void write(TO* out, const float* in, const int64_t& count)
+        {
+            const __m128d vmin = _mm_set1_pd(numeric_limits<TO>::min()), vmax = _mm_set1_pd(numeric_limits<TO>::max()), half = _mm_set1_pd(0.5);
+            int64_t i = 0;
+            for (; i + 2 <= count; i += 2)
+            {
+                __m128d val = _mm_add_pd(half, load(in + i));//exact, and the same thing the scalar code does
+                store<SWAPPED>(out + i, clampFloor(val, vmin, vmax));
+                int good = _mm_movemask_pd(_mm_cmpord_pd(val, val));//leave NaN to whatever the scalar code does
+                if (good != 3) fixupWrite<SWAPPED>(out + i, in + i, 2, good);
+            }
+            for (; i < count; ++i) out[i] = fileOrder<SWAPPED>(writeScalar<TO>(in[i]));
+        }
+        
+        void range(const float* in, const int64_t& count, float& minval, float& maxval)
+        {//non-finite lanes are replaced by infinities, which can't win
+            const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff)), inf = _mm_set1_ps(numeric_limits<float>::infinity()), negInf = _mm_set1_ps(-numeric_limits<float>::infinity());
+            __m128 vmin = inf, vmax = negInf;
+            int64_t i = 0;
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128 x = _mm_loadu_ps(in + i);
+                __m128 finite = _mm_cmplt_ps(_mm_and_ps(x, absMask), inf);
+                vmin = _mm_min_ps(vmin, _mm_or_ps(_mm_and_ps(finite, x), _mm_andnot_ps(finite, inf)));
+                vmax = _mm_max_ps(vmax, _mm_or_ps(_mm_and_ps(finite, x), _mm_andnot_ps(finite, negInf)));
+            }
+            float mins[4], maxes[4];
+            _mm_storeu_ps(mins, vmin);
+            _mm_storeu_ps(maxes, vmax);
+            rangeScalar(mins, 4, minval, maxval);
+            rangeScalar(maxes, 4, minval, maxval);
+            rangeScalar(in + i, count - i, minval, maxval);
+        }
+    }
+    
+    namespace avx2
+    {//4 doubles at a time
+#define CIFTILIB_TARGET_AVX2 __attribute__((target("avx2")))
+        CIFTILIB_TARGET_AVX2 inline __m128i swap16(const __m128i& x)
+        {
+            return _mm_shuffle_epi8(x, _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14));
+        }
+        
+        CIFTILIB_TARGET_AVX2 inline __m256i swap32(const __m256i& x)
+        {
+            return _mm256_shuffle_epi8(x, _mm256_broadcastsi128_si256(_mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12)));
+        }
+        
+        CIFTILIB_TARGET_AVX2 inline __m256i swap64(const __m256i& x)
+        {
+            return _mm256_shuffle_epi8(x, _mm256_broadcastsi128_si256(_mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8)));
+        }
+        
+        template<bool SWAPPED>
+        CIFTILIB_TARGET_AVX2 inline __m256d load(const int16_t* in)
+        {
+            __m128i x = _mm_loadl_epi64((const __m128i*)in);
+            if (SWAPPED) x = swap16(x);
+            return _mm256_cvtepi32_pd(_mm_cvtepi16_epi32(x));
+        }
+        
+        template<bool SWAPPED>
+        CIFTILIB_TARGET_AVX2 inline __m256d load(const uint8_t* in)
+        {
+            int32_t bits;
+            memcpy(&bits, in, sizeof(bits));
+            return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bits)));
+        }
+        
+        template<bool SWAPPED>
+        CIFTILIB_TARGET_AVX2 inline __m256d load(const int8_t* in)
+        {
+            int32_t bits;
+            memcpy(&bits, in, sizeof(bits));
+            return _mm256_cvtepi32_pd(_mm_cvtepi8_epi32(_mm_cvtsi32_si128(bits)));
+        }
+        
+        template<bool SWAPPED>
+        CIFTILIB_TARGET_AVX2 inline __m256d load(const double* in)
+        {
+            if (SWAPPED) return _mm256_castsi256_pd(swap64(_mm256_loadu_si256((const __m256i*)in)));
+            return _mm256_loadu_pd(in);
+        }
+        
+        CIFTILIB_TARGET_AVX2 inline __m256d load(const float* in)
+        {
+            return _mm256_cvtps_pd(_mm_loadu_ps(in));
+        }
+        
+        CIFTILIB_TARGET_AVX2 inline void store(float* out, const __m256d& val)
+        {
+            _mm_storeu_ps(out, _mm256_cvtpd_ps(val));
+        }
+        
+        template<bool SWAPPED>
+        CIFTILIB_TARGET_AVX2 inline void store(int16_t* out, const __m256d& val)
+        {
+            __m128i x = _mm256_cvttpd_epi32(val);
+            x = _mm_packs_epi32(x, x);
+            if (SWAPPED) x = swap16(x);
+            _mm_storel_epi64((__m128i*)out, x);
+        }
+        
+        template<bool SWAPPED>
+        CIFTILIB_TARGET_AVX2 inline void store(uint8_t* out, const __m256d& val)
+        {
+            __m128i x = _mm256_cvttpd_epi32(val);
+            x = _mm_packs_epi32(x, x);
+            int32_t bits = _mm_cvtsi128_si32(_mm_packus_epi16(x, x));
+            memcpy(out, &bits, sizeof(bits));
+        }
+        
+        CIFTILIB_TARGET_AVX2 inline __m256d clampFloor(const __m256d& val, const __m256d& vmin, const __m256d& vmax)
+        {
+            return _mm256_floor_pd(_mm256_min_pd(_mm256_max_pd(val, vmin), vmax));
+        }
+        
+        CIFTILIB_TARGET_AVX2 void swapCopy(float* out, const float* in, const int64_t& count)
+        {
+            int64_t i = 0;
+            for (; i + 8 <= count; i += 8) _mm256_storeu_si256((__m256i*)(out + i), swap32(_mm256_loadu_si256((const __m256i*)(in + i))));
+            for (; i < count; ++i) out[i] = fileOrder<true>(in[i]);
+        }
+        
+        template<bool SWAPPED, typename FROM>
+        CIFTILIB_TARGET_AVX2 void read(float* out, const FROM* in, const int64_t& count)
+        {
+            int64_t i = 0;
+            for (; i + 4 <= count; i += 4) store(out + i, load<SWAPPED>(in + i));
+            for (; i < count; ++i) out[i] = (float)fileOrder<SWAPPED>(in[i]);
+        }
+        
+        template<bool SWAPPED, typename FROM>
+        CIFTILIB_TARGET_AVX2 void readScaled(float* out, const FROM* in, const int64_t& count, const double& mult, const double& offset)
+        {
+            const __m256d vmult = _mm256_set1_pd(mult), voffset = _mm256_set1_pd(offset), vabsOffset = _mm256_set1_pd(fabs(offset));
+            const __m256d vbound = _mm256_set1_pd(ERROR_BOUND), sign = _mm256_set1_pd(-0.0);
+            int64_t i = 0;
+            for (; i + 4 <= count; i += 4)
+            {
+                __m256d product = _mm256_mul_pd(vmult, load<SWAPPED>(in + i));
+                __m256d val = _mm256_add_pd(voffset, product);
+                __m256d margin = _mm256_mul_pd(vbound, _mm256_add_pd(_mm256_andnot_pd(sign, product), vabsOffset));
+                store(out + i, val);
+                int good = _mm_movemask_ps(_mm_cmpeq_ps(_mm256_cvtpd_ps(_mm256_add_pd(val, margin)), _mm256_cvtpd_ps(_mm256_sub_pd(val, margin))));
+                if (good != 15) fixupRead<SWAPPED>(out + i, in + i, 4, good, mult, offset);
+            }
+            for (; i < count; ++i) out[i] = readScalar(fileOrder<SWAPPED>(in[i]), mult, offset);
+        }
+        
+        template<bool SWAPPED, typename TO>
+        CIFTILIB_TARGET_AVX2 void write(TO* out, const float* in, const int64_t& count)
+        {
+            const __m256d vmin = _mm256_set1_pd(numeric_limits<TO>::min()), vmax = _mm256_set1_pd(numeric_limits<TO>::max()), half = _mm256_set1_pd(0.5);
+            int64_t i = 0;
+            for (; i + 4 <= count; i += 4)
+            {
+                __m256d val = _mm256_add_pd(half, load(in + i));
+                store<SWAPPED>(out + i, clampFloor(val, vmin, vmax));
+                int good = _mm256_movemask_pd(_mm256_cmp_pd(val, val, _CMP_ORD_Q));
+                if (good != 15) fixupWrite<SWAPPED>(out + i, in + i, 4, good);
+            }
+            for (; i < count; ++i) out[i] = fileOrder<SWAPPED>(writeScalar<TO>(in[i]));
+        }
+        
+        template<bool SWAPPED, typename TO>
+        CIFTILIB_TARGET_AVX2 void writeScaled(TO* out, const float* in, const int64_t& count, const double& mult, const double& offset)
+        {
+            const __m256d vmin = _mm256_set1_pd(numeric_limits<TO>::min()), vmax = _mm256_set1_pd(numeric_limits<TO>::max()), half = _mm256_set1_pd(0.5);
+            const __m256d vinverse = _mm256_set1_pd(1.0 / mult), vabsInverse = _mm256_set1_pd(fabs(1.0 / mult));
+            const __m256d voffset = _mm256_set1_pd(offset), vabsOffset = _mm256_set1_pd(fabs(offset));
+            const __m256d vbound = _mm256_set1_pd(ERROR_BOUND), sign = _mm256_set1_pd(-0.0);
+            int64_t i = 0;
+            for (; i + 4 <= count; i += 4)
+            {
+                __m256d x = load(in + i);
+                __m256d val = _mm256_add_pd(half, _mm256_mul_pd(_mm256_sub_pd(x, voffset), vinverse));
+                __m256d margin = _mm256_mul_pd(vbound, _mm256_add_pd(_mm256_mul_pd(_mm256_add_pd(_mm256_andnot_pd(sign, x), vabsOffset), vabsInverse), _mm256_andnot_pd(sign, val)));
+                __m256d high = _mm256_add_pd(val, margin), low = _mm256_sub_pd(val, margin);
+                store<SWAPPED>(out + i, clampFloor(val, vmin, vmax));
+                int good = _mm256_movemask_pd(_mm256_and_pd(_mm256_cmp_pd(high, low, _CMP_ORD_Q), _mm256_cmp_pd(clampFloor(high, vmin, vmax), clampFloor(low, vmin, vmax), _CMP_EQ_OQ)));
+                if (good != 15) fixupWrite<SWAPPED>(out + i, in + i, 4, good, mult, offset);
+            }
+            for (; i < count; ++i) out[i] = fileOrder<SWAPPED>(writeScalar<TO>(in[i], mult, offset));
+        }
+        
+        CIFTILIB_TARGET_AVX2 void range(const float* in, const int64_t& count, float& minval, float& maxval)
+        {
+            const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff)), inf = _mm256_set1_ps(numeric_limits<float>::infinity()), negInf = _mm256_set1_ps(-numeric_limits<float>::infinity());
+            __m256 vmin = inf, vmax = negInf;
+            int64_t i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                __m256 x = _mm256_loadu_ps(in + i);
+                __m256 finite = _mm256_cmp_ps(_mm256_and_ps(x, absMask), inf, _CMP_LT_OQ);
+                vmin = _mm256_min_ps(vmin, _mm256_blendv_ps(inf, x, finite));
+                vmax = _mm256_max_ps(vmax, _mm256_blendv_ps(negInf, x, finite));
+            }
+            float mins[8], maxes[8];
+            _mm256_storeu_ps(mins, vmin);
+            _mm256_storeu_ps(maxes, vmax);
+            rangeScalar(mins, 8, minval, maxval);
+            rangeScalar(maxes, 8, minval, maxval);
+            rangeScalar(in + i, count - i, minval, maxval);
+        }
+#undef CIFTILIB_TARGET_AVX2
+        
+#define CIFTILIB_TARGET_F16C __attribute__((target("avx2,f16c")))
+        template<bool SWAPPED>
+        CIFTILIB_TARGET_F16C void readHalf(float* out, const Float16* in, const int64_t& count)
+        {
+            int64_t i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+                if (SWAPPED) x = swap16(x);
+                _mm256_storeu_ps(out + i, _mm256_cvtph_ps(x));
+            }
+            for (; i < count; ++i) out[i] = fileOrder<SWAPPED>(in[i]);
+        }
+        
+        template<bool SWAPPED>
+        CIFTILIB_TARGET_F16C void writeHalf(Float16* out, const float* in, const int64_t& count)
+        {
+            int64_t i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                __m128i x = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);//same rounding as Float16::fromFloat
+                if (SWAPPED) x = swap16(x);
+                _mm_storeu_si128((__m128i*)(out + i), x);
+            }
+            for (; i < count; ++i) out[i] = fileOrder<SWAPPED>(Float16(in[i]));
+        }
+#undef CIFTILIB_TARGET_F16C
+    }
+    
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"//gcc's avx512 intrinsics use a self-initialized "undefined" vector for unmasked operations
+#endif
+    namespace avx512
+    {//8 doubles at a time, only using AVX-512F instructions (byte shuffles stay 256 bits wide, they would need AVX-512BW)
+#define CIFTILIB_TARGET_AVX512 __attribute__((target("avx512f")))
+        template<bool SWAPPED>
+        CIFTILIB_TARGET_AVX512 inline __m512d load(const int16_t* in)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i*)in);
+            if (SWAPPED) x = _mm_shuffle_epi8(x, _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14));
+            return _mm512_cvtepi32_pd(_mm256_cvtepi16_epi32(x));
+        }
+        
+        template<bool SWAPPED>
+        CIFTILIB_TARGET_AVX512 inline __m512d load(const uint8_t* in)
+        {
+            return _mm512_cvtepi32_pd(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)in)));
+        }
+        
+        template<bool SWAPPED>
+        CIFTILIB_TARGET_AVX512 inline __m512d load(const int8_t* in)
+        {
+            return _mm512_cvtepi32_pd(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)in)));
+        }
+        
+        template<bool SWAPPED>
+        CIFTILIB_TARGET_AVX512 inline __m512d load(const double* in)
+        {
+            if (SWAPPED)
+            {
+                const __m256i mask = _mm256_broadcastsi128_si256(_mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8));
+                __m256d low = _mm256_castsi256_pd(_mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)in), mask));
+                __m256d high = _mm256_castsi256_pd(_mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(in + 4)), mask));
+                return _mm512_insertf64x4(_mm512_castpd256_pd512(low), high, 1);
+            }
+            return _mm512_loadu_pd(in);
+        }
+        
+        CIFTILIB_TARGET_AVX512 inline __m512d load(const float* in)
+        {
+            return _mm512_cvtps_pd(_mm256_loadu_ps(in));
+        }
+        
+        CIFTILIB_TARGET_AVX512 inline void store(float* out, const __m512d& val)
+        {
+            _mm256_storeu_ps(out, _mm512_cvtpd_ps(val));
+        }
+        
+        CIFTILIB_TARGET_AVX512 inline __m128i pack32(const __m512d& val)
+        {
+            __m256i x = _mm512_cvttpd_epi32(val);
+            return _mm_packs_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+        }
+        
+        template<bool SWAPPED>
+        CIFTILIB_TARGET_AVX512 inline void store(int16_t* out, const __m512d& val)
+        {
+            __m128i x = pack32(val);
+            if (SWAPPED) x = _mm_shuffle_epi8(x, _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14));
+            _mm_storeu_si128((__m128i*)out, x);
+        }
+        
+        template<bool SWAPPED>
+        CIFTILIB_TARGET_AVX512 inline void store(uint8_t* out, const __m512d& val)
+        {
+            __m128i x = pack32(val);
+            _mm_storel_epi64((__m128i*)out, _mm_packus_epi16(x, x));
+        }
+        
+        CIFTILIB_TARGET_AVX512 inline __m512d clampFloor(const __m512d& val, const __m512d& vmin, const __m512d& vmax)
+        {
+            return _mm512_roundscale_pd(_mm512_min_pd(_mm512_max_pd(val, vmin), vmax), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        }
+        
+        template<bool SWAPPED, typename FROM>
+        CIFTILIB_TARGET_AVX512 void read(float* out, const FROM* in, const int64_t& count)
+        {
+            int64_t i = 0;
+            for (; i + 8 <= count; i += 8) store(out + i, load<SWAPPED>(in + i));
+            for (; i < count; ++i) out[i] = (float)fileOrder<SWAPPED>(in[i]);
+        }
+        
+        template<bool SWAPPED, typename FROM>
+        CIFTILIB_TARGET_AVX512 void readScaled(float* out, const FROM* in, const int64_t& count, const double& mult, const double& offset)
+        {
+            const __m512d vmult = _mm512_set1_pd(mult), voffset = _mm512_set1_pd(offset), vabsOffset = _mm512_set1_pd(fabs(offset));
+            const __m512d vbound = _mm512_set1_pd(ERROR_BOUND);
+            int64_t i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                __m512d product = _mm512_mul_pd(vmult, load<SWAPPED>(in + i));
+                __m512d val = _mm512_add_pd(voffset, product);
+                __m512d margin = _mm512_mul_pd(vbound, _mm512_add_pd(_mm512_abs_pd(product), vabsOffset));
+                store(out + i, val);
+                int good = _mm256_movemask_ps(_mm256_cmp_ps(_mm512_cvtpd_ps(_mm512_add_pd(val, margin)), _mm512_cvtpd_ps(_mm512_sub_pd(val, margin)), _CMP_EQ_OQ));
+                if (good != 255) fixupRead<SWAPPED>(out + i, in + i, 8, good, mult, offset);
+            }
+            for (; i < count; ++i) out[i] = readScalar(fileOrder<SWAPPED>(in[i]), mult, offset);
+        }
+        
+        template<bool SWAPPED, typename TO>
+        CIFTILIB_TARGET_AVX512 void write(TO* out, const float* in, const int64_t& count)
+        {
+            const __m512d vmin = _mm512_set1_pd(numeric_limits<TO>::min()), vmax = _mm512_set1_pd(numeric_limits<TO>::max()), half = _mm512_set1_pd(0.5);
+            int64_t i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                __m512d val = _mm512_add_pd(half, load(in + i));
+                store<SWAPPED>(out + i, clampFloor(val, vmin, vmax));
+                int good = _mm512_cmp_pd_mask(val, val, _CMP_ORD_Q);
+                if (good != 255) fixupWrite<SWAPPED>(out + i, in + i, 8, good);
+            }
+            for (; i < count; ++i) out[i] = fileOrder<SWAPPED>(writeScalar<TO>(in[i]));
+        }
+        
+        template<bool SWAPPED, typename TO>
+        CIFTILIB_TARGET_AVX512 void writeScaled(TO* out, const float* in, const int64_t& count, const double& mult, const double& offset)
+        {
+            const __m512d vmin = _mm512_set1_pd(numeric_limits<TO>::min()), vmax = _mm512_set1_pd(numeric_limits<TO>::max()), half = _mm512_set1_pd(0.5);
+            const __m512d vinverse = _mm512_set1_pd(1.0 / mult), vabsInverse = _mm512_set1_pd(fabs(1.0 / mult));
+            const __m512d voffset = _mm512_set1_pd(offset), vabsOffset = _mm512_set1_pd(fabs(offset));
+            const __m512d vbound = _mm512_set1_pd(ERROR_BOUND);
+            int64_t i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                __m512d x = load(in + i);
+                __m512d val = _mm512_add_pd(half, _mm512_mul_pd(_mm512_sub_pd(x, voffset), vinverse));
+                __m512d margin = _mm512_mul_pd(vbound, _mm512_add_pd(_mm512_mul_pd(_mm512_add_pd(_mm512_abs_pd(x), vabsOffset), vabsInverse), _mm512_abs_pd(val)));
+                __m512d high = _mm512_add_pd(val, margin), low = _mm512_sub_pd(val, margin);
+                store<SWAPPED>(out + i, clampFloor(val, vmin, vmax));
+                int good = _mm512_cmp_pd_mask(high, low, _CMP_ORD_Q) & _mm512_cmp_pd_mask(clampFloor(high, vmin, vmax), clampFloor(low, vmin, vmax), _CMP_EQ_OQ);
+                if (good != 255) fixupWrite<SWAPPED>(out + i, in + i, 8, good, mult, offset);
+            }
+            for (; i < count; ++i) out[i] = fileOrder<SWAPPED>(writeScalar<TO>(in[i], mult, offset));
+        }
+        
+        CIFTILIB_TARGET_AVX512 inline __m256i swap16(const __m256i& x)
+        {
+            return _mm256_shuffle_epi8(x, _mm256_broadcastsi128_si256(_mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14)));
+        }
+        
+        template<bool SWAPPED>
+        CIFTILIB_TARGET_AVX512 void readHalf(float* out, const Float16* in, const int64_t& count)
+        {
+            int64_t i = 0;
+            for (; i + 16 <= count; i += 16)
+            {
+                __m256i x = _mm256_loadu_si256((const __m256i*)(in + i));
+                if (SWAPPED) x = swap16(x);
+                _mm512_storeu_ps(out + i, _mm512_cvtph_ps(x));
+            }
+            for (; i < count; ++i) out[i] = fileOrder<SWAPPED>(in[i]);
+        }
+        
+        template<bool SWAPPED>
+        CIFTILIB_TARGET_AVX512 void writeHalf(Float16* out, const float* in, const int64_t& count)
+        {
+            int64_t i = 0;
+            for (; i + 16 <= count; i += 16)
+            {
+                __m256i x = _mm512_cvtps_ph(_mm512_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+                if (SWAPPED) x = swap16(x);
+                _mm256_storeu_si256((__m256i*)(out + i), x);
+            }
+            for (; i < count; ++i) out[i] = fileOrder<SWAPPED>(Float16(in[i]));
+        }
+        
+        CIFTILIB_TARGET_AVX512 void range(const float* in, const int64_t& count, float& minval, float& maxval)
+        {
+            const __m512 inf = _mm512_set1_ps(numeric_limits<float>::infinity());
+            __m512 vmin = inf, vmax = _mm512_set1_ps(-numeric_limits<float>::infinity());
+            int64_t i = 0;
+            for (; i + 16 <= count; i += 16)
+            {
+                __m512 x = _mm512_loadu_ps(in + i);
+                __mmask16 finite = _mm512_cmp_ps_mask(_mm512_abs_ps(x), inf, _CMP_LT_OQ);
+                vmin = _mm512_mask_min_ps(vmin, finite, vmin, x);
+                vmax = _mm512_mask_max_ps(vmax, finite, vmax, x);
+            }
+            float reducedMin = _mm512_reduce_min_ps(vmin), reducedMax = _mm512_reduce_max_ps(vmax);
+            if (reducedMin < minval) minval = reducedMin;//infinite when no lane was finite, which leaves the range alone
+            if (reducedMax > maxval) maxval = reducedMax;
+            rangeScalar(in + i, count - i, minval, maxval);
+        }
+#undef CIFTILIB_TARGET_AVX512
+    }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+    
+    template<bool SWAPPED, typename FROM>
+    bool readToFloat(float* out, const FROM* in, const int64_t& count, const bool& doScale, const double& mult, const double& offset)
+    {
+        switch (simdLevel())
+        {
+            case SIMD_AVX512:
+                if (doScale) avx512::readScaled<SWAPPED>(out, in, count, mult, offset); else avx512::read<SWAPPED>(out, in, count);
+                break;
+            case SIMD_AVX2:
+                if (doScale) avx2::readScaled<SWAPPED>(out, in, count, mult, offset); else avx2::read<SWAPPED>(out, in, count);
+                break;
+            case SIMD_SSE2:
+                if (doScale) return false;
+                sse2::read<SWAPPED>(out, in, count);
+                break;
+            default:
+                return false;
+        }
+        return true;
+    }
+    
+    template<bool SWAPPED, typename TO>
+    bool writeFromFloat(TO* out, const float* in, const int64_t& count, const bool& doScale, const double& mult, const double& offset)
+    {
+        switch (simdLevel())
+        {
+            case SIMD_AVX512:
+                if (doScale) avx512::writeScaled<SWAPPED>(out, in, count, mult, offset); else avx512::write<SWAPPED>(out, in, count);
+                break;
+            case SIMD_AVX2:
+                if (doScale) avx2::writeScaled<SWAPPED>(out, in, count, mult, offset); else avx2::write<SWAPPED>(out, in, count);
+                break;
+            case SIMD_SSE2:
+                if (doScale) return false;
+                sse2::write<SWAPPED>(out, in, count);
+                break;
+            default:
+                return false;
+        }
+        return true;
+    }
+    
+    template<bool SWAPPED>
+    bool readHalf(float* out, const Float16* in, const int64_t& count)
+    {
+        switch (simdLevel())
+        {
+            case SIMD_AVX512:
+                avx512::readHalf<SWAPPED>(out, in, count);
+                return true;
+            case SIMD_AVX2:
+                if (!haveF16C()) return false;
+                avx2::readHalf<SWAPPED>(out, in, count);
+                return true;
+            default:
+                return false;
+        }
+    }
+    
+    template<bool SWAPPED>
+    bool writeHalf(Float16* out, const float* in, const int64_t& count)
+    {
+        switch (simdLevel())
+        {
+            case SIMD_AVX512:
+                avx512::writeHalf<SWAPPED>(out, in, count);
+                return true;
+            case SIMD_AVX2:
+                if (!haveF16C()) return false;
+                avx2::writeHalf<SWAPPED>(out, in, count);
+                return true;
+            default:
+                return false;
+        }
+    }
+#endif //CIFTILIB_HAVE_X86_SIMD
+    
+    template<typename FROM>
+    bool readToFloat(float* out, const FROM* in, const int64_t& count, const bool& swapped, const bool& doScale, const double& mult, const double& offset)
+    {
+#ifdef CIFTILIB_HAVE_X86_SIMD
+        if (swapped) return readToFloat<true>(out, in, count, doScale, mult, offset);
+        return readToFloat<false>(out, in, count, doScale, mult, offset);
+#else
+        (void)out; (void)in; (void)count; (void)swapped; (void)doScale; (void)mult; (void)offset;
+        return false;
+#endif
+    }
+    
+    template<typename TO>
+    bool writeFromFloat(TO* out, const float* in, const int64_t& count, const bool& swapped, const bool& doScale, const double& mult, const double& offset)
+    {
+#ifdef CIFTILIB_HAVE_X86_SIMD
+        if (swapped) return writeFromFloat<true>(out, in, count, doScale, mult, offset);
+        return writeFromFloat<false>(out, in, count, doScale, mult, offset);
+#else
+        (void)out; (void)in; (void)count; (void)swapped; (void)doScale; (void)mult; (void)offset;
+        return false;
+#endif
+    }
+    
+    bool readHalf(float* out, const Float16* in, const int64_t& count, const bool& swapped)
+    {
+#ifdef CIFTILIB_HAVE_X86_SIMD
+        if (swapped) return readHalf<true>(out, in, count);
+        return readHalf<false>(out, in, count);
+#else
+        (void)out; (void)in; (void)count; (void)swapped;
+        return false;
+#endif
+    }
+    
+    bool writeHalf(Float16* out, const float* in, const int64_t& count, const bool& swapped)
+    {
+#ifdef CIFTILIB_HAVE_X86_SIMD
+        if (swapped) return writeHalf<true>(out, in, count);
+        return writeHalf<false>(out, in, count);
+#else
+        (void)out; (void)in; (void)count; (void)swapped;
+        return false;
+#endif
+    }
+    
+    void range(const float* in, const int64_t& count, float& minval, float& maxval)
+    {
+#ifdef CIFTILIB_HAVE_X86_SIMD
+        switch (simdLevel())
+        {
+            case SIMD_AVX512:
+                avx512::range(in, count, minval, maxval);
+                break;
+            case SIMD_AVX2:
+                avx2::range(in, count, minval, maxval);
+                break;
+            case SIMD_SSE2:
+                sse2::range(in, count, minval, maxval);
+                break;
+            default:
+                rangeScalar(in, count, minval, maxval);
+                break;
+        }
+#else
+        rangeScalar(in, count, minval, maxval);
+#endif
+    }
+    
+    bool swapCopy(float* out, const float* in, const int64_t& count)
+    {
+#ifdef CIFTILIB_HAVE_X86_SIMD
+        switch (simdLevel())
+        {
+            case SIMD_NONE:
+                return false;
+            case SIMD_SSE2:
+                sse2::swapCopy(out, in, count);
+                break;
+            default:
+                avx2::swapCopy(out, in, count);
+                break;
+        }
+        return true;
+#else
+        (void)out; (void)in; (void)count;
+        return false;
+#endif
+    }
+}
+
+bool DataConversion::convertRead(float* out, const int16_t* in, const int64_t& count, const bool& swapped, const bool& doScale, const double& mult, const double& offset)
+{
+    return readToFloat(out, in, count, swapped, doScale, mult, offset);
+}
+
+bool DataConversion::convertRead(float* out, const uint8_t* in, const int64_t& count, const bool& swapped, const bool& doScale, const double& mult, const double& offset)
+{
+    return readToFloat(out, in, count, swapped, doScale, mult, offset);
+}
+
+bool DataConversion::convertRead(float* out, const int8_t* in, const int64_t& count, const bool& swapped, const bool& doScale, const double& mult, const double& offset)
+{
+    return readToFloat(out, in, count, swapped, doScale, mult, offset);
+}
+
+bool DataConversion::convertRead(float* out, const double* in, const int64_t& count, const bool& swapped, const bool& doScale, const double& mult, const double& offset)
+{
+    return readToFloat(out, in, count, swapped, doScale, mult, offset);
+}
+
+bool DataConversion::convertRead(float* out, const float* in, const int64_t& count, const bool& swapped, const bool& doScale, const double&, const double&)
+{
+    if (!swapped || doScale) return false;//nothing for a kernel to do, or a rare case
+    return swapCopy(out, in, count);
+}
+
+bool DataConversion::convertWrite(int16_t* out, const float* in, const int64_t& count, const bool& swapped, const bool& doScale, const double& mult, const double& offset)
+{
+    return writeFromFloat(out, in, count, swapped, doScale, mult, offset);
+}
+
+bool DataConversion::convertWrite(uint8_t* out, const float* in, const int64_t& count, const bool& swapped, const bool& doScale, const double& mult, const double& offset)
+{
+    return writeFromFloat(out, in, count, swapped, doScale, mult, offset);
+}
+
+bool DataConversion::convertWrite(float* out, const float* in, const int64_t& count, const bool& swapped, const bool& doScale, const double&, const double&)
+{
+    if (!swapped || doScale) return false;
+    return swapCopy(out, in, count);
+}
+
+bool DataConversion::convertRead(float* out, const Float16* in, const int64_t& count, const bool& swapped, const bool& doScale, const double&, const double&)
+{
+    if (doScale) return false;//the point of half precision is to not need scaling
+    return readHalf(out, in, count, swapped);
+}
+
+bool DataConversion::convertWrite(Float16* out, const float* in, const int64_t& count, const bool& swapped, const bool& doScale, const double&, const double&)
+{
+    if (doScale) return false;
+    return writeHalf(out, in, count, swapped);
+}
+
+void DataConversion::updateRange(const float* data, const int64_t& count, float& minval, float& maxval)
+{
+    range(data, count, minval, maxval);
+}
+
+void DataConversion::setMaxKernelLevel(const KernelLevel& level)
+{
+    s_maxKernelLevel = level;
+}
@@ -0,0 +1,85 @@
+#ifndef __DATA_CONVERSION_H__
+#define __DATA_CONVERSION_H__
+
+/*LICENSE_START*/ 
+/*
+ *  Copyright (c) 2014, Washington University School of Medicine
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without modification,
+ *  are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Float16.h"
+
+#include <stdint.h>
+
+namespace cifti {
+
+    /**
+     * Vectorized versions of the common NiftiIO datatype conversions.
+     * 
+     * The results are identical to the generic loops in NiftiIO::convertRead and NiftiIO::convertWrite,
+     * including their rounding and clamping, the instruction set is chosen at runtime.
+     * When swapped is true, the file side of the conversion (input when reading, output when writing) is in the opposite byte order,
+     * and the byteswap is done in the same pass.
+     * Each function returns false when there is no kernel for this platform, and the caller should use its generic code.
+     */
+    class DataConversion
+    {
+    public:
+        ///reading: out = offset + mult * in when doScale, otherwise out = in
+        template<typename TO, typename FROM>
+        static bool convertRead(TO*, const FROM*, const int64_t&, const bool&, const bool&, const double&, const double&) { return false; }
+        static bool convertRead(float* out, const int16_t* in, const int64_t& count, const bool& swapped, const bool& doScale, const double& mult, const double& offset);
+        static bool convertRead(float* out, const uint8_t* in, const int64_t& count, const bool& swapped, const bool& doScale, const double& mult, const double& offset);
+        static bool convertRead(float* out, const int8_t* in, const int64_t& count, const bool& swapped, const bool& doScale, const double& mult, const double& offset);
+        static bool convertRead(float* out, const double* in, const int64_t& count, const bool& swapped, const bool& doScale, const double& mult, const double& offset);
+        static bool convertRead(float* out, const float* in, const int64_t& count, const bool& swapped, const bool& doScale, const double& mult, const double& offset);
+        static bool convertRead(float* out, const Float16* in, const int64_t& count, const bool& swapped, const bool& doScale, const double& mult, const double& offset);
+        
+        ///writing: out = floor(0.5 + (in - offset) / mult) when doScale, otherwise floor(0.5 + in), clamped to the range of the output type
+        template<typename TO, typename FROM>
+        static bool convertWrite(TO*, const FROM*, const int64_t&, const bool&, const bool&, const double&, const double&) { return false; }
+        static bool convertWrite(int16_t* out, const float* in, const int64_t& count, const bool& swapped, const bool& doScale, const double& mult, const double& offset);
+        static bool convertWrite(uint8_t* out, const float* in, const int64_t& count, const bool& swapped, const bool& doScale, const double& mult, const double& offset);
+        static bool convertWrite(float* out, const float* in, const int64_t& count, const bool& swapped, const bool& doScale, const double& mult, const double& offset);
+        static bool convertWrite(Float16* out, const float* in, const int64_t& count, const bool& swapped, const bool& doScale, const double& mult, const double& offset);
+        
+        enum KernelLevel
+        {
+            KERNELS_NONE,//every conversion returns false, so callers use their generic code
+            KERNELS_SSE2,
+            KERNELS_AVX2,
+            KERNELS_AVX512
+        };
+        ///use at most this instruction set, for comparing the kernels against each other and against the generic code - levels the processor lacks are skipped
+        ///the default is KERNELS_AVX512, this isn't synchronized, so only change it while no conversions are running
+        static void setMaxKernelLevel(const KernelLevel& level);
+        
+        ///widens [minval, maxval] to include the finite values in data, ignoring NaN and infinities - start from minval = +inf, maxval = -inf
+        ///unlike the conversions, this always does the work, with scalar code when there is no kernel
+        static void updateRange(const float* data, const int64_t& count, float& minval, float& maxval);
+    };
+
+}
+
+#endif //__DATA_CONVERSION_H__
@@ -0,0 +1,115 @@
+#ifndef __FLOAT16_H__
+#define __FLOAT16_H__
+
+/*LICENSE_START*/ 
+/*
+ *  Copyright (c) 2014, Washington University School of Medicine
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without modification,
+ *  are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *  EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+#include <limits>
+#include <stdint.h>
+
+namespace cifti {
+    
+    ///IEEE 754 half precision float, only for storage - it converts to and from float for anything else
+    ///conversion from float rounds to nearest even, overflow gives infinity, NaNs stay NaN (made quiet), matching the F16C instructions
+    class Float16
+    {
+        uint16_t m_bits;
+    public:
+        Float16() { m_bits = 0; }
+        Float16(const float& value) { m_bits = fromFloat(value); }
+        operator float() const { return toFloat(m_bits); }
+        uint16_t getBits() const { return m_bits; }
+        static Float16 fromBits(const uint16_t& bits) { Float16 ret; ret.m_bits = bits; return ret; }
+        static float toFloat(const uint16_t& bits);
+        static uint16_t fromFloat(const float& value);
+    };
+    
+    inline float Float16::toFloat(const uint16_t& bits)
+    {
+        uint32_t sign = (uint32_t)(bits & 0x8000) << 16, exponent = (bits >> 10) & 0x1F, mantissa = bits & 0x3FF, out;
+        if (exponent == 0x1F)
+        {
+            out = sign | 0x7F800000 | (mantissa << 13) | (mantissa != 0 ? 0x400000 : 0);//infinity, or quiet NaN keeping the payload
+        } else if (exponent == 0) {
+            float ret = mantissa * (1.0f / (1 << 24));//zero or subnormal, exact in float
+            return (sign != 0 ? -ret : ret);
+        } else {
+            out = sign | ((exponent + 112) << 23) | (mantissa << 13);//rebias from 15 to 127
+        }
+        float ret;
+        memcpy(&ret, &out, sizeof(float));
+        return ret;
+    }
+    
+    inline uint16_t Float16::fromFloat(const float& value)
+    {
+        uint32_t in;
+        memcpy(&in, &value, sizeof(float));
+        uint16_t sign = (uint16_t)((in >> 16) & 0x8000);
+        uint32_t magnitude = in & 0x7FFFFFFF;
+        if (magnitude > 0x7F800000) return sign | 0x7E00 | ((magnitude >> 13) & 0x3FF);//NaN
+        if (magnitude >= 0x477FF000) return sign | 0x7C00;//65520 and up rounds to infinity
+        if (magnitude < 0x38800000)
+        {//below the smallest normal half, round to a multiple of 2^-24
+            if (magnitude <= 0x33000000) return sign;//2^-25 is a tie, and rounds to the even zero
+            uint32_t mantissa = (magnitude & 0x7FFFFF) | 0x800000, shift = 126 - (magnitude >> 23);
+            uint32_t ret = mantissa >> shift, remainder = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+            if (remainder > halfway || (remainder == halfway && (ret & 1))) ++ret;//may carry into the smallest normal, which is still the right encoding
+            return sign | (uint16_t)ret;
+        }
+        uint32_t rebiased = magnitude - 0x38000000;//exponent from 127 to 15 bias
+        uint32_t ret = rebiased >> 13, remainder = rebiased & 0x1FFF;
+        if (remainder > 0x1000 || (remainder == 0x1000 && (ret & 1))) ++ret;//carry into the exponent is correct too
+        return sign | (uint16_t)ret;
+    }
+    
+}
+
+namespace std
+{
+    template<>
+    class numeric_limits<cifti::Float16>
+    {//enough for the generic datatype code (NiftiIO, NiftiHeader scaling)
+    public:
+        static const bool is_specialized = true;
+        static const bool is_signed = true;
+        static const bool is_integer = false;
+        static const bool is_exact = false;
+        static const bool has_infinity = true;
+        static const bool has_quiet_NaN = true;
+        static const int digits = 11;
+        static cifti::Float16 min() { return cifti::Float16::fromBits(0x0400); }//smallest normal, 2^-14
+        static cifti::Float16 max() { return cifti::Float16::fromBits(0x7BFF); }//65504
+        static cifti::Float16 lowest() { return cifti::Float16::fromBits(0xFBFF); }
+        static cifti::Float16 epsilon() { return cifti::Float16::fromBits(0x1400); }//2^-10
+        static cifti::Float16 infinity() { return cifti::Float16::fromBits(0x7C00); }
+        static cifti::Float16 quiet_NaN() { return cifti::Float16::fromBits(0x7E00); }
+    };
+}
+
+#endif //__FLOAT16_H__
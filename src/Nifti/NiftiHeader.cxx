@@ -30,6 +30,7 @@
 #include "Common/ByteSwapping.h"
 #include "Common/CiftiAssert.h"
 #include "Common/CiftiException.h"
+#include "Common/Float16.h"
 #include "Common/FloatMatrix.h"
 #include "Common/MathFunctions.h"
 
@@ -117,6 +118,19 @@ int64_t NiftiHeader::computeVoxOffset(const int& version) const
     return ret;
 }
 
+int64_t NiftiHeader::getExtensionOffset(const int& index) const
+{
+    CiftiAssert(index >= 0 && index < (int)m_extensions.size());
+    int64_t ret = 4 + (m_version == 2 ? sizeof(nifti_2_header) : sizeof(nifti_1_header));//same layout as write()
+    for (int i = 0; i < index; ++i)
+    {
+        int64_t thisSize = 8 + m_extensions[i]->m_bytes.size();
+        if (thisSize % 16 != 0) thisSize += 16 - (thisSize % 16);
+        ret += thisSize;
+    }
+    return ret + 8;//skip the size and ecode
+}
+
 bool NiftiHeader::getDataScaling(double& mult, double& offset) const
 {
     if (m_header.datatype == NIFTI_TYPE_RGB24 ||
@@ -577,6 +591,12 @@ void NiftiHeader::setDataTypeAndScaleRange(const int16_t& type, const double& mi
             setDataScaling(myscale.mult, myscale.offset);
             break;
         }
+        case CIFTILIB_TYPE_FLOAT16:
+        {
+            Scaling<Float16> myscale(minval, maxval);
+            setDataScaling(myscale.mult, myscale.offset);
+            break;
+        }
         case NIFTI_TYPE_FLOAT32:
         case NIFTI_TYPE_COMPLEX64:
         {
@@ -628,6 +648,7 @@ int NiftiHeader::getNumComponents() const
         case NIFTI_TYPE_UINT64:
         case NIFTI_TYPE_FLOAT64:
         case NIFTI_TYPE_FLOAT128:
+        case CIFTILIB_TYPE_FLOAT16:
             return 1;
             break;
         default:
@@ -816,6 +837,7 @@ int NiftiHeader::typeToNumBits(const int64_t& type)
             break;
         case NIFTI_TYPE_INT16:
         case NIFTI_TYPE_UINT16:
+        case CIFTILIB_TYPE_FLOAT16:
             return 16;
             break;
         case NIFTI_TYPE_RGB24:
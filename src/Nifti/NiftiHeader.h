@@ -60,6 +60,7 @@ namespace cifti
         std::vector<std::vector<float> > getSForm() const;
         double getTimeStep() const;//seconds
         int64_t getDataOffset() const { return m_header.vox_offset; }
+        int64_t getExtensionOffset(const int& index) const;//file position of the bytes of an extension, as last read or written
         int16_t getDataType() const { return m_header.datatype; }
         int32_t getIntentCode() const { return m_header.intent_code; }
         const char* getIntentName() const { return m_header.intent_name; }//NOTE: 16 BYTES, MAY NOT HAVE A NULL TERMINATOR
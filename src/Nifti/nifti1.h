@@ -574,6 +574,11 @@ const int32_t NIFTI_TYPE_COMPLEX128  =1792;
 const int32_t NIFTI_TYPE_COMPLEX256  =2048;
 /* @} */
 
+/*! CiftiLib extension, NOT a registered nifti datatype: 16 bit IEEE half precision float (see Common/Float16.h).
+    Other nifti readers reject the unknown code, rather than silently misreading the data, and the value is far from
+    the registered codes so that it won't collide with future ones. */
+const int32_t CIFTILIB_TYPE_FLOAT16 =16400;
+
 /*-------- sample typedefs for complicated types ---*/
 #if 0
 typedef struct { float       r,i;     } complex_float ;
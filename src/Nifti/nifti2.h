@@ -53,6 +53,9 @@ const int32_t NIFTI_INTENT_CONNECTIVITY_PARCELLATED_PARCELLATED_SERIES=3011;
 const int32_t NIFTI_INTENT_CONNECTIVITY_PARCELLATED_PARCELLATED_SCALAR=3012;
 
 const int32_t NIFTI_ECODE_CIFTI=32;
+/*! CiftiLib extension, NOT a registered extension code: per-row scale and offset tables for 8 or 16 bit integer cifti data,
+    see CiftiFile::setWritingDataTypeRowScaling - other nifti readers ignore it, and see the stored integers */
+const int32_t CIFTILIB_ECODE_ROW_SCALING=16400;
 
 #define NIFTI2_VERSION(h) \
     (h).sizeof_hdr == 348 ? 1 : (\
@@ -33,9 +33,21 @@
 using namespace std;
 using namespace cifti;
 
-void NiftiIO::openRead(const AString& filename)
+void NiftiIO::openRead(const AString& filename, const BinaryFile::IOMethod& method)
 {
-    m_file.open(filename);
+    m_file.open(filename, BinaryFile::READ, method);
+    readHeader();
+}
+
+void NiftiIO::openReadMemory(const void* data, const int64_t& size)
+{
+    m_file.openMemory(data, size);
+    readHeader();
+}
+
+void NiftiIO::readHeader()
+{
+    const AString filename = m_file.getFilename();
     m_header.read(m_file);
     if (m_header.getDataType() == DT_BINARY)
     {
@@ -54,7 +66,8 @@ void NiftiIO::openRead(const AString& filename)
     }
 }
 
-void NiftiIO::writeNew(const AString& filename, const NiftiHeader& header, const int& version, const bool& withRead, const bool& swapEndian)
+void NiftiIO::writeNew(const AString& filename, const NiftiHeader& header, const int& version, const bool& withRead, const bool& swapEndian,
+                       const BinaryFile::IOMethod& method)
 {
     if (header.getDataType() == DT_BINARY)
     {
@@ -62,27 +75,106 @@ void NiftiIO::writeNew(const AString& filename, const NiftiHeader& header, const
     }
     if (withRead)
     {
-        m_file.open(filename, BinaryFile::READ_WRITE_TRUNCATE);//for cifti on-disk writing, replace structure with along row needs to RMW
+        m_file.open(filename, BinaryFile::READ_WRITE_TRUNCATE, method);//for cifti on-disk writing, replace structure with along row needs to RMW
     } else {
-        m_file.open(filename, BinaryFile::WRITE_TRUNCATE);
+        m_file.open(filename, BinaryFile::WRITE_TRUNCATE, method);
     }
+    writeHeader(header, version, swapEndian);
+}
+
+void NiftiIO::writeNewMemory(std::vector<char>& buffer, const NiftiHeader& header, const int& version, const bool& swapEndian)
+{
+    if (header.getDataType() == DT_BINARY)
+    {
+        throw CiftiException("writing NIFTI with binary datatype is unsupported");
+    }
+    m_file.openMemory(buffer, BinaryFile::READ_WRITE_TRUNCATE);
+    writeHeader(header, version, swapEndian);
+}
+
+void NiftiIO::writeHeader(const NiftiHeader& header, const int& version, const bool& swapEndian)
+{
     m_header = header;
     m_header.write(m_file, version, swapEndian);//the header's getDataOffset() is not what gets written, as it doesn't reflect changes in the extensions
     m_dims = m_header.getDimensions();
 }
 
+void NiftiIO::updateExtension(const int& index, const vector<char>& bytes)
+{
+    if (index < 0 || index >= (int)m_header.m_extensions.size()) throw CiftiException("NiftiIO: invalid extension index");
+    if (bytes.size() != m_header.m_extensions[index]->m_bytes.size()) throw CiftiException("NiftiIO: extension size can't change after writing");
+    m_file.writeAt(m_header.getExtensionOffset(index), bytes.data(), bytes.size());
+    m_header.m_extensions[index]->m_bytes = bytes;
+}
+
 void NiftiIO::close()
 {
     m_file.close();
     m_dims.clear();
 }
 
+void NiftiIO::preallocateData()
+{
+    if (m_dims.empty()) throw CiftiException("preallocateData called on unopened NiftiIO");
+    int64_t numElems = getNumComponents();
+    for (size_t i = 0; i < m_dims.size(); ++i)
+    {
+        numElems *= m_dims[i];
+    }
+    m_file.preallocate(m_header.getDataOffset() + numElems * numBytesPerElem());
+}
+
+void NiftiIO::adviseAccess(const BinaryFile::AccessPattern& pattern, const int64_t& firstElem, const int64_t& numElems)
+{
+    if (m_dims.empty()) return;//not open, and it is only a hint
+    m_file.adviseAccess(pattern, m_header.getDataOffset() + firstElem * numBytesPerElem(), numElems * numBytesPerElem());
+}
+
+void NiftiIO::getSelection(const int& fullDims, const vector<int64_t>& indexSelect, int64_t& numElems, int64_t& numSkip) const
+{
+    if (fullDims < 0) throw CiftiException("NiftiIO: fulldims must not be negative");
+    if (fullDims > (int)m_dims.size()) throw CiftiException("NiftiIO: fulldims must not be greater than number of dimensions");
+    if ((size_t)fullDims + indexSelect.size() != m_dims.size())
+    {//could be >=, but should catch more stupid mistakes as ==
+        throw CiftiException("NiftiIO: fulldims plus length of indexSelect must equal number of dimensions");
+    }
+    numElems = getNumComponents();//for now, calculate read size on the fly, as the read call will be the slowest part
+    int curDim;
+    for (curDim = 0; curDim < fullDims; ++curDim)
+    {
+        numElems *= m_dims[curDim];
+    }
+    int64_t numDimSkip = numElems;
+    numSkip = 0;
+    for (; curDim < (int)m_dims.size(); ++curDim)
+    {
+        if (indexSelect[curDim - fullDims] < 0) throw CiftiException("NiftiIO: indices must not be negative");
+        if (indexSelect[curDim - fullDims] >= m_dims[curDim]) throw CiftiException("NiftiIO: index exceeds nifti dimension length");
+        numSkip += indexSelect[curDim - fullDims] * numDimSkip;
+        numDimSkip *= m_dims[curDim];
+    }
+}
+
+const int64_t NiftiIO::SCRATCH_KEEP_BYTES = 1<<24;//16MiB, far more than a row of a dense file needs
+
+vector<char>& NiftiIO::threadScratch()
+{
+    static thread_local vector<char> scratch;
+    return scratch;
+}
+
+void NiftiIO::trimThreadScratch()
+{
+    vector<char>& scratch = threadScratch();
+    if ((int64_t)scratch.capacity() > SCRATCH_KEEP_BYTES) vector<char>().swap(scratch);
+}
+
 int NiftiIO::getNumComponents() const
 {
     return m_header.getNumComponents();
 }
 
-int NiftiIO::numBytesPerElem()
+int NiftiIO::numBytesPerElem() const
 {
     switch (m_header.getDataType())
     {
@@ -93,6 +185,7 @@ int NiftiIO::numBytesPerElem()
             break;
         case NIFTI_TYPE_INT16:
         case NIFTI_TYPE_UINT16:
+        case CIFTILIB_TYPE_FLOAT16:
             return 2;
             break;
         case NIFTI_TYPE_INT32:
@@ -33,12 +33,14 @@
 #include "Common/ByteSwapping.h"
 #include "Common/BinaryFile.h"
 #include "Common/CiftiException.h"
-#include "Common/CiftiMutex.h"
+#include "Common/DataConversion.h"
+#include "Common/Float16.h"
 #include "Nifti/NiftiHeader.h"
 
 //include MultiDimIterator from a private include directory, in case people want to use it with NiftiIO
 #include "Common/MultiDimIterator.h"
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
 #include <vector>
@@ -51,104 +53,233 @@ namespace cifti
         BinaryFile m_file;
         NiftiHeader m_header;
         std::vector<int64_t> m_dims;
-        std::vector<char> m_scratch;//scratch memory for byteswapping, type conversion, etc
-        CiftiMutex m_mutex;
-        int numBytesPerElem();//for resizing scratch
+        void getSelection(const int& fullDims, const std::vector<int64_t>& indexSelect, int64_t& numElems, int64_t& numSkip) const;//checks indices, computes element count and element offset
+        void readHeader();//after m_file is opened
+        void writeHeader(const NiftiHeader& header, const int& version, const bool& swapEndian);
+        template<typename T>
+        bool dataTypeMatches() const;//true if T is the same type as the data in the file, so no conversion is needed (other than possibly byteswapping)
+        template<typename T>
+        bool isDirectType() const;//true if the file data is exactly an array of T (matching type, native endian, unscaled), so caller memory can be used for the file IO
+        template<typename T>
+        void convertFromScratch(T* dataOut, char* scratch, const int64_t& numElems);//converts from the file's datatype, may modify scratch
+        template<typename T>
+        void convertToScratch(char* scratch, const T* dataIn, const int64_t& numElems);//converts to the file's datatype
         template<typename TO, typename FROM>
         void convertRead(TO* out, FROM* in, const int64_t& count);//for reading from file
         template<typename TO, typename FROM>
         void convertWrite(TO* out, const FROM* in, const int64_t& count);//for writing to file
         template<typename TO, typename FROM>
         static TO clamp(const FROM& in);//deal with integer cast being undefined when converting from outside range
+        static std::vector<char>& threadScratch();//reused by the calls without caller-owned scratch, one per thread so readers don't contend
+        static void trimThreadScratch();//after using it, so that one large selection doesn't stay allocated in every thread for the thread's lifetime
+        const static int64_t SCRATCH_KEEP_BYTES;//most per-thread scratch kept between calls, also the chunk size for batch and range calls
     public:
-        void openRead(const AString& filename);
-        void writeNew(const AString& filename, const NiftiHeader& header, const int& version = 1, const bool& withRead = false, const bool& swapEndian = false);
+        void openRead(const AString& filename, const BinaryFile::IOMethod& method = BinaryFile::BUFFERED);
+        void writeNew(const AString& filename, const NiftiHeader& header, const int& version = 1, const bool& withRead = false, const bool& swapEndian = false,
+                      const BinaryFile::IOMethod& method = BinaryFile::BUFFERED);
+        ///uncompressed nifti in caller-owned memory, which must stay valid until close - data is read without copying where possible
+        void openReadMemory(const void* data, const int64_t& size);
+        ///write into a caller-owned vector (resized as needed), which must stay valid until close
+        void writeNewMemory(std::vector<char>& buffer, const NiftiHeader& header, const int& version = 1, const bool& swapEndian = false);
         AString getFilename() const { return m_file.getFilename(); }
+        int numBytesPerElem() const;//size of one element (component) in the file
+        ///reserve disk space for all of the data (after writeNew), so data written in any order ends up contiguous on disk
+        void preallocateData();
+        ///hint about how the data will be accessed, range is in elements from the start of the data (as in getSelection), numElems 0 means to the end
+        void adviseAccess(const BinaryFile::AccessPattern& pattern, const int64_t& firstElem = 0, const int64_t& numElems = 0);
         void overrideDimensions(const std::vector<int64_t>& newDims) { m_dims = newDims; }//HACK: deal with reading/writing CIFTI-1's broken headers
+        ///replace the contents of an extension in a file being written, for things that aren't known until the data is written - the size can't change
+        void updateExtension(const int& index, const std::vector<char>& bytes);
         void close();
         const NiftiHeader& getHeader() const { return m_header; }
         const std::vector<int64_t>& getDimensions() const { return m_dims; }
         int getNumComponents() const;
         //to read/write 1 frame of a standard volume file, call with fullDims = 3, indexSelect containing indexes for any of dims 4-7 that exist
         //NOTE: you need to provide storage for all components within the range, if getNumComponents() == 3 and fullDims == 0, you need 3 elements allocated
+        //reading and writing use positional IO with no shared state, so multiple threads may read (or write different parts) at the same time
         template<typename T>
         void readData(T* dataOut, const int& fullDims, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead = false);
         template<typename T>
         void writeData(const T* dataIn, const int& fullDims, const std::vector<int64_t>& indexSelect);
+        //versions with caller-owned scratch memory (for byteswapping, type conversion, etc) - the versions above use a per-thread scratch instead
+        //scratch is only ever grown by these, so it is best to reuse the same vector for all calls
+        template<typename T>
+        void readData(T* dataOut, const int& fullDims, const std::vector<int64_t>& indexSelect, std::vector<char>& scratch, const bool& tolerateShortRead = false);
+        template<typename T>
+        void writeData(const T* dataIn, const int& fullDims, const std::vector<int64_t>& indexSelect, std::vector<char>& scratch);
+        //many selections of the same size at once, stored consecutively in dataOut/dataIn - the file IO is submitted in batches (io_uring on linux), which helps for scattered selections
+        template<typename T>
+        void readDataBatch(T* dataOut, const int& fullDims, const std::vector<std::vector<int64_t> >& indexSelects);
+        template<typename T>
+        void writeDataBatch(const T* dataIn, const int& fullDims, const std::vector<std::vector<int64_t> >& indexSelects);
+        //numSelects consecutive selections in file order (first index fastest), starting at indexSelect - contiguous in the file, so done as one large read/write and conversion
+        template<typename T>
+        void readDataRange(T* dataOut, const int& fullDims, const std::vector<int64_t>& indexSelect, const int64_t& numSelects);
+        template<typename T>
+        void writeDataRange(const T* dataIn, const int& fullDims, const std::vector<int64_t>& indexSelect, const int64_t& numSelects);
+        //zero-copy access when the file was opened with MEMORY_MAP, and the file contains native-endian, unscaled data of type T
+        //returns NULL when any of these conditions aren't met, pointer is valid until the file is closed
+        template<typename T>
+        const T* getDataPointer(const int& fullDims, const std::vector<int64_t>& indexSelect);
     };
     
     template<typename T>
-    void NiftiIO::readData(T* dataOut, const int& fullDims, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead)
+    bool NiftiIO::dataTypeMatches() const
     {
-        if (fullDims < 0) throw CiftiException("NiftiIO: fulldims must not be negative");
-        if (fullDims > (int)m_dims.size()) throw CiftiException("NiftiIO: fulldims must not be greater than number of dimensions");
-        if ((size_t)fullDims + indexSelect.size() != m_dims.size())
-        {//could be >=, but should catch more stupid mistakes as ==
-            throw CiftiException("NiftiIO: fulldims plus length of indexSelect must equal number of dimensions");
-        }
-        int64_t numElems = getNumComponents();//for now, calculate read size on the fly, as the read call will be the slowest part
-        int curDim;
-        for (curDim = 0; curDim < fullDims; ++curDim)
+        typedef std::numeric_limits<T> mylimits;
+        if (getNumComponents() != 1) return false;
+        switch (m_header.getDataType())
         {
-            numElems *= m_dims[curDim];
+            case NIFTI_TYPE_UINT8:
+            case NIFTI_TYPE_UINT16:
+            case NIFTI_TYPE_UINT32:
+            case NIFTI_TYPE_UINT64:
+                return mylimits::is_integer && !mylimits::is_signed && (int)sizeof(T) == numBytesPerElem();
+            case NIFTI_TYPE_INT8:
+            case NIFTI_TYPE_INT16:
+            case NIFTI_TYPE_INT32:
+            case NIFTI_TYPE_INT64:
+                return mylimits::is_integer && mylimits::is_signed && (int)sizeof(T) == numBytesPerElem();
+            case NIFTI_TYPE_FLOAT32:
+            case NIFTI_TYPE_FLOAT64:
+            case CIFTILIB_TYPE_FLOAT16:
+                return !mylimits::is_integer && (int)sizeof(T) == numBytesPerElem();
+            default://don't try to match long double to FLOAT128, it isn't really 128 bits on most platforms
+                return false;
         }
-        int64_t numDimSkip = numElems, numSkip = 0;
-        for (; curDim < (int)m_dims.size(); ++curDim)
-        {
-            if (indexSelect[curDim - fullDims] < 0) throw CiftiException("NiftiIO: indices must not be negative");
-            if (indexSelect[curDim - fullDims] >= m_dims[curDim]) throw CiftiException("NiftiIO: index exceeds nifti dimension length");
-            numSkip += indexSelect[curDim - fullDims] * numDimSkip;
-            numDimSkip *= m_dims[curDim];
+    }
+    
+    template<typename T>
+    bool NiftiIO::isDirectType() const
+    {
+        if (m_header.isSwapped() || !dataTypeMatches<T>()) return false;
+        double mult, offset;
+        return !m_header.getDataScaling(mult, offset);
+    }
+    
+    template<typename T>
+    const T* NiftiIO::getDataPointer(const int& fullDims, const std::vector<int64_t>& indexSelect)
+    {
+        const char* mapped = m_file.getMappedData();
+        if (mapped == NULL || !isDirectType<T>()) return NULL;
+        int64_t numElems, numSkip;
+        getSelection(fullDims, indexSelect, numElems, numSkip);
+        int64_t start = m_header.getDataOffset() + numSkip * (int64_t)sizeof(T);
+        if (start + numElems * (int64_t)sizeof(T) > m_file.size()) return NULL;
+        if (((size_t)(mapped + start)) % sizeof(T) != 0) return NULL;//mappings are page aligned, but vox_offset might not be a multiple of the type size
+        return (const T*)(mapped + start);
+    }
+    
+    template<typename T>
+    void NiftiIO::readData(T* dataOut, const int& fullDims, const std::vector<int64_t>& indexSelect, const bool& tolerateShortRead)
+    {
+        readData(dataOut, fullDims, indexSelect, threadScratch(), tolerateShortRead);
+        trimThreadScratch();
+    }
+    
+    template<typename T>
+    void NiftiIO::readData(T* dataOut, const int& fullDims, const std::vector<int64_t>& indexSelect, std::vector<char>& scratch, const bool& tolerateShortRead)
+    {
+        int64_t numElems, numSkip;
+        getSelection(fullDims, indexSelect, numElems, numSkip);
+        if (isDirectType<T>())
+        {//nothing to convert, read straight into the caller's memory
+            const int64_t numBytes = numElems * (int64_t)sizeof(T);
+            int64_t numRead = 0;
+            m_file.readAt(numSkip * numBytesPerElem() + m_header.getDataOffset(), dataOut, numBytes, &numRead);
+            if ((numRead != numBytes && !tolerateShortRead) || numRead < 0)
+            {
+                throw CiftiException("error while reading from file '" + m_file.getFilename() + "'");
+            }
+            if (numRead < numBytes)
+            {
+                std::fill((char*)dataOut + numRead, (char*)dataOut + numBytes, 0);
+            }
+            return;
         }
-        CiftiMutexLocker locked(&m_mutex);//protect starting with resizing until we are done converting, because we use an internal variable for scratch space
         //we can't guarantee that the output memory is enough to use as scratch space, as we might be doing a narrowing conversion
-        //we are doing FILE ACCESS, so cpu performance isn't really something to worry about
-        m_scratch.resize(numElems * numBytesPerElem());
-        m_file.seek(numSkip * numBytesPerElem() + m_header.getDataOffset());
+        const int64_t numBytes = numElems * numBytesPerElem();
+        if ((int64_t)scratch.size() < numBytes) scratch.resize(numBytes);//don't shrink, so alternating sizes doesn't reallocate and re-zero
         int64_t numRead = 0;
-        m_file.read(m_scratch.data(), m_scratch.size(), &numRead);
-        if ((numRead != (int64_t)m_scratch.size() && !tolerateShortRead) || numRead < 0)//for now, assume read giving -1 is always a problem
+        m_file.readAt(numSkip * numBytesPerElem() + m_header.getDataOffset(), scratch.data(), numBytes, &numRead);
+        if ((numRead != numBytes && !tolerateShortRead) || numRead < 0)//for now, assume read giving -1 is always a problem
         {
             throw CiftiException("error while reading from file '" + m_file.getFilename() + "'");
         }
+        if (numRead < numBytes)
+        {//reused scratch contains old data, don't let it leak into a short read
+            std::fill(scratch.begin() + numRead, scratch.begin() + numBytes, 0);
+        }
+        convertFromScratch(dataOut, scratch.data(), numElems);
+    }
+    
+    template<typename T>
+    void NiftiIO::writeData(const T* dataIn, const int& fullDims, const std::vector<int64_t>& indexSelect)
+    {
+        writeData(dataIn, fullDims, indexSelect, threadScratch());
+        trimThreadScratch();
+    }
+    
+    template<typename T>
+    void NiftiIO::writeData(const T* dataIn, const int& fullDims, const std::vector<int64_t>& indexSelect, std::vector<char>& scratch)
+    {
+        int64_t numElems, numSkip;
+        getSelection(fullDims, indexSelect, numElems, numSkip);
+        if (isDirectType<T>())
+        {
+            m_file.writeAt(numSkip * numBytesPerElem() + m_header.getDataOffset(), dataIn, numElems * (int64_t)sizeof(T));
+            return;
+        }
+        const int64_t numBytes = numElems * numBytesPerElem();
+        if ((int64_t)scratch.size() < numBytes) scratch.resize(numBytes);
+        convertToScratch(scratch.data(), dataIn, numElems);
+        m_file.writeAt(numSkip * numBytesPerElem() + m_header.getDataOffset(), scratch.data(), numBytes);
+    }
+    
+    template<typename T>
+    void NiftiIO::convertFromScratch(T* dataOut, char* scratch, const int64_t& numElems)
+    {
         switch (m_header.getDataType())
         {
             case NIFTI_TYPE_UINT8:
             case NIFTI_TYPE_RGB24://handled by components
-                convertRead(dataOut, (uint8_t*)m_scratch.data(), numElems);
+                convertRead(dataOut, (uint8_t*)scratch, numElems);
                 break;
             case NIFTI_TYPE_INT8:
-                convertRead(dataOut, (int8_t*)m_scratch.data(), numElems);
+                convertRead(dataOut, (int8_t*)scratch, numElems);
                 break;
             case NIFTI_TYPE_UINT16:
-                convertRead(dataOut, (uint16_t*)m_scratch.data(), numElems);
+                convertRead(dataOut, (uint16_t*)scratch, numElems);
                 break;
             case NIFTI_TYPE_INT16:
-                convertRead(dataOut, (int16_t*)m_scratch.data(), numElems);
+                convertRead(dataOut, (int16_t*)scratch, numElems);
                 break;
             case NIFTI_TYPE_UINT32:
-                convertRead(dataOut, (uint32_t*)m_scratch.data(), numElems);
+                convertRead(dataOut, (uint32_t*)scratch, numElems);
                 break;
             case NIFTI_TYPE_INT32:
-                convertRead(dataOut, (int32_t*)m_scratch.data(), numElems);
+                convertRead(dataOut, (int32_t*)scratch, numElems);
                 break;
             case NIFTI_TYPE_UINT64:
-                convertRead(dataOut, (uint64_t*)m_scratch.data(), numElems);
+                convertRead(dataOut, (uint64_t*)scratch, numElems);
                 break;
             case NIFTI_TYPE_INT64:
-                convertRead(dataOut, (int64_t*)m_scratch.data(), numElems);
+                convertRead(dataOut, (int64_t*)scratch, numElems);
                 break;
             case NIFTI_TYPE_FLOAT32:
             case NIFTI_TYPE_COMPLEX64://components
-                convertRead(dataOut, (float*)m_scratch.data(), numElems);
+                convertRead(dataOut, (float*)scratch, numElems);
                 break;
             case NIFTI_TYPE_FLOAT64:
             case NIFTI_TYPE_COMPLEX128:
-                convertRead(dataOut, (double*)m_scratch.data(), numElems);
+                convertRead(dataOut, (double*)scratch, numElems);
                 break;
             case NIFTI_TYPE_FLOAT128:
             case NIFTI_TYPE_COMPLEX256:
-                convertRead(dataOut, (long double*)m_scratch.data(), numElems);
+                convertRead(dataOut, (long double*)scratch, numElems);
+                break;
+            case CIFTILIB_TYPE_FLOAT16:
+                convertRead(dataOut, (Float16*)scratch, numElems);
                 break;
             default:
                 throw CiftiException("internal error, tell the developers what you just tried to do");
@@ -156,86 +287,201 @@ namespace cifti
     }
     
     template<typename T>
-    void NiftiIO::writeData(const T* dataIn, const int& fullDims, const std::vector<int64_t>& indexSelect)
+    void NiftiIO::convertToScratch(char* scratch, const T* dataIn, const int64_t& numElems)
     {
-        if (fullDims < 0) throw CiftiException("NiftiIO: fulldims must not be negative");
-        if (fullDims > (int)m_dims.size()) throw CiftiException("NiftiIO: fulldims must not be greater than number of dimensions");
-        if ((size_t)fullDims + indexSelect.size() != m_dims.size())
-        {//could be >=, but should catch more stupid mistakes as ==
-            throw CiftiException("NiftiIO: fulldims plus length of indexSelect must equal number of dimensions");
-        }
-        int64_t numElems = getNumComponents();//for now, calculate read size on the fly, as the read call will be the slowest part
-        int curDim;
-        for (curDim = 0; curDim < fullDims; ++curDim)
-        {
-            numElems *= m_dims[curDim];
-        }
-        int64_t numDimSkip = numElems, numSkip = 0;
-        for (; curDim < (int)m_dims.size(); ++curDim)
-        {
-            if (indexSelect[curDim - fullDims] < 0) throw CiftiException("NiftiIO: indices must not be negative");
-            if (indexSelect[curDim - fullDims] >= m_dims[curDim]) throw CiftiException("NiftiIO: index exceeds nifti dimension length");
-            numSkip += indexSelect[curDim - fullDims] * numDimSkip;
-            numDimSkip *= m_dims[curDim];
-        }
-        CiftiMutexLocker locked(&m_mutex);//protect starting with resizing until we are done writing, because we use an internal variable for scratch space
-        //we are doing FILE ACCESS, so cpu performance isn't really something to worry about
-        m_scratch.resize(numElems * numBytesPerElem());
-        m_file.seek(numSkip * numBytesPerElem() + m_header.getDataOffset());
         switch (m_header.getDataType())
         {
             case NIFTI_TYPE_UINT8:
             case NIFTI_TYPE_RGB24://handled by components
-                convertWrite((uint8_t*)m_scratch.data(), dataIn, numElems);
+                convertWrite((uint8_t*)scratch, dataIn, numElems);
                 break;
             case NIFTI_TYPE_INT8:
-                convertWrite((int8_t*)m_scratch.data(), dataIn, numElems);
+                convertWrite((int8_t*)scratch, dataIn, numElems);
                 break;
             case NIFTI_TYPE_UINT16:
-                convertWrite((uint16_t*)m_scratch.data(), dataIn, numElems);
+                convertWrite((uint16_t*)scratch, dataIn, numElems);
                 break;
             case NIFTI_TYPE_INT16:
-                convertWrite((int16_t*)m_scratch.data(), dataIn, numElems);
+                convertWrite((int16_t*)scratch, dataIn, numElems);
                 break;
             case NIFTI_TYPE_UINT32:
-                convertWrite((uint32_t*)m_scratch.data(), dataIn, numElems);
+                convertWrite((uint32_t*)scratch, dataIn, numElems);
                 break;
             case NIFTI_TYPE_INT32:
-                convertWrite((int32_t*)m_scratch.data(), dataIn, numElems);
+                convertWrite((int32_t*)scratch, dataIn, numElems);
                 break;
             case NIFTI_TYPE_UINT64:
-                convertWrite((uint64_t*)m_scratch.data(), dataIn, numElems);
+                convertWrite((uint64_t*)scratch, dataIn, numElems);
                 break;
             case NIFTI_TYPE_INT64:
-                convertWrite((int64_t*)m_scratch.data(), dataIn, numElems);
+                convertWrite((int64_t*)scratch, dataIn, numElems);
                 break;
             case NIFTI_TYPE_FLOAT32:
             case NIFTI_TYPE_COMPLEX64://components
-                convertWrite((float*)m_scratch.data(), dataIn, numElems);
+                convertWrite((float*)scratch, dataIn, numElems);
                 break;
             case NIFTI_TYPE_FLOAT64:
             case NIFTI_TYPE_COMPLEX128:
-                convertWrite((double*)m_scratch.data(), dataIn, numElems);
+                convertWrite((double*)scratch, dataIn, numElems);
                 break;
             case NIFTI_TYPE_FLOAT128:
             case NIFTI_TYPE_COMPLEX256:
-                convertWrite((long double*)m_scratch.data(), dataIn, numElems);
+                convertWrite((long double*)scratch, dataIn, numElems);
+                break;
+            case CIFTILIB_TYPE_FLOAT16:
+                convertWrite((Float16*)scratch, dataIn, numElems);
                 break;
             default:
                 throw CiftiException("internal error, tell the developers what you just tried to do");
         }
-        m_file.write(m_scratch.data(), m_scratch.size());
+    }
+    
+    template<typename T>
+    void NiftiIO::readDataBatch(T* dataOut, const int& fullDims, const std::vector<std::vector<int64_t> >& indexSelects)
+    {
+        if (indexSelects.empty()) return;
+        int64_t numElems, numSkip;
+        getSelection(fullDims, indexSelects[0], numElems, numSkip);//every selection with the same fullDims is the same size
+        const int64_t selectBytes = numElems * numBytesPerElem();//SCRATCH_KEEP_BYTES of scratch at most, unless a single selection is larger
+        int64_t perBatch = std::max((int64_t)1, SCRATCH_KEEP_BYTES / std::max(selectBytes, (int64_t)1));
+        const bool direct = isDirectType<T>();//if so, the requests point straight into dataOut
+        std::vector<char>& scratch = threadScratch();
+        std::vector<BinaryFile::BatchRequest> requests;
+        for (int64_t start = 0; start < (int64_t)indexSelects.size(); start += perBatch)
+        {
+            int64_t end = std::min((int64_t)indexSelects.size(), start + perBatch);
+            char* buffer = (char*)(dataOut + start * numElems);
+            if (!direct)
+            {
+                if ((int64_t)scratch.size() < (end - start) * selectBytes) scratch.resize((end - start) * selectBytes);
+                buffer = scratch.data();
+            }
+            requests.resize(end - start);
+            for (int64_t i = start; i < end; ++i)
+            {
+                getSelection(fullDims, indexSelects[i], numElems, numSkip);
+                requests[i - start] = BinaryFile::BatchRequest(numSkip * numBytesPerElem() + m_header.getDataOffset(), buffer + (i - start) * selectBytes, selectBytes);
+            }
+            m_file.readAtBatch(requests);
+            if (!direct) convertFromScratch(dataOut + start * numElems, scratch.data(), (end - start) * numElems);
+        }
+        trimThreadScratch();
+    }
+    
+    template<typename T>
+    void NiftiIO::writeDataBatch(const T* dataIn, const int& fullDims, const std::vector<std::vector<int64_t> >& indexSelects)
+    {
+        if (indexSelects.empty()) return;
+        int64_t numElems, numSkip;
+        getSelection(fullDims, indexSelects[0], numElems, numSkip);
+        const int64_t selectBytes = numElems * numBytesPerElem();
+        int64_t perBatch = std::max((int64_t)1, SCRATCH_KEEP_BYTES / std::max(selectBytes, (int64_t)1));
+        const bool direct = isDirectType<T>();
+        std::vector<char>& scratch = threadScratch();
+        std::vector<BinaryFile::BatchRequest> requests;
+        for (int64_t start = 0; start < (int64_t)indexSelects.size(); start += perBatch)
+        {
+            int64_t end = std::min((int64_t)indexSelects.size(), start + perBatch);
+            char* buffer = (char*)(dataIn + start * numElems);//only read from, BatchRequest is shared with reading
+            if (!direct)
+            {
+                if ((int64_t)scratch.size() < (end - start) * selectBytes) scratch.resize((end - start) * selectBytes);
+                convertToScratch(scratch.data(), dataIn + start * numElems, (end - start) * numElems);
+                buffer = scratch.data();
+            }
+            requests.resize(end - start);
+            for (int64_t i = start; i < end; ++i)
+            {
+                getSelection(fullDims, indexSelects[i], numElems, numSkip);
+                requests[i - start] = BinaryFile::BatchRequest(numSkip * numBytesPerElem() + m_header.getDataOffset(), buffer + (i - start) * selectBytes, selectBytes);
+            }
+            m_file.writeAtBatch(requests);
+        }
+        trimThreadScratch();
+    }
+    
+    template<typename T>
+    void NiftiIO::readDataRange(T* dataOut, const int& fullDims, const std::vector<int64_t>& indexSelect, const int64_t& numSelects)
+    {
+        int64_t numElems, numSkip;
+        getSelection(fullDims, indexSelect, numElems, numSkip);
+        int64_t totalSelects = 1;
+        for (int i = fullDims; i < (int)m_dims.size(); ++i) totalSelects *= m_dims[i];
+        if (numSelects < 0 || (numElems > 0 && numSkip / numElems + numSelects > totalSelects)) throw CiftiException("NiftiIO: range exceeds nifti dimensions");
+        if (numElems == 0) return;//a selected dimension has length 0, nothing to transfer
+        const int64_t selectBytes = numElems * numBytesPerElem();//SCRATCH_KEEP_BYTES of scratch at most, unless a single selection is larger
+        int64_t perChunk = std::max((int64_t)1, SCRATCH_KEEP_BYTES / std::max(selectBytes, (int64_t)1));
+        if (isDirectType<T>())
+        {//straight into the caller's memory, chunked the same way
+            for (int64_t start = 0; start < numSelects; start += perChunk)
+            {
+                int64_t numBytes = (std::min(numSelects, start + perChunk) - start) * selectBytes, numRead = 0;
+                m_file.readAt((numSkip + start * numElems) * numBytesPerElem() + m_header.getDataOffset(), dataOut + start * numElems, numBytes, &numRead);
+                if (numRead != numBytes)
+                {
+                    throw CiftiException("error while reading from file '" + m_file.getFilename() + "'");
+                }
+            }
+            return;
+        }
+        std::vector<char>& scratch = threadScratch();
+        for (int64_t start = 0; start < numSelects; start += perChunk)
+        {
+            int64_t end = std::min(numSelects, start + perChunk);
+            int64_t numBytes = (end - start) * selectBytes, numRead = 0;
+            if ((int64_t)scratch.size() < numBytes) scratch.resize(numBytes);
+            m_file.readAt((numSkip + start * numElems) * numBytesPerElem() + m_header.getDataOffset(), scratch.data(), numBytes, &numRead);
+            if (numRead != numBytes)
+            {
+                throw CiftiException("error while reading from file '" + m_file.getFilename() + "'");
+            }
+            convertFromScratch(dataOut + start * numElems, scratch.data(), (end - start) * numElems);
+        }
+        trimThreadScratch();
+    }
+    
+    template<typename T>
+    void NiftiIO::writeDataRange(const T* dataIn, const int& fullDims, const std::vector<int64_t>& indexSelect, const int64_t& numSelects)
+    {
+        int64_t numElems, numSkip;
+        getSelection(fullDims, indexSelect, numElems, numSkip);
+        int64_t totalSelects = 1;
+        for (int i = fullDims; i < (int)m_dims.size(); ++i) totalSelects *= m_dims[i];
+        if (numSelects < 0 || (numElems > 0 && numSkip / numElems + numSelects > totalSelects)) throw CiftiException("NiftiIO: range exceeds nifti dimensions");
+        if (numElems == 0) return;//a selected dimension has length 0, nothing to transfer
+        const int64_t selectBytes = numElems * numBytesPerElem();
+        int64_t perChunk = std::max((int64_t)1, SCRATCH_KEEP_BYTES / std::max(selectBytes, (int64_t)1));
+        if (isDirectType<T>())
+        {
+            for (int64_t start = 0; start < numSelects; start += perChunk)
+            {
+                int64_t numBytes = (std::min(numSelects, start + perChunk) - start) * selectBytes;
+                m_file.writeAt((numSkip + start * numElems) * numBytesPerElem() + m_header.getDataOffset(), dataIn + start * numElems, numBytes);
+            }
+            return;
+        }
+        std::vector<char>& scratch = threadScratch();
+        for (int64_t start = 0; start < numSelects; start += perChunk)
+        {
+            int64_t end = std::min(numSelects, start + perChunk);
+            int64_t numBytes = (end - start) * selectBytes;
+            if ((int64_t)scratch.size() < numBytes) scratch.resize(numBytes);
+            convertToScratch(scratch.data(), dataIn + start * numElems, (end - start) * numElems);
+            m_file.writeAt((numSkip + start * numElems) * numBytesPerElem() + m_header.getDataOffset(), scratch.data(), numBytes);
+        }
+        trimThreadScratch();
     }
     
     template<typename TO, typename FROM>
     void NiftiIO::convertRead(TO* out, FROM* in, const int64_t& count)
     {
+        double mult, offset;
+        bool doScale = m_header.getDataScaling(mult, offset);
+        if (DataConversion::convertRead(out, in, count, m_header.isSwapped(), doScale, mult, offset)) return;//vectorized kernel for a common combination, byteswaps in the same pass, same results as below
         if (m_header.isSwapped())
         {
             ByteSwapping::swapArray(in, count);
         }
-        double mult, offset;
-        bool doScale = m_header.getDataScaling(mult, offset);
         if (std::numeric_limits<TO>::is_integer)//do round to nearest when integer output type
         {
             if (doScale)
@@ -271,6 +517,7 @@ namespace cifti
     {
         double mult, offset;
         bool doScale = m_header.getDataScaling(mult, offset);
+        if (DataConversion::convertWrite(out, in, count, m_header.isSwapped(), doScale, mult, offset)) return;//vectorized kernel for a common combination, byteswaps in the same pass, same results as below
         if (std::numeric_limits<TO>::is_integer)//do round to nearest when integer output type
         {//TODO: what about NaN?
             if (doScale)